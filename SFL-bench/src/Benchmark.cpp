@@ -0,0 +1,119 @@
+#include "Benchmark.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+typedef std::chrono::steady_clock Clock;
+
+static double secondsSince(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// returns the seconds taken and adds the units processed to units
+static double runBatch(const Benchmark &benchmark, size_t iterations, double &units)
+{
+    auto start = Clock::now();
+    for(size_t i = 0; i < iterations; i++)
+    {
+        units += benchmark.iteration();
+    }
+    return secondsSince(start);
+}
+
+bool parseBenchmarkOptions(int argc, const char *argv[], BenchmarkOptions &options)
+{
+    for(int i = 1; i < argc; i++)
+    {
+        const char *arg = argv[i];
+        if(std::strncmp(arg, "--filter=", 9) == 0)
+        {
+            options.filter = arg + 9;
+        }
+        else if(std::strncmp(arg, "--min-time=", 11) == 0)
+        {
+            options.minSampleTime = std::atof(arg + 11);
+        }
+        else if(std::strncmp(arg, "--samples=", 10) == 0)
+        {
+            options.samples = std::max(1, std::atoi(arg + 10));
+        }
+        else if(std::strcmp(arg, "--json") == 0)
+        {
+            options.json = true;
+        }
+        else
+        {
+            std::cerr << "usage: " << argv[0] << " [--filter=<text>] [--min-time=<seconds>] [--samples=<n>] [--json]\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+std::vector<BenchmarkResult> runBenchmarks(const std::vector<Benchmark> &benchmarks, const BenchmarkOptions &options)
+{
+    std::vector<BenchmarkResult> results;
+    for(const auto &benchmark : benchmarks)
+    {
+        if(benchmark.name.find(options.filter) == std::string::npos)
+        {
+            continue;
+        }
+
+        // warm up and find a batch size that takes long enough to time reliably
+        size_t iterations = 1;
+        double units = 0;
+        while(runBatch(benchmark, iterations, units) < options.minSampleTime)
+        {
+            iterations *= 2;
+        }
+
+        std::vector<double> times;
+        double unitsPerIteration = 0;
+        for(int i = 0; i < options.samples; i++)
+        {
+            units = 0;
+            times.push_back(runBatch(benchmark, iterations, units) / iterations);
+            unitsPerIteration = units / iterations;
+        }
+        std::sort(times.begin(), times.end());
+        double median = times[times.size() / 2];
+
+        results.push_back(BenchmarkResult{benchmark.name, benchmark.unit, iterations, median * 1e9, unitsPerIteration / median});
+    }
+    return results;
+}
+
+// scales a rate to at most three digits before the point for the table
+static void printRate(double perSecond, const std::string &unit)
+{
+    const char *prefixes[] = {"", "k", "M", "G"};
+    int prefix = 0;
+    while(perSecond >= 1000 && prefix < 3)
+    {
+        perSecond /= 1000;
+        prefix++;
+    }
+    std::printf("%10.2f %s%s/s\n", perSecond, prefixes[prefix], unit.c_str());
+}
+
+void printBenchmarkResults(const std::vector<BenchmarkResult> &results, const BenchmarkOptions &options)
+{
+    for(const auto &result : results)
+    {
+        if(options.json)
+        {
+            std::printf("{\"name\": \"%s\", \"iterations\": %zu, \"ns_per_iteration\": %.1f, \"unit\": \"%s\", \"per_second\": %.1f}\n",
+                result.name.c_str(), result.iterations, result.nsPerIteration, result.unit.c_str(), result.unitsPerSecond);
+        }
+        else
+        {
+            std::printf("%-32s %14.0f ns/iter", result.name.c_str(), result.nsPerIteration);
+            printRate(result.unitsPerSecond, result.unit);
+        }
+    }
+}
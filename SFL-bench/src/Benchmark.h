@@ -0,0 +1,47 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+// A small harness for timing the stages of SFL. Each benchmark runs one
+// iteration per call and returns how many units (bytes, nodes, operations...)
+// that iteration processed, so results can be reported as throughput.
+struct Benchmark
+{
+    std::string name;
+    std::string unit;
+    std::function<double()> iteration;
+};
+
+struct BenchmarkResult
+{
+    std::string name;
+    std::string unit;
+    size_t iterations;      // per sample
+    double nsPerIteration;  // median over the samples
+    double unitsPerSecond;
+};
+
+struct BenchmarkOptions
+{
+    std::string filter;         // only run benchmarks whose name contains this
+    double minSampleTime = 0.1; // seconds each sample runs for at least
+    int samples = 5;
+    bool json = false;
+};
+
+// returns false and prints the usage if the arguments could not be parsed
+bool parseBenchmarkOptions(int argc, const char *argv[], BenchmarkOptions &options);
+
+std::vector<BenchmarkResult> runBenchmarks(const std::vector<Benchmark> &benchmarks, const BenchmarkOptions &options);
+
+// a table for people, or one JSON object per line for comparing builds
+void printBenchmarkResults(const std::vector<BenchmarkResult> &results, const BenchmarkOptions &options);
+
+// keeps the compiler from discarding a result that is otherwise unused
+template<typename T>
+inline void doNotOptimize(const T &value)
+{
+    asm volatile("" : : "r,m"(value) : "memory");
+}
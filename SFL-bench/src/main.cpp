@@ -0,0 +1,457 @@
+#include "Benchmark.h"
+
+#include <Lexer/Lexer.h>
+#include <Parser/Parser.h>
+#include <Parser/ASTCache.h>
+#include <Interpreter/EventLoop.h>
+#include <Interpreter/Interpreter.h>
+#include <Interpreter/Program.h>
+#include <SFL/BatchRunner.h>
+
+#include <cstdlib>
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <thread>
+#include <string>
+
+// ----- programs -----
+
+static std::string numericLoop()
+{
+    return R"(
+        i = 0;
+        total = 0;
+        while (i == 100000) == 0 begin
+            total = total + i * 2 - i / 4;
+            i = i + 1;
+        end
+    )";
+}
+
+static std::string stringBuilding()
+{
+    return R"(
+        i = 0;
+        s = "";
+        while (i == 20000) == 0 begin
+            s = s + "ab" + "c";
+            i = i + 1;
+        end
+    )";
+}
+
+// one long expression evaluated over and over
+static std::string deepExpression()
+{
+    std::string expression = "i";
+    for(int i = 0; i < 200; i++)
+    {
+        expression = "(" + expression + (i % 2 ? " + " : " * ") + std::to_string(i % 7 + 1) + ")";
+    }
+    return "i = 0; while (i == 1000) == 0 begin x = " + expression + "; i = i + 1; end";
+}
+
+// many short statements with no loops
+static std::string flatScript()
+{
+    std::string src;
+    for(int i = 0; i < 20000; i++)
+    {
+        std::string name = "v" + std::to_string(i % 500);
+        src += name + " = " + std::to_string(i) + " * 2 + 1; # line " + std::to_string(i) + "\n";
+        src += "if " + name + " == 3 begin w = \"three\" + \"!\"; end\n";
+    }
+    return src;
+}
+
+// deep recursion, so mostly the cost of calling and returning
+static std::string recursiveCalls()
+{
+    return R"(
+        function fib(n) begin
+            if n == 0 begin return 0; end
+            if n == 1 begin return 1; end
+            return fib(n - 1) + fib(n - 2);
+        end
+        x = fib(20);
+    )";
+}
+
+// a small helper called from a tight loop
+static std::string helperCalls()
+{
+    return R"(
+        function step(total, i) begin
+            return total + i * 2 - i / 4;
+        end
+        i = 0;
+        total = 0;
+        while (i == 100000) == 0 begin
+            total = step(total, i);
+            i = i + 1;
+        end
+    )";
+}
+
+// a C function from a shared library called from a tight loop
+static std::string nativeCalls()
+{
+    return R"sfl(
+        dll_import("libm.so.6");
+        dll_bind("fabs", "double(double)");
+        i = 0;
+        total = 0;
+        while (i == 100000) == 0 begin
+            total = total + fabs(i - 50000);
+            i = i + 1;
+        end
+    )sfl";
+}
+
+struct Script
+{
+    std::string name;
+    std::string source;
+};
+
+static size_t countNodes(const AST::Node *node)
+{
+    size_t count = 1;
+    for(uint32_t i = 0; i < node->childCount; i++)
+    {
+        count += countNodes(node->child(i));
+    }
+    return count;
+}
+
+// ----- benchmarks -----
+
+static void addProgramBenchmarks(std::vector<Benchmark> &benchmarks, const Script &program)
+{
+    auto lexemes = std::make_shared<LexemeList>(Lexer::lexString(program.source));
+    auto ast = std::make_shared<AST>(*lexemes);
+    double nodes = static_cast<double>(countNodes(ast->getRoot()));
+
+    benchmarks.push_back({"lexer/" + program.name, "B", [program]()
+    {
+        doNotOptimize(Lexer::lexString(program.source).size());
+        return static_cast<double>(program.source.size());
+    }});
+
+    benchmarks.push_back({"parser/" + program.name, "nodes", [lexemes, nodes]()
+    {
+        AST ast(*lexemes);
+        doNotOptimize(ast.getRoot());
+        return nodes;
+    }});
+
+    benchmarks.push_back({"lex+parse/" + program.name, "B", [program]()
+    {
+        LexemeStream stream(program.source);
+        AST ast(stream);
+        doNotOptimize(ast.getRoot());
+        return static_cast<double>(program.source.size());
+    }});
+
+    // the warm start path: hash the source and map the entry written by an earlier run
+    const char *temporary = std::getenv("TMPDIR");
+    std::string entry = std::string(temporary ? temporary : "/tmp") + "/sfl-bench-" + program.name + ".sflc";
+    if(ASTCache::write(entry, ASTCache::hash(program.source), *ast))
+    {
+        benchmarks.push_back({"cache-load/" + program.name, "B", [program, entry]()
+        {
+            doNotOptimize(ASTCache::read(entry, ASTCache::hash(program.source))->getRoot());
+            return static_cast<double>(program.source.size());
+        }});
+    }
+
+    benchmarks.push_back({"interpreter/" + program.name, "runs", [ast]()
+    {
+        Interpreter interpreter;
+        interpreter.setForeignImports(true);
+        interpreter.run(*ast);
+        return 1.0;
+    }});
+
+    benchmarks.push_back({"jit/" + program.name, "runs", [ast]()
+    {
+        Interpreter interpreter;
+        interpreter.setJit(true);
+        interpreter.setForeignImports(true);
+        interpreter.run(*ast);
+        return 1.0;
+    }});
+}
+
+static void addValueBenchmarks(std::vector<Benchmark> &benchmarks)
+{
+    const int count = 100000;
+
+    benchmarks.push_back({"value/add-numbers", "ops", [count]()
+    {
+        Value total = Value::createNumber(0);
+        Value step = Value::createNumber(1.5);
+        for(int i = 0; i < count; i++)
+        {
+            total = Value::add(total, step);
+        }
+        doNotOptimize(total.getNumber());
+        return static_cast<double>(count);
+    }});
+
+    benchmarks.push_back({"value/equals-numbers", "ops", [count]()
+    {
+        Value a = Value::createNumber(3);
+        Value b = Value::createNumber(4);
+        double trues = 0;
+        for(int i = 0; i < count; i++)
+        {
+            trues += Value::equals(a, b).getNumber();
+        }
+        doNotOptimize(trues);
+        return static_cast<double>(count);
+    }});
+
+    benchmarks.push_back({"value/concat-append", "ops", [count]()
+    {
+        Value s = Value::createString("");
+        Value piece = Value::createString("abc");
+        for(int i = 0; i < count; i++)
+        {
+            s = Value::add(s, piece);
+        }
+        doNotOptimize(s.getString().size());
+        return static_cast<double>(count);
+    }});
+
+    benchmarks.push_back({"value/concat-copy", "ops", [count]()
+    {
+        // longer grows the buffer past base, so every concatenation onto base has to copy
+        Value base = Value::createString(std::string(64, 'x'));
+        Value piece = Value::createString("abc");
+        Value longer = Value::add(base, piece);
+        for(int i = 0; i < count; i++)
+        {
+            doNotOptimize(Value::add(base, piece).getString().size());
+        }
+        return static_cast<double>(count);
+    }});
+
+    benchmarks.push_back({"value/equals-strings", "ops", [count]()
+    {
+        Value a = Value::createString(std::string(32, 'x') + "a");
+        Value b = Value::createString(std::string(32, 'x') + "b");
+        double trues = 0;
+        for(int i = 0; i < count; i++)
+        {
+            trues += Value::equals(a, b).getNumber();
+        }
+        doNotOptimize(trues);
+        return static_cast<double>(count);
+    }});
+
+    benchmarks.push_back({"value/to-string", "ops", [count]()
+    {
+        Value number = Value::createNumber(1234.5);
+        size_t length = 0;
+        for(int i = 0; i < count / 10; i++)
+        {
+            length += number.asString().size();
+        }
+        doNotOptimize(length);
+        return static_cast<double>(count / 10);
+    }});
+}
+
+int main(const int argc, const char *argv[])
+{
+    BenchmarkOptions options;
+    if(!parseBenchmarkOptions(argc, argv, options))
+    {
+        return 1;
+    }
+
+#ifndef NDEBUG
+    std::cerr << "warning: built without NDEBUG, configure with -DCMAKE_BUILD_TYPE=Release for meaningful numbers\n";
+#endif
+
+    const std::vector<Script> programs =
+    {
+        {"numeric-loop", numericLoop()},
+        {"string-building", stringBuilding()},
+        {"deep-expression", deepExpression()},
+        {"calls-fib", recursiveCalls()},
+        {"calls-helper-loop", helperCalls()},
+        {"calls-native-loop", nativeCalls()},
+        {"flat-script", flatScript()}, // last, it is repeated for the large lexer benchmarks
+    };
+
+    std::vector<Benchmark> benchmarks;
+    for(const auto &program : programs)
+    {
+        addProgramBenchmarks(benchmarks, program);
+    }
+
+    const std::string largeSource = [&]()
+    {
+        std::string source;
+        while(source.size() < (16 << 20)) source += programs.back().source;
+        return source;
+    }();
+    benchmarks.push_back({"lexer/large-parallel", "B", [&largeSource]()
+    {
+        doNotOptimize(Lexer::lexString(largeSource, 0).size());
+        return static_cast<double>(largeSource.size());
+    }});
+    benchmarks.push_back({"lexer/large-sequential", "B", [&largeSource]()
+    {
+        doNotOptimize(Lexer::lexString(largeSource).size());
+        return static_cast<double>(largeSource.size());
+    }});
+
+    AST registered(Lexer::lexString(R"(
+        i = 0;
+        total = 0;
+        while (i == 100000) == 0 begin
+            total = total + scale(i, 2);
+            i = i + 1;
+        end
+    )"));
+    benchmarks.push_back({"interpreter/registered-call-loop", "runs", [&registered]()
+    {
+        Interpreter interpreter;
+        interpreter.registerFunction("scale", [](double x, double by) { return x * by; });
+        interpreter.run(registered);
+        return 1.0;
+    }});
+
+    // the same loop run in slices, as a host sharing a thread between scripts would
+    AST sliced(Lexer::lexString(numericLoop()));
+    for(bool jit : {false, true})
+    {
+        benchmarks.push_back({std::string(jit ? "jit" : "interpreter") + "/numeric-loop-sliced", "runs", [&sliced, jit]()
+        {
+            Interpreter interpreter;
+            interpreter.setJit(jit);
+            RunStatus status = interpreter.run(sliced, RunLimits::withFuel(10000));
+            while(status != RunStatus::Finished)
+            {
+                status = interpreter.resume(RunLimits::withFuel(10000));
+            }
+            return 1.0;
+        }});
+    }
+
+    // scripts that each wait on a run of async calls, all in flight on one
+    // thread, with every call finished through the event loop
+    AST waiting(Lexer::lexString(R"(
+        i = 0;
+        while (i == 10) == 0 begin
+            i = i + echo(1);
+        end
+    )"));
+    benchmarks.push_back({"interpreter/async-scripts-in-flight", "scripts", [&waiting]()
+    {
+        const int Scripts = 1000;
+        EventLoop loop;
+        std::vector<std::unique_ptr<Interpreter>> interpreters;
+        for(int i = 0; i < Scripts; i++)
+        {
+            interpreters.push_back(std::make_unique<Interpreter>());
+            interpreters.back()->registerAsyncFunction("echo", [&loop](Completion completion, double x)
+            {
+                loop.post([completion, x]() mutable { completion.resolve(x); });
+            });
+            loop.start(*interpreters.back(), waiting, [](std::exception_ptr) {});
+        }
+        loop.run();
+        return double(Scripts);
+    }});
+
+    AST printing(Lexer::lexString(R"(
+        i = 0;
+        while (i == 20000) == 0 begin
+            print(i / 8, " ", "line\n");
+            i = i + 1;
+        end
+    )"));
+    benchmarks.push_back({"interpreter/print-heavy", "runs", [&printing]()
+    {
+        std::string output;
+        Interpreter interpreter;
+        interpreter.setOutput(OutputSink::memory(output));
+        interpreter.run(printing);
+        doNotOptimize(output.size());
+        return 1.0;
+    }});
+
+    // the same compiled program run in many contexts at once, on one thread and on all of them
+    auto shared = std::make_shared<const Program>(AST(Lexer::lexString(programs[0].source)));
+    std::vector<unsigned> threadCounts = {1};
+    if(std::thread::hardware_concurrency() > 1)
+    {
+        threadCounts.push_back(std::thread::hardware_concurrency());
+    }
+    for(unsigned threads : threadCounts)
+    {
+        auto runner = std::make_shared<ContextRunner>(threads);
+        auto contexts = std::make_shared<std::vector<Context>>();
+        for(unsigned i = 0; i < threads * 8; i++)
+        {
+            contexts->emplace_back(shared);
+        }
+        benchmarks.push_back({"contexts/numeric-loop-" + std::to_string(threads) + "-threads", "runs", [runner, contexts]()
+        {
+            runner->run(*contexts);
+            return static_cast<double>(contexts->size());
+        }});
+    }
+
+    // a batch where the first eighth of the scripts do nearly all the work, so a
+    // static split leaves most workers idle. The table shows throughput; how
+    // busy the workers were is printed to stderr afterwards.
+    std::vector<std::string> skewed;
+    for(int i = 0; i < 256; i++)
+    {
+        int count = i < 32 ? 20000 : 200;
+        skewed.push_back("i = 0; while (i == " + std::to_string(count) + ") == 0 begin i = i + 1; end");
+    }
+    std::vector<std::pair<std::string, std::shared_ptr<BatchRunner>>> batchRunners;
+    for(bool stealing : {true, false})
+    {
+        auto runner = std::make_shared<BatchRunner>(std::max(4u, std::thread::hardware_concurrency()));
+        runner->setStealing(stealing);
+        std::string name = stealing ? "batch/skewed-stealing" : "batch/skewed-static";
+        batchRunners.push_back({name, runner});
+        benchmarks.push_back({name, "jobs", [runner, &skewed]()
+        {
+            doNotOptimize(runner->run(skewed).size());
+            return static_cast<double>(skewed.size());
+        }});
+    }
+
+    addValueBenchmarks(benchmarks);
+
+    try
+    {
+        printBenchmarkResults(runBenchmarks(benchmarks, options), options);
+        std::fflush(stdout);
+        for(const auto &named : batchRunners)
+        {
+            const BatchStats &stats = named.second->getStats();
+            if(!stats.jobs.empty())
+            {
+                auto most = std::max_element(stats.busySeconds.begin(), stats.busySeconds.end());
+                std::fprintf(stderr, "%s: %u workers %.0f%% utilized, busiest %.1f ms of %.1f ms, %llu steals\n",
+                    named.first.c_str(), named.second->workerCount(), stats.utilization() * 100,
+                    *most * 1e3, stats.seconds * 1e3, static_cast<unsigned long long>(stats.steals));
+            }
+        }
+    }
+    catch(const std::exception &e)
+    {
+        std::cerr << e.what() << '\n';
+        return 1;
+    }
+}
@@ -1,8 +1,20 @@
 #include <SFL/SFL.h>
 #include <iostream>
+#include <string>
 
 int main(const int argc, const char *argv[])
 {
+    if(argc > 1 && std::string(argv[1]) == "--repl")
+    {
+        SFL::repl();
+        return 0;
+    }
+    if(argc > 1)
+    {
+        SFL::runFile(argv[1]);
+        return 0;
+    }
+
     std::cout << "Hello World!\n";
     SFL::test();
 }
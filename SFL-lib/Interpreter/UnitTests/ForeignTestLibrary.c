@@ -0,0 +1,63 @@
+// Functions for the dll_import and dll_bind tests to call.
+
+#include <stddef.h>
+#include <string.h>
+
+static double remembered = 0;
+
+double scale(double x, double by)
+{
+    return x * by;
+}
+
+int add_ints(int a, int b)
+{
+    return a + b;
+}
+
+long count_char(const char *text, int c)
+{
+    long count = 0;
+    for(; *text; text++)
+    {
+        if(*text == c) count++;
+    }
+    return count;
+}
+
+long buffer_length(const char *data, size_t size)
+{
+    // the characters may go on past size, so only the length is trusted
+    return data ? (long)size : -1;
+}
+
+// integers and doubles interleaved, to check each lands where it should
+double mixed(long a, double b, const char *text, double c, int d)
+{
+    return (double)a * 10000 + b * 1000 + (double)strlen(text) * 100 + c * 10 + d;
+}
+
+long six(long a, long b, long c, long d, long e, long f)
+{
+    return a + b * 2 + c * 3 + d * 4 + e * 5 + f * 6;
+}
+
+const char *greeting(void)
+{
+    return "hello";
+}
+
+const char *nothing(void)
+{
+    return NULL;
+}
+
+void remember(double x)
+{
+    remembered = x;
+}
+
+double recall(void)
+{
+    return remembered;
+}
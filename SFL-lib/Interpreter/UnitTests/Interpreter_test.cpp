@@ -1,5 +1,1596 @@
+#include <Interpreter/EventLoop.h>
 #include <Interpreter/Interpreter.h>
+#include <Interpreter/InterpreterError.h>
+#include <Interpreter/Program.h>
+#include <Interpreter/Repl.h>
+#include <Parser/Optimizer.h>
+
+#include <chrono>
+#include <limits>
+#include <map>
+#include <sstream>
+#include <thread>
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
 
 #include <gtest/gtest.h>
 #include <gmock/gmock.h>
 using namespace ::testing;
+
+TEST(Value, types)
+{
+    ASSERT_TRUE(::Value().isUndefined());
+    ASSERT_TRUE(::Value::createNumber(1).isNumber());
+    ASSERT_TRUE(::Value::createString("a").isString());
+    ASSERT_EQ(::Value::createNumber(2).getNumber(), 2);
+    ASSERT_EQ(::Value::createString("a").getString(), "a");
+}
+
+TEST(Value, copiesShareStrings)
+{
+    ::Value a = ::Value::createString("shared");
+    ::Value b = a;
+    ::Value c = ::Value::createNumber(3);
+    c = b;
+    b = ::Value::createNumber(1);
+    ASSERT_EQ(a.getString(), "shared");
+    ASSERT_EQ(a.getString().data(), c.getString().data());
+
+    ::Value moved = std::move(c);
+    ASSERT_TRUE(c.isUndefined());
+    ASSERT_EQ(moved.getString(), "shared");
+}
+
+TEST(Value, concatenationKeepsOperandsIntact)
+{
+    ::Value s = ::Value::createString("abc");
+    ::Value t = ::Value::add(s, ::Value::createString("x"));
+    ::Value u = ::Value::add(s, ::Value::createString("y"));
+    ::Value v = ::Value::add(t, t);
+    ASSERT_EQ(s.getString(), "abc");
+    ASSERT_EQ(t.getString(), "abcx");
+    ASSERT_EQ(u.getString(), "abcy");
+    ASSERT_EQ(v.getString(), "abcxabcx");
+    ASSERT_EQ(::Value::equals(::Value::add(s, ::Value::createString("x")), t).getNumber(), 1);
+
+    // t was extended in place, so the buffer is shared
+    ASSERT_EQ(s.getString().data(), t.getString().data());
+}
+
+TEST(Value, operations)
+{
+    auto n = ::Value::createNumber;
+    auto s = [](const char *str) { return ::Value::createString(str); };
+
+    ASSERT_EQ(::Value::add(n(1), n(2)).getNumber(), 3);
+    ASSERT_EQ(::Value::sub(n(1), n(2)).getNumber(), -1);
+    ASSERT_EQ(::Value::mul(n(3), n(2)).getNumber(), 6);
+    ASSERT_EQ(::Value::div(n(3), n(2)).getNumber(), 1.5);
+    ASSERT_EQ(::Value::equals(n(3), n(3)).getNumber(), 1);
+    ASSERT_EQ(::Value::add(s("a"), s("b")).getString(), "ab");
+    ASSERT_EQ(::Value::equals(s("a"), s("a")).getNumber(), 1);
+    ASSERT_EQ(::Value::equals(s("a"), s("b")).getNumber(), 0);
+
+    ASSERT_THROW(::Value::add(n(1), s("b")), InterpreterError);
+    ASSERT_THROW(::Value::equals(s("a"), n(1)), InterpreterError);
+    ASSERT_THROW(::Value::mul(s("a"), s("b")), InterpreterError);
+}
+
+std::string runCapturingOutput(Interpreter &interpreter, const std::string &src)
+{
+    AST ast(Lexer::lexString(src));
+    testing::internal::CaptureStdout();
+    try
+    {
+        interpreter.run(ast);
+    }
+    catch(...)
+    {
+        testing::internal::GetCapturedStdout();
+        throw;
+    }
+    return testing::internal::GetCapturedStdout();
+}
+
+std::string runCapturingOutput(const std::string &src)
+{
+    Interpreter interpreter;
+    return runCapturingOutput(interpreter, src);
+}
+
+TEST(Interpreter, empty)
+{
+    ASSERT_EQ(runCapturingOutput(""), "");
+}
+
+TEST(Interpreter, print)
+{
+    ASSERT_EQ(runCapturingOutput(R"(print("a", 1, "b", 2.5);)"), "a1b2.5");
+}
+
+TEST(Interpreter, arithmetic)
+{
+    ASSERT_EQ(runCapturingOutput("print(1 + 2 * 3 - 4 / 2);"), "5");
+    ASSERT_EQ(runCapturingOutput("print((1 + 2) * 3);"), "9");
+    ASSERT_EQ(runCapturingOutput("print(2 == 2, 2 == 3);"), "10");
+    ASSERT_EQ(runCapturingOutput(R"(print("a" + "b", "a" == "a");)"), "ab1");
+}
+
+TEST(Interpreter, assignment)
+{
+    Interpreter interpreter;
+    runCapturingOutput(interpreter, "a = 1; b = a + 1; a = b * 10;");
+    ASSERT_EQ(interpreter.getGlobalVariable("a").asString(), "20");
+    ASSERT_EQ(interpreter.getGlobalVariable("b").asString(), "2");
+}
+
+TEST(Interpreter, globalsPersistBetweenRuns)
+{
+    Interpreter interpreter;
+    interpreter.setGlobalVariable("x", ::Value::createNumber(4));
+    ASSERT_EQ(runCapturingOutput(interpreter, "x = x + 1; print(x);"), "5");
+    ASSERT_EQ(runCapturingOutput(interpreter, "print(x);"), "5");
+}
+
+TEST(Interpreter, unassignedGlobals)
+{
+    Interpreter interpreter;
+    ASSERT_THROW(interpreter.getGlobalVariable("never"), InterpreterError);
+
+    // compiling a program gives b a slot, but it is still unset when it is read
+    ASSERT_THROW(runCapturingOutput(interpreter, "a = 1; print(b);"), InterpreterError);
+    ASSERT_THROW(interpreter.getGlobalVariable("b"), InterpreterError);
+    ASSERT_EQ(interpreter.getGlobalVariable("a").asString(), "1");
+
+    interpreter.setGlobalVariable("b", ::Value::createString("set by host"));
+    ASSERT_EQ(runCapturingOutput(interpreter, "print(b);"), "set by host");
+}
+
+TEST(Interpreter, ifStatement)
+{
+    ASSERT_EQ(runCapturingOutput(R"(if 1 == 1 begin print("yes"); end if 1 == 2 begin print("no"); end)"), "yes");
+    ASSERT_EQ(runCapturingOutput(R"(if "" begin print("no"); end if "s" begin print("yes"); end)"), "yes");
+}
+
+TEST(Interpreter, whileStatement)
+{
+    ASSERT_EQ(runCapturingOutput("i = 0; while i == 0 begin print(i); i = 1; end print(i);"), "01");
+
+    Interpreter interpreter;
+    runCapturingOutput(interpreter, R"(
+        i = 0;
+        total = 0;
+        s = "";
+        done = 0;
+        while done == 0 begin
+            i = i + 1;
+            total = total + i;
+            s = s + "x";
+            done = i == 100;
+        end
+    )");
+    ASSERT_EQ(interpreter.getGlobalVariable("total").asString(), "5050");
+    ASSERT_EQ(interpreter.getGlobalVariable("s").asString().size(), 100);
+}
+
+TEST(Interpreter, stringBuilding)
+{
+    Interpreter interpreter;
+    runCapturingOutput(interpreter, R"(
+        i = 0;
+        s = "";
+        copy = "";
+        while (i == 20000) == 0 begin
+            s = s + "ab" + "c";
+            if i == 10 begin
+                copy = s;
+            end
+            i = i + 1;
+        end
+    )");
+    ASSERT_EQ(interpreter.getGlobalVariable("s").asString().size(), 60000);
+    ASSERT_EQ(interpreter.getGlobalVariable("copy").asString(), "abcabcabcabcabcabcabcabcabcabcabc");
+}
+
+TEST(Interpreter, nestedLoops)
+{
+    ASSERT_EQ(runCapturingOutput(R"(
+        i = 0;
+        while (i == 3) == 0 begin
+            j = 0;
+            while (j == 2) == 0 begin
+                print(i, j, " ");
+                j = j + 1;
+            end
+            i = i + 1;
+        end
+    )"), "00 01 10 11 20 21 ");
+}
+
+TEST(Interpreter, errors)
+{
+    ASSERT_THROW(runCapturingOutput("print(a);"), InterpreterError);
+    ASSERT_THROW(runCapturingOutput(R"(print(1 + "a");)"), InterpreterError);
+    ASSERT_THROW(runCapturingOutput(R"(print("a" - "a");)"), InterpreterError);
+    ASSERT_THROW(runCapturingOutput("foo();"), InterpreterError);
+    ASSERT_THROW(runCapturingOutput("1 + 2;"), InterpreterError);
+}
+
+TEST(Interpreter, profiling)
+{
+    const std::string src = "i = 0;\nwhile (i == 10) == 0 begin\n    i = i + 1;\nend\n";
+    AST ast(Lexer::lexString(src));
+
+    // nothing extra is compiled in unless profiling
+    SlotTable slots;
+    for(const auto &instruction : Compiler::compile(ast, slots).code)
+    {
+        ASSERT_NE(instruction.op, OpCode::ProfileEnter);
+        ASSERT_NE(instruction.op, OpCode::ProfileExit);
+    }
+
+    Interpreter interpreter;
+    ASSERT_EQ(interpreter.getProfiler(), nullptr);
+    interpreter.setProfiling(true);
+    interpreter.run(ast);
+    interpreter.run(ast);
+
+    const Profiler *profiler = interpreter.getProfiler();
+    ASSERT_NE(profiler, nullptr);
+    std::map<std::pair<int, AST::Node::Type>, uint64_t> counts;
+    for(const auto &entry : profiler->entries())
+    {
+        counts[{entry.lineNumber, entry.type}] += entry.count;
+        ASSERT_GE(entry.inclusive, entry.exclusive);
+    }
+    // both runs add to the same sites. The condition has two Equals nodes.
+    EXPECT_EQ((counts[{1, AST::Node::Type::Assign}]), 2);
+    EXPECT_EQ((counts[{2, AST::Node::Type::While}]), 2);
+    EXPECT_EQ((counts[{2, AST::Node::Type::Equals}]), 2 * 2 * 11);
+    EXPECT_EQ((counts[{3, AST::Node::Type::Assign}]), 2 * 10);
+    EXPECT_EQ((counts[{3, AST::Node::Type::Add}]), 2 * 10);
+
+    const auto hotSpots = profiler->hotSpots();
+    for(size_t i = 1; i < hotSpots.size(); i++)
+    {
+        ASSERT_GE(hotSpots[i - 1].exclusive, hotSpots[i].exclusive);
+    }
+
+    std::ostringstream report;
+    profiler->report(report, src);
+    EXPECT_NE(report.str().find("i = i + 1;"), std::string::npos);
+    EXPECT_NE(report.str().find("3:"), std::string::npos);
+
+    // runs that stop with an error still close their sites
+    ASSERT_THROW(runCapturingOutput(interpreter, "j = 1;\nprint(j + \"a\");"), InterpreterError);
+    ASSERT_NO_THROW(interpreter.run(ast));
+
+    interpreter.setProfiling(false);
+    ASSERT_EQ(interpreter.getProfiler(), nullptr);
+}
+
+// the output of a run, or the error it stopped with
+std::string runResult(const std::string &src, bool optimize)
+{
+    AST ast(Lexer::lexString(src));
+    if(optimize) Optimizer::optimize(ast);
+
+    Interpreter interpreter;
+    testing::internal::CaptureStdout();
+    try
+    {
+        interpreter.run(ast);
+    }
+    catch(const InterpreterError &e)
+    {
+        return testing::internal::GetCapturedStdout() + "error: " + e.what();
+    }
+    return testing::internal::GetCapturedStdout();
+}
+
+TEST(Interpreter, optimizedRunsMatch)
+{
+    const std::string programs[] =
+    {
+        R"(print(60 * 60 * 24, " ", 1 / 3, " ", 1 / 0, " ", 0.1 + 0.2, " ", 2 == 2);)",
+        R"(s = "a" + "b" + "c"; print(s + s, "x" == "x", "x" == "y");)",
+        R"(if 1 == 1 begin print("yes"); end if 1 == 0 begin print("no"); end if "" begin print("empty"); end)",
+        R"(if 2 begin print("two"); end while 0 begin print("never"); end print("done");)",
+        R"(i = 0; while (i == 3) == 0 begin if (2 * 2) == 4 begin print(i); end i = i + 1; end)",
+        R"(print("before"); if 1 == 1 begin print(1 + "a"); end)",
+        R"(if 1 == 0 begin print(1 + "a"); end print("x" * "y");)",
+        R"(print(1 == "a");)",
+        R"(x = 7; function f() begin if 0 begin x = 5; end return x; end print(f());)",
+        R"(x = 7; function f() begin while 0 begin if 1 begin x = 1; end end x = 2; return x; end print(f(), x);)",
+    };
+    for(const auto &src : programs)
+    {
+        EXPECT_EQ(runResult(src, true), runResult(src, false)) << src;
+    }
+}
+
+// runs src with the JIT on and off and checks both leave the same globals and output
+void expectJitMatches(const std::string &src, const std::vector<std::string> &globals, JitStats &stats)
+{
+    Interpreter interpreted;
+    Interpreter jitted;
+    jitted.setJit(true);
+
+    std::string expected = runCapturingOutput(interpreted, src);
+    ASSERT_EQ(runCapturingOutput(jitted, src), expected);
+    for(const auto &name : globals)
+    {
+        ASSERT_EQ(jitted.getGlobalVariable(name).getTypeAsString(), interpreted.getGlobalVariable(name).getTypeAsString()) << name;
+        ASSERT_EQ(jitted.getGlobalVariable(name).asString(), interpreted.getGlobalVariable(name).asString()) << name;
+    }
+    stats = jitted.getJitStats();
+}
+
+TEST(Interpreter, jit)
+{
+    if(!JitCompiler::isSupported())
+    {
+        GTEST_SKIP();
+    }
+
+    JitStats stats;
+    expectJitMatches(R"(
+        i = 0;
+        total = 0;
+        odd = 0;
+        while (i == 1000) == 0 begin
+            total = total + i * 3 - i / 7;
+            if odd == 1 begin
+                total = total - 1;
+            end
+            odd = (odd == 0);
+            i = i + 1;
+        end
+        inf = 1 / 0;
+        nan = inf - inf;
+        same = 0;
+        j = 0;
+        while (j == 100) == 0 begin
+            same = same + (nan == nan) + (inf == inf);
+            j = j + 1;
+        end
+    )", {"i", "total", "odd", "same"}, stats);
+    EXPECT_EQ(stats.compiled, 2);
+    EXPECT_EQ(stats.entries, 2);
+
+    // the inner loop runs compiled until x turns into a string, then falls back
+    expectJitMatches(R"(
+        k = 0;
+        x = 1;
+        while (k == 4) == 0 begin
+            if k == 2 begin
+                x = "s";
+            end
+            j = 0;
+            while (j == 100) == 0 begin
+                t = x;
+                j = j + 1;
+            end
+            k = k + 1;
+        end
+    )", {"k", "j", "t"}, stats);
+    EXPECT_EQ(stats.compiled, 1);
+    EXPECT_EQ(stats.entries, 2);
+    // while x is a string the types are checked on the first back edge and then
+    // once every JitTier::Threshold of the 200 that follow
+    EXPECT_EQ(stats.deopts, 1 + 200 / JitTier::Threshold);
+
+    // nested loops compile as one
+    expectJitMatches(R"(
+        a = 0;
+        sum = 0;
+        while (a == 80) == 0 begin
+            b = 0;
+            while (b == 80) == 0 begin
+                sum = sum + a * b;
+                b = b + 1;
+            end
+            a = a + 1;
+        end
+    )", {"a", "b", "sum"}, stats);
+    EXPECT_GE(stats.compiled, 1);
+
+    // printing and strings stay in the interpreter
+    expectJitMatches(R"(
+        i = 0;
+        s = "";
+        while (i == 100) == 0 begin
+            s = s + "x";
+            i = i + 1;
+        end
+        while (i == 200) == 0 begin
+            print(i);
+            i = i + 1;
+        end
+    )", {"i", "s"}, stats);
+    EXPECT_EQ(stats.compiled, 0);
+    EXPECT_EQ(stats.rejected, 2);
+}
+
+TEST(Interpreter, quickening)
+{
+    // the same instructions see numbers first and strings later
+    Interpreter interpreter;
+    ASSERT_EQ(runCapturingOutput(interpreter, R"(
+        i = 0;
+        a = 1;
+        b = 2;
+        while (i == 6) == 0 begin
+            if i == 3 begin
+                a = "x";
+                b = "y";
+            end
+            print(a + b, a == b, " ");
+            i = i + 1;
+        end
+        while (i == 9) == 0 begin
+            a = i;
+            b = i * 2;
+            print(a + b, " ");
+            i = i + 1;
+        end
+    )"), "30 30 30 xy0 xy0 xy0 18 21 24 ");
+
+    // a quickened instruction still raises the generic error
+    try
+    {
+        runCapturingOutput(interpreter, R"(
+            i = 0;
+            a = 1;
+            while (i == 3) == 0 begin
+                if i == 2 begin
+                    a = "x";
+                end
+                c = a - 1;
+                i = i + 1;
+            end
+        )");
+        FAIL();
+    }
+    catch(const InterpreterError &e)
+    {
+        ASSERT_STREQ(e.what(), "Cannot subtraction values with types string and number");
+    }
+    ASSERT_EQ(interpreter.getGlobalVariable("c").asString(), "0");
+}
+
+TEST(Value, numberFormatting)
+{
+    // the format numbers have always been printed in
+    auto printfStyle = [](double number)
+    {
+        std::string str = std::to_string(number);
+        size_t dec_loc = str.find('.');
+        size_t remove_loc = str.find_last_not_of('0') + 1;
+        if(dec_loc == remove_loc-1) remove_loc = dec_loc;
+        str.erase(remove_loc, std::string::npos);
+        return str;
+    };
+
+    const double numbers[] = {0, -0.0, 1, -1, 2.5, 100, 0.1 + 0.2, 1.0 / 3, 2.0 / 3, 1e-7, 5e-7, 123456789.125,
+        1e21, -1e300, 1.7976931348623157e308, std::numeric_limits<double>::infinity(),
+        -std::numeric_limits<double>::infinity()};
+    for(double number : numbers)
+    {
+        ASSERT_EQ(::Value::createNumber(number).asString(), printfStyle(number)) << number;
+    }
+}
+
+TEST(Interpreter, outputSink)
+{
+    const std::string src = R"(i = 0; while (i == 3) == 0 begin print(i, "-", 0.5 + i, " "); i = i + 1; end)";
+    AST ast(Lexer::lexString(src));
+
+    std::string memory;
+    Interpreter interpreter;
+    interpreter.setOutput(OutputSink::memory(memory));
+    interpreter.run(ast);
+    ASSERT_EQ(memory, "0-0.5 1-1.5 2-2.5 ");
+
+    // small buffers flush as they fill up, and big writes go straight through
+    std::vector<std::string> chunks;
+    {
+        OutputSink sink([&](std::string_view text) { chunks.emplace_back(text); }, 1);
+        for(int i = 0; i < 100; i++)
+        {
+            sink.write("0123456789");
+        }
+        sink.write(std::string(1000, 'x'));
+        sink.write(1.5);
+        ASSERT_GT(chunks.size(), 2);
+    }
+    std::string joined;
+    for(const auto &chunk : chunks)
+    {
+        ASSERT_LE(chunk.size(), 1000);
+        joined += chunk;
+    }
+    std::string expected;
+    for(int i = 0; i < 100; i++) expected += "0123456789";
+    ASSERT_EQ(joined, expected + std::string(1000, 'x') + "1.5");
+
+    // shortest round trip formatting on request
+    memory.clear();
+    OutputSink shortest = OutputSink::memory(memory);
+    shortest.setNumberFormat(OutputSink::NumberFormat::Shortest);
+    interpreter.setOutput(std::move(shortest));
+    runCapturingOutput(interpreter, "print(0.1 + 0.2, \" \", 1 / 3, \" \", 2.5, \" \", 100);");
+    ASSERT_EQ(memory, "0.30000000000000004 0.3333333333333333 2.5 100");
+
+    // output before an error is still flushed
+    memory.clear();
+    interpreter.setOutput(OutputSink::memory(memory));
+    ASSERT_THROW(runCapturingOutput(interpreter, "print(\"before\"); print(1 + \"a\");"), InterpreterError);
+    ASSERT_EQ(memory, "before");
+
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+    interpreter.setOutput(OutputSink::fileDescriptor(fds[1]));
+    interpreter.run(ast);
+    char buffer[64] = {};
+    ASSERT_EQ(read(fds[0], buffer, sizeof(buffer) - 1), 18);
+    ASSERT_STREQ(buffer, "0-0.5 1-1.5 2-2.5 ");
+    close(fds[0]);
+    close(fds[1]);
+}
+
+TEST(Repl, statements)
+{
+    std::string output;
+    Repl repl;
+    repl.getInterpreter().setOutput(OutputSink::memory(output));
+
+    ASSERT_EQ(repl.feed("a = 2;"), Repl::Status::Ran);
+    ASSERT_EQ(repl.feed("print(a * 3);"), Repl::Status::Ran);
+    ASSERT_EQ(output, "6");
+    ASSERT_EQ(repl.feed(""), Repl::Status::Ran);
+
+    // a block runs once its end is entered
+    output.clear();
+    ASSERT_EQ(repl.feed("while (a == 5) == 0 begin"), Repl::Status::Incomplete);
+    ASSERT_EQ(repl.feed("  print(a);"), Repl::Status::Incomplete);
+    ASSERT_EQ(repl.feed("  a = a + 1;"), Repl::Status::Incomplete);
+    ASSERT_EQ(output, "");
+    ASSERT_EQ(repl.feed("end"), Repl::Status::Ran);
+    ASSERT_EQ(output, "234");
+
+    // and so does a statement split over lines, or a string with a line break in it
+    output.clear();
+    ASSERT_EQ(repl.feed("s = \"one"), Repl::Status::Incomplete);
+    ASSERT_EQ(repl.feed("two\" +"), Repl::Status::Incomplete);
+    ASSERT_EQ(repl.feed("\"!\"; print(s);"), Repl::Status::Ran);
+    ASSERT_EQ(output, "one\ntwo!");
+    ASSERT_EQ(repl.getInterpreter().getGlobalVariable("a").asString(), "5");
+}
+
+TEST(Repl, errors)
+{
+    std::string output;
+    Repl repl;
+    repl.getInterpreter().setOutput(OutputSink::memory(output));
+    ASSERT_EQ(repl.feed("a = 1;"), Repl::Status::Ran);
+
+    ASSERT_EQ(repl.feed("end"), Repl::Status::Failed);
+    ASSERT_THAT(repl.getError(), HasSubstr("'end'"));
+    ASSERT_EQ(repl.feed("print(missing);"), Repl::Status::Failed);
+    ASSERT_THAT(repl.getError(), HasSubstr("missing"));
+    ASSERT_EQ(repl.feed("frobnicate(1);"), Repl::Status::Failed);
+    ASSERT_THAT(repl.getError(), HasSubstr("at 1:"));
+    ASSERT_EQ(repl.feed("a = 2; b = a + \"x\";"), Repl::Status::Failed);
+
+    // what ran before the error stays, and the session carries on
+    ASSERT_EQ(repl.feed("print(a);"), Repl::Status::Ran);
+    ASSERT_EQ(output, "2");
+
+    ASSERT_EQ(repl.feed("if a == 2 begin"), Repl::Status::Incomplete);
+    repl.reset();
+    ASSERT_EQ(repl.feed("print(a);"), Repl::Status::Ran);
+    ASSERT_EQ(output, "22");
+}
+
+TEST(Program, contextsAreIndependent)
+{
+    auto program = std::make_shared<const Program>(AST(Lexer::lexString(
+        "s = s + \"!\"; print(s, n + n);")));
+    const std::vector<Instruction> compiled = program->getBytecode().code;
+
+    std::string firstOutput, secondOutput;
+    Context first(program), second(program);
+    first.setOutput(OutputSink::memory(firstOutput));
+    second.setOutput(OutputSink::memory(secondOutput));
+    first.setGlobalVariable("s", Value::createString("a"));
+    first.setGlobalVariable("n", Value::createNumber(1));
+    second.setGlobalVariable("s", Value::createString("b"));
+    second.setGlobalVariable("n", Value::createString("x"));
+
+    first.run();
+    first.run();
+    second.run();
+    ASSERT_EQ(firstOutput, "a!2a!!2");
+    ASSERT_EQ(secondOutput, "b!xx");
+
+    // each context quickened n + n its own way, and the program kept the plain form
+    ASSERT_EQ(program->getBytecode().code.size(), compiled.size());
+    for(size_t i = 0; i < compiled.size(); i++)
+    {
+        ASSERT_EQ(program->getBytecode().code[i].op, compiled[i].op);
+    }
+
+    first.reset();
+    ASSERT_THROW(first.getGlobalVariable("s"), InterpreterError);
+    ASSERT_THROW(first.setGlobalVariable("unused", Value::createNumber(1)), InterpreterError);
+    ASSERT_THROW(first.run(), InterpreterError);
+}
+
+TEST(Program, runner)
+{
+    auto program = std::make_shared<const Program>(AST(Lexer::lexString(R"(
+        i = 0;
+        s = "";
+        while (i == n) == 0 begin
+            s = s + "ab";
+            i = i + 1;
+        end
+        print(i, s == "abababab");
+    )")));
+
+    ContextRunner runner(4);
+    ASSERT_EQ(runner.threadCount(), 4u);
+
+    std::vector<std::string> outputs(200);
+    std::vector<Context> contexts;
+    for(size_t i = 0; i < outputs.size(); i++)
+    {
+        contexts.emplace_back(program);
+        contexts.back().setOutput(OutputSink::memory(outputs[i]));
+        contexts.back().setJit(i % 2 == 0);
+        // every tenth context fails because n is not set
+        if(i % 10 != 0)
+        {
+            contexts.back().setGlobalVariable("n", Value::createNumber(static_cast<double>(i % 7)));
+        }
+    }
+
+    for(int round = 0; round < 3; round++)
+    {
+        for(auto &output : outputs) output.clear();
+        std::vector<std::exception_ptr> errors = runner.run(contexts);
+        ASSERT_EQ(errors.size(), contexts.size());
+        for(size_t i = 0; i < contexts.size(); i++)
+        {
+            if(i % 10 == 0)
+            {
+                ASSERT_TRUE(errors[i]);
+                ASSERT_THROW(std::rethrow_exception(errors[i]), InterpreterError);
+            }
+            else
+            {
+                ASSERT_FALSE(errors[i]);
+                ASSERT_EQ(outputs[i], std::to_string(i % 7) + (i % 7 == 4 ? "1" : "0"));
+            }
+        }
+    }
+
+    std::vector<Context> none;
+    ASSERT_TRUE(runner.run(none).empty());
+}
+
+TEST(Interpreter, errorsOutliveTheAST)
+{
+    InterpreterError error("");
+    try
+    {
+        AST ast(Lexer::lexString("a = 1;\n  frobnicate(a);"));
+        Program program(ast);
+    }
+    catch(const InterpreterError &e)
+    {
+        error = e;
+    }
+    ASSERT_EQ(error.lineNumber, 2);
+    ASSERT_EQ(error.colPosition, 3);
+}
+
+TEST(Interpreter, functions)
+{
+    ASSERT_EQ(runCapturingOutput(R"(
+        function add(a, b) begin return a + b; end
+        print(add(1, 2), " ", add("x", "y"), " ", add(add(1, 2), add(3, 4)));
+    )"), "3 xy 10");
+
+    // calls can come before definitions, and functions can recurse
+    ASSERT_EQ(runCapturingOutput(R"(
+        print(fib(15));
+        function fib(n) begin
+            if n == 0 begin return 0; end
+            if n == 1 begin return 1; end
+            return fib(n - 1) + fib(n - 2);
+        end
+    )"), "610");
+
+    // a call as a statement drops its result, and a function with no return gives nothing back
+    ASSERT_EQ(runCapturingOutput(R"(
+        function show(x) begin print("<", x, ">"); end
+        show(1);
+        function empty() begin end
+        empty();
+    )"), "<1>");
+    ASSERT_THROW(runCapturingOutput("function empty() begin end print(empty());"), InterpreterError);
+}
+
+TEST(Interpreter, functionScopes)
+{
+    Interpreter interpreter;
+    runCapturingOutput(interpreter, R"(
+        g = 1;
+        function reads() begin return g + 1; end
+        function shadows(x) begin g = x * 10; return g; end
+        function sets!(x) begin g = x; x = 0; end
+        function loop(n) begin
+            i = 0;
+            total = 0;
+            while (i == n) == 0 begin
+                i = i + 1;
+                total = total + i;
+            end
+            return total;
+        end
+        r = reads();
+        s = shadows(5);
+        after = g;
+        sets!(7);
+        l = loop(4);
+    )");
+    ASSERT_EQ(interpreter.getGlobalVariable("r").asString(), "2");
+    ASSERT_EQ(interpreter.getGlobalVariable("s").asString(), "50");
+    ASSERT_EQ(interpreter.getGlobalVariable("after").asString(), "1");
+    ASSERT_EQ(interpreter.getGlobalVariable("g").asString(), "7");
+    ASSERT_EQ(interpreter.getGlobalVariable("l").asString(), "10");
+    ASSERT_THROW(interpreter.getGlobalVariable("x"), InterpreterError);
+    ASSERT_THROW(interpreter.getGlobalVariable("total"), InterpreterError);
+
+    // locals are fresh on every call, so reading one before it is assigned fails
+    ASSERT_THROW(runCapturingOutput(interpreter, R"(
+        function early() begin print(v); v = 1; end
+        early();
+    )"), InterpreterError);
+}
+
+TEST(Interpreter, functionsPersistBetweenRuns)
+{
+    Interpreter interpreter;
+    runCapturingOutput(interpreter, "function twice(x) begin return x * 2; end function four() begin return twice(2); end");
+    ASSERT_EQ(runCapturingOutput(interpreter, "print(twice(21));"), "42");
+
+    // redefining a function changes what existing callers run
+    runCapturingOutput(interpreter, "function twice(x) begin return x + x + x; end");
+    ASSERT_EQ(runCapturingOutput(interpreter, "print(twice(1), four());"), "36");
+
+    // a program that fails to compile leaves the functions as they were
+    ASSERT_THROW(runCapturingOutput(interpreter, "function twice(x) begin return 0; end function broken() begin nope(); end"), InterpreterError);
+    ASSERT_THROW(runCapturingOutput(interpreter, "print(broken());"), InterpreterError);
+    ASSERT_EQ(runCapturingOutput(interpreter, "print(twice(1));"), "3");
+
+    // callers compiled earlier pass the old number of arguments, so that cannot change
+    runCapturingOutput(interpreter, "function g(a) begin return a; end function f() begin return g(5); end");
+    ASSERT_THROW(runCapturingOutput(interpreter, "function g(a, b) begin return a + b; end y = f();"), InterpreterError);
+    ASSERT_EQ(runCapturingOutput(interpreter, "print(f(), g(1));"), "51");
+}
+
+TEST(Interpreter, functionErrors)
+{
+    ASSERT_THROW(runCapturingOutput("function f(a) begin return a; end print(f());"), InterpreterError);
+    ASSERT_THROW(runCapturingOutput("function f(a) begin return a; end print(f(1, 2));"), InterpreterError);
+    ASSERT_THROW(runCapturingOutput("return 1;"), InterpreterError);
+    ASSERT_THROW(runCapturingOutput("if 1 begin function f() begin end end"), InterpreterError);
+    ASSERT_THROW(runCapturingOutput("function f() begin end function f() begin end"), InterpreterError);
+    ASSERT_THROW(runCapturingOutput("function f(a, a) begin end"), InterpreterError);
+    ASSERT_THROW(runCapturingOutput("function print(a) begin end"), InterpreterError);
+
+    try
+    {
+        runCapturingOutput("function forever(n) begin return forever(n + 1); end forever(0);");
+        FAIL();
+    }
+    catch(const InterpreterError &e)
+    {
+        ASSERT_THAT(e.what(), HasSubstr("forever"));
+    }
+}
+
+TEST(Interpreter, functionsWithProfilingAndJit)
+{
+    const std::string src = R"(
+        function square(x) begin
+            if x == 3 begin return 9; end
+            return x * x;
+        end
+        function count!() begin
+            i = 0;
+            while (i == 500) == 0 begin i = i + 1; end
+        end
+        i = 0;
+        total = 0;
+        while (i == 200) == 0 begin
+            total = total + square(i);
+            i = i + 1;
+        end
+        count!();
+    )";
+    AST ast(Lexer::lexString(src));
+
+    // returns from inside nested sites still exit all of them
+    Interpreter profiled;
+    profiled.setProfiling(true);
+    profiled.run(ast);
+    profiled.run(ast);
+    uint64_t returns = 0;
+    for(const auto &entry : profiled.getProfiler()->entries())
+    {
+        if(entry.type == AST::Node::Type::Return) returns += entry.count;
+    }
+    ASSERT_EQ(returns, 2 * 200);
+    ASSERT_EQ(profiled.getGlobalVariable("total").asString(), "2646700");
+
+    std::ostringstream report;
+    profiled.getProfiler()->report(report, src, profiled.getProfiler()->entries().size());
+    EXPECT_NE(report.str().find("Return"), std::string::npos);
+    EXPECT_EQ(report.str().find("Error"), std::string::npos);
+
+    // the loop with a call stays interpreted; the one in count! only uses globals
+    Interpreter jitted;
+    jitted.setJit(true);
+    jitted.run(ast);
+    ASSERT_EQ(jitted.getGlobalVariable("total").asString(), "2646700");
+    ASSERT_EQ(jitted.getGlobalVariable("i").asString(), "500");
+    if(JitCompiler::isSupported())
+    {
+        ASSERT_EQ(jitted.getJitStats().compiled, 1u);
+    }
+
+    // and contexts share the functions of their program
+    auto program = std::make_shared<const Program>(ast);
+    std::string output;
+    Context context(program);
+    context.setOutput(OutputSink::memory(output));
+    context.run();
+    ASSERT_EQ(context.getGlobalVariable("total").asString(), "2646700");
+}
+
+// dll_import, with the path of the test library as its argument
+static std::string importTestLibrary()
+{
+    return std::string("dll_import(\"") + FOREIGN_TEST_LIBRARY + "\");\n";
+}
+
+// runs src in an interpreter that lets it use dll_import
+static std::string runWithImports(const std::string &src)
+{
+    Interpreter interpreter;
+    interpreter.setForeignImports(true);
+    return runCapturingOutput(interpreter, src);
+}
+
+TEST(Interpreter, profilingCanBeTurnedOffBetweenRuns)
+{
+    Interpreter interpreter;
+    interpreter.setProfiling(true);
+    runCapturingOutput(interpreter, "function twice(x) begin if x == 1 begin return 2; end return x * 2; end");
+    ASSERT_EQ(runCapturingOutput(interpreter, "print(twice(3));"), "6");
+
+    interpreter.setProfiling(false);
+    ASSERT_EQ(runCapturingOutput(interpreter, "print(twice(1));"), "2");
+    interpreter.setProfiling(true);
+    ASSERT_EQ(runCapturingOutput(interpreter, "print(twice(4));"), "8");
+    ASSERT_EQ(interpreter.getProfiler()->hotSpots().size(), interpreter.getProfiler()->entries().size());
+}
+
+TEST(Interpreter, foreignFunctions)
+{
+    ASSERT_EQ(runWithImports(importTestLibrary() + R"sfl(
+        dll_bind("scale", "double(double, double)");
+        dll_bind("add_ints", "int(int, int)");
+        dll_bind("count_char", "long(string, int)");
+        dll_bind("greeting", "string()");
+        print(scale(1.5, 4), " ", add_ints(2, 3 - 10), " ", count_char("banana", 97), " ", greeting());
+    )sfl"), "6 -5 3 hello");
+
+    // arguments of both kinds interleaved, up to the limit of six
+    ASSERT_EQ(runWithImports(importTestLibrary() + R"sfl(
+        dll_bind("mixed", "double(long, double, string, double, int)");
+        dll_bind("six", "long(long, long, long, long, long, long)");
+        print(mixed(1, 2, "abc", 4, 5), " ", six(1, 1, 1, 1, 1, 1));
+    )sfl"), "12345 21");
+
+    // calls can come before the bind, and void results are dropped
+    ASSERT_EQ(runWithImports(importTestLibrary() + R"sfl(
+        remember(7.25);
+        print(recall());
+        dll_bind("remember", "void(double)");
+        dll_bind("recall", "double()");
+    )sfl"), "7.25");
+}
+
+TEST(Interpreter, foreignStrings)
+{
+    Interpreter interpreter;
+    interpreter.setForeignImports(true);
+    runCapturingOutput(interpreter, importTestLibrary() + R"sfl(
+        dll_bind("count_char", "long(string, int)");
+        dll_bind("buffer_length", "long(buffer)");
+        dll_bind("nothing", "string()");
+        s = "ab";
+        longer = s + "aaa";
+    )sfl");
+
+    // s only covers the start of the buffer it shares with longer, so it has
+    // no terminator of its own and has to be copied
+    ASSERT_EQ(runCapturingOutput(interpreter, R"sfl(print(count_char(s, 97), " ", count_char(longer, 97));)sfl"), "1 4");
+    ASSERT_EQ(runCapturingOutput(interpreter, R"sfl(print(buffer_length(s), " ", buffer_length(""));)sfl"), "2 0");
+
+    ASSERT_THROW(runCapturingOutput(interpreter, "print(nothing());"), InterpreterError);
+    ASSERT_THROW(runCapturingOutput(interpreter, "count_char(1, 97);"), InterpreterError);
+    ASSERT_THROW(runCapturingOutput(interpreter, "count_char(\"a\", \"b\");"), InterpreterError);
+    ASSERT_THROW(runCapturingOutput(interpreter, "count_char(\"a\", 1 / 0);"), InterpreterError);
+}
+
+TEST(Interpreter, foreignErrors)
+{
+    const std::string import = importTestLibrary();
+    // imports are only allowed once the host turns them on
+    ASSERT_FALSE(Interpreter().areForeignImportsAllowed());
+    ASSERT_THROW(runCapturingOutput(import + "x = 1;"), InterpreterError);
+    ASSERT_THROW(Program(AST(Lexer::lexString(import))), InterpreterError);
+    ASSERT_EQ(runWithImports(import + "print(1);"), "1");
+
+    ASSERT_THROW(runWithImports("dll_import(\"no-such-library.so\");"), InterpreterError);
+    ASSERT_THROW(runCapturingOutput("dll_bind(\"scale\", \"double(double, double)\");"), InterpreterError);
+    ASSERT_THROW(runWithImports(import + "dll_bind(\"no_such_function\", \"void()\");"), InterpreterError);
+    ASSERT_THROW(runWithImports(import + "dll_bind(\"scale\");"), InterpreterError);
+    ASSERT_THROW(runWithImports(import + "name = \"scale\"; dll_bind(name, \"void()\");"), InterpreterError);
+    ASSERT_THROW(runWithImports(import + "if 1 begin dll_bind(\"scale\", \"void()\"); end"), InterpreterError);
+    ASSERT_THROW(runWithImports(import + "x = dll_bind(\"scale\", \"void()\");"), InterpreterError);
+    ASSERT_THROW(runWithImports(import + "dll_bind(\"scale\", \"void()\"); dll_bind(\"scale\", \"void()\");"), InterpreterError);
+    ASSERT_THROW(runWithImports(import + "dll_bind(\"scale\", \"void()\"); function scale() begin end"), InterpreterError);
+    ASSERT_THROW(runWithImports(import + "dll_bind(\"scale\", \"double(double)\"); scale(1, 2);"), InterpreterError);
+
+    // ints have to fit in 32 bits rather than be cut down to them
+    const std::string addInts = import + "dll_bind(\"add_ints\", \"int(int, int)\");";
+    ASSERT_EQ(runWithImports(addInts + "print(add_ints(2147483647, 0), \" \", add_ints(0 - 2147483648, 0));"),
+              "2147483647 -2147483648");
+    for(const char *call : {"add_ints(3000000000, 1);", "add_ints(1, 0 - 2147483649);", "add_ints(2147483648, 0);"})
+    {
+        try
+        {
+            runWithImports(addInts + call);
+            FAIL() << call;
+        }
+        catch(const InterpreterError &e)
+        {
+            ASSERT_THAT(e.what(), HasSubstr("must be a number that fits in an int")) << call;
+        }
+    }
+
+    for(const char *signature : {"", "double", "double(", "double(double", "float(double)", "double(void)",
+                                 "buffer()", "void(long, long, long, long, long, buffer)", "double() x"})
+    {
+        try
+        {
+            runWithImports(import + "dll_bind(\"scale\", \"" + signature + "\");");
+            FAIL() << signature;
+        }
+        catch(const InterpreterError &e)
+        {
+            ASSERT_THAT(e.what(), HasSubstr("Bad signature")) << signature;
+        }
+    }
+}
+
+TEST(Interpreter, foreignFunctionsPersist)
+{
+    Interpreter interpreter;
+    interpreter.setForeignImports(true);
+    runCapturingOutput(interpreter, importTestLibrary() + "dll_bind(\"scale\", \"double(double, double)\");");
+    ASSERT_EQ(runCapturingOutput(interpreter, "print(scale(2, 3));"), "6");
+
+    // a failed compile takes back what it bound
+    ASSERT_THROW(runCapturingOutput(interpreter, "dll_bind(\"recall\", \"double()\"); nope();"), InterpreterError);
+    ASSERT_THROW(runCapturingOutput(interpreter, "print(recall());"), InterpreterError);
+
+    // binding again keeps earlier calls working, so it cannot change how many arguments they pass
+    runCapturingOutput(interpreter, "function twice(x) begin return scale(x, 2); end");
+    ASSERT_THROW(runCapturingOutput(interpreter, "dll_bind(\"scale\", \"double(double)\"); y = twice(3);"),
+                 InterpreterError);
+    runCapturingOutput(interpreter, "dll_bind(\"add_ints\", \"int(int, int)\");");
+    ASSERT_THROW(runCapturingOutput(interpreter, "dll_bind(\"add_ints\", \"int(int)\");"), InterpreterError);
+    runCapturingOutput(interpreter, "dll_bind(\"scale\", \"double(double, double)\");");
+    ASSERT_EQ(runCapturingOutput(interpreter, "print(twice(3.5), add_ints(1, 2));"), "73");
+
+    // and contexts get the natives of their program
+    AST ast(Lexer::lexString(importTestLibrary() + "dll_bind(\"add_ints\", \"int(int, int)\"); x = add_ints(40, 2);"));
+    auto program = std::make_shared<const Program>(ast, true);
+    std::vector<Context> contexts;
+    for(int i = 0; i < 4; i++)
+    {
+        contexts.emplace_back(program);
+    }
+    ContextRunner runner(4);
+    for(const auto &error : runner.run(contexts))
+    {
+        ASSERT_FALSE(error);
+    }
+    ASSERT_EQ(contexts[3].getGlobalVariable("x").asString(), "42");
+}
+
+static double half(double x)
+{
+    return x / 2;
+}
+
+TEST(Interpreter, registeredFunctions)
+{
+    Interpreter interpreter;
+    int calls = 0;
+    std::string seen;
+    interpreter.registerFunction("half", half);
+    interpreter.registerFunction("repeat", [](std::string_view text, int times)
+    {
+        std::string result;
+        for(int i = 0; i < times; i++) result += text;
+        return result;
+    });
+    interpreter.registerFunction("count!", [&calls]() { return ++calls; });
+    interpreter.registerFunction("see", [&seen](const std::string &text) { seen += text; });
+    interpreter.registerFunction("either", [](bool condition, const ::Value &a, ::Value b) { return condition ? a : b; });
+    interpreter.registerFunction("positive?", [](long n) noexcept { return n > 0; });
+    interpreter.registerFunction("name", [](unsigned n) -> const char * { return n == 1 ? "one" : nullptr; });
+
+    ASSERT_EQ(runCapturingOutput(interpreter, R"sfl(
+        print(half(5), " ", repeat("ab", 3), " ", either(1, "yes", 2), either(0, "yes", 2), either("a", 3, 4), either("", 3, 4));
+        count!();
+        count!();
+        see("x");
+        see(repeat("y", 2));
+        print(" ", positive?(3), positive?(0 - 3), " ", name(1));
+    )sfl"), "2.5 ababab yes234 10 one");
+    ASSERT_EQ(calls, 2);
+    ASSERT_EQ(seen, "xyy");
+
+    // calls from functions, and from functions compiled in an earlier run
+    runCapturingOutput(interpreter, "function quarter(x) begin return half(half(x)); end");
+    ASSERT_EQ(runCapturingOutput(interpreter, "print(quarter(10));"), "2.5");
+    interpreter.registerFunction("half", [](double x) { return x / 2 + 1; });
+    ASSERT_EQ(runCapturingOutput(interpreter, "print(quarter(10));"), "4");
+}
+
+TEST(Interpreter, registeredFunctionErrors)
+{
+    Interpreter interpreter;
+    interpreter.registerFunction("half", half);
+    interpreter.registerFunction("small", [](int8_t n) { return n; });
+    interpreter.registerFunction("name", [](unsigned n) -> const char * { return n == 1 ? "one" : nullptr; });
+    interpreter.registerFunction("fail", []() -> double { throw InterpreterError("failed on purpose"); });
+
+    ASSERT_THROW(runCapturingOutput(interpreter, "half(\"a\");"), InterpreterError);
+    ASSERT_THROW(runCapturingOutput(interpreter, "half(1, 2);"), InterpreterError);
+    ASSERT_THROW(runCapturingOutput(interpreter, "small(200);"), InterpreterError);
+    ASSERT_THROW(runCapturingOutput(interpreter, "print(name(2));"), InterpreterError);
+    ASSERT_THROW(runCapturingOutput(interpreter, "function half(x) begin end"), InterpreterError);
+    ASSERT_EQ(runCapturingOutput(interpreter, "print(small(0 - 128));"), "-128");
+
+    try
+    {
+        runCapturingOutput(interpreter, "x = 1; fail(); x = 2;");
+        FAIL();
+    }
+    catch(const InterpreterError &e)
+    {
+        ASSERT_THAT(e.what(), HasSubstr("failed on purpose"));
+    }
+    ASSERT_EQ(interpreter.getGlobalVariable("x").asString(), "1");
+
+    runCapturingOutput(interpreter, "function twice(x) begin return x * 2; end");
+    ASSERT_THROW(interpreter.registerFunction("twice", half), InterpreterError);
+    ASSERT_THROW(interpreter.registerFunction("print", half), InterpreterError);
+
+    // quarter was compiled to pass half one argument, so half has to keep taking one
+    runCapturingOutput(interpreter, "function quarter(x) begin return half(half(x)); end");
+    ASSERT_THROW(interpreter.registerFunction("half", [](double x, double y) { return x + y; }), InterpreterError);
+    ASSERT_THROW(interpreter.registerAsyncFunction("half", [](Completion) {}), InterpreterError);
+    ASSERT_EQ(runCapturingOutput(interpreter, "print(quarter(10));"), "2.5");
+}
+
+// runs ast in slices of fuel until it finishes and returns how many it took
+static int runInSlices(Interpreter &interpreter, const AST &ast, uint64_t fuel)
+{
+    int slices = 1;
+    RunStatus status = interpreter.run(ast, RunLimits::withFuel(fuel));
+    while(status != RunStatus::Finished)
+    {
+        EXPECT_EQ(status, RunStatus::OutOfFuel);
+        EXPECT_TRUE(interpreter.isSuspended());
+        status = interpreter.resume(RunLimits::withFuel(fuel));
+        slices++;
+    }
+    EXPECT_FALSE(interpreter.isSuspended());
+    return slices;
+}
+
+TEST(Interpreter, fuel)
+{
+    AST ast(Lexer::lexString(R"sfl(
+        function fib(n) begin
+            if n == 0 begin return 0; end
+            if n == 1 begin return 1; end
+            return fib(n - 1) + fib(n - 2);
+        end
+        i = 0;
+        total = 0;
+        while (i == 300) == 0 begin
+            j = 0;
+            while (j == i) == 0 begin
+                total = total + j;
+                j = j + 1;
+            end
+            i = i + 1;
+        end
+        print(total, " ", fib(15));
+    )sfl"));
+
+    std::string unlimited;
+    Interpreter reference;
+    reference.setOutput(OutputSink::memory(unlimited));
+    ASSERT_EQ(reference.run(ast, RunLimits()), RunStatus::Finished);
+    ASSERT_EQ(unlimited, "4455100 610");
+
+    // suspended in loops and deep in recursion, and always carrying on exactly
+    for(bool jit : {false, true})
+    {
+        std::string output;
+        Interpreter interpreter;
+        interpreter.setJit(jit);
+        interpreter.setOutput(OutputSink::memory(output));
+        ASSERT_GT(runInSlices(interpreter, ast, 1000), 100);
+        ASSERT_EQ(output, unlimited);
+        if(jit && JitCompiler::isSupported())
+        {
+            ASSERT_GT(interpreter.getJitStats().entries, 0u);
+        }
+    }
+}
+
+TEST(Interpreter, fuelStopsEndlessLoops)
+{
+    AST ast(Lexer::lexString("i = 0; while 1 begin i = i + 1; end"));
+
+    // the JIT charges loops exactly as the interpreter does, so both stop at the same point
+    std::string counted[2];
+    for(bool jit : {false, true})
+    {
+        Interpreter interpreter;
+        interpreter.setJit(jit);
+        ASSERT_EQ(interpreter.run(ast, RunLimits::withFuel(1000000)), RunStatus::OutOfFuel);
+        counted[jit] = interpreter.getGlobalVariable("i").asString();
+        ASSERT_EQ(interpreter.resume(RunLimits::withFuel(0)), RunStatus::OutOfFuel);
+        ASSERT_TRUE(interpreter.isSuspended());
+    }
+    ASSERT_EQ(counted[0], counted[1]);
+    ASSERT_GT(std::stoi(counted[0]), 1000);
+
+    for(bool jit : {false, true})
+    {
+        Interpreter interpreter;
+        interpreter.setJit(jit);
+        auto start = std::chrono::steady_clock::now();
+        ASSERT_EQ(interpreter.run(ast, RunLimits::within(std::chrono::milliseconds(20))), RunStatus::PastDeadline);
+        ASSERT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(2));
+
+        // recursion is stopped too, since calls are charged
+        ASSERT_EQ(interpreter.run(AST(Lexer::lexString(R"sfl(
+            function both(n) begin both(n + 1); both(n + 1); end
+            both(0);
+        )sfl")), RunLimits::within(std::chrono::milliseconds(20))), RunStatus::PastDeadline);
+    }
+}
+
+TEST(Interpreter, suspendedRuns)
+{
+    Interpreter interpreter;
+    ASSERT_THROW(interpreter.resume(), InterpreterError);
+
+    AST endless(Lexer::lexString("i = 0; while 1 begin i = i + 1; end"));
+    ASSERT_EQ(interpreter.run(endless, RunLimits::withFuel(100)), RunStatus::OutOfFuel);
+
+    // globals can be changed while a run is suspended, and setting one replaces it
+    interpreter.setGlobalVariable("i", Value::createString("x"));
+    interpreter.setGlobalVariable("i", Value::createString("oops"));
+    ASSERT_EQ(interpreter.getGlobalVariable("i").asString(), "oops");
+    ASSERT_THROW(interpreter.resume(), InterpreterError);
+    ASSERT_FALSE(interpreter.isSuspended());
+
+    // and running another program drops the suspended one
+    ASSERT_EQ(interpreter.run(endless, RunLimits::withFuel(100)), RunStatus::OutOfFuel);
+    ASSERT_EQ(runCapturingOutput(interpreter, "print(i == 0);"), "0");
+    ASSERT_FALSE(interpreter.isSuspended());
+    ASSERT_THROW(interpreter.resume(), InterpreterError);
+}
+
+TEST(Interpreter, timeSlicing)
+{
+    // one thread taking turns between many scripts, one of which never ends
+    const int Scripts = 40;
+    std::vector<AST> asts;
+    std::vector<std::string> outputs(Scripts);
+    std::vector<std::unique_ptr<Interpreter>> interpreters;
+    for(int i = 0; i < Scripts; i++)
+    {
+        std::string condition = i == 0 ? "1" : "(n == " + std::to_string(i * 100) + ") == 0";
+        asts.emplace_back(Lexer::lexString("n = 0; while " + condition + " begin n = n + 1; end print(n);"));
+        interpreters.push_back(std::make_unique<Interpreter>());
+        interpreters.back()->setOutput(OutputSink::memory(outputs[i]));
+        interpreters.back()->setJit(i % 2 == 0);
+        ASSERT_EQ(interpreters.back()->run(asts.back(), RunLimits::withFuel(0)), RunStatus::OutOfFuel);
+    }
+
+    int turns = 0;
+    int running = Scripts;
+    while(running > 1)
+    {
+        running = 0;
+        for(auto &interpreter : interpreters)
+        {
+            if(interpreter->isSuspended() && interpreter->resume(RunLimits::withFuel(500)) != RunStatus::Finished)
+            {
+                running++;
+            }
+        }
+        turns++;
+    }
+    for(int i = 1; i < Scripts; i++)
+    {
+        ASSERT_EQ(outputs[i], std::to_string(i * 100));
+    }
+    ASSERT_TRUE(interpreters[0]->isSuspended());
+    ASSERT_GT(turns, 10);
+}
+
+TEST(Program, suspendedContexts)
+{
+    AST ast(Lexer::lexString("i = 0; while (i == 10000) == 0 begin i = i + 1; end print(i);"));
+    auto program = std::make_shared<const Program>(ast);
+    std::string output;
+    Context context(program);
+    context.setOutput(OutputSink::memory(output));
+
+    int slices = 1;
+    RunStatus status = context.run(RunLimits::withFuel(1000));
+    while(status != RunStatus::Finished)
+    {
+        status = context.resume(RunLimits::withFuel(1000));
+        slices++;
+    }
+    ASSERT_EQ(output, "10000");
+    ASSERT_GT(slices, 10);
+
+    ASSERT_EQ(context.run(RunLimits::withFuel(10)), RunStatus::OutOfFuel);
+    context.reset();
+    ASSERT_FALSE(context.isSuspended());
+    ASSERT_THROW(context.resume(), InterpreterError);
+}
+
+TEST(Program, suspendedContextsCanMove)
+{
+    // suspended inside a loop the JIT has compiled, then moved as their vector grows
+    AST ast(Lexer::lexString("i = 0; while (i == 100000) == 0 begin i = i + 1; end print(i);"));
+    auto program = std::make_shared<const Program>(ast);
+    std::vector<std::string> outputs(4);
+    std::vector<Context> contexts;
+    for(int i = 0; i < 4; i++)
+    {
+        contexts.emplace_back(program);
+        contexts.back().setOutput(OutputSink::memory(outputs[i]));
+        contexts.back().setJit(true);
+    }
+    for(auto &context : contexts)
+    {
+        ASSERT_EQ(context.run(RunLimits::withFuel(5000)), RunStatus::OutOfFuel);
+    }
+    uint64_t entries = contexts[0].getJitStats().entries;
+
+    contexts.reserve(contexts.capacity() * 4);
+    for(auto &context : contexts)
+    {
+        while(context.resume(RunLimits::withFuel(5000)) != RunStatus::Finished)
+        {
+        }
+    }
+    for(const auto &output : outputs)
+    {
+        ASSERT_EQ(output, "100000");
+    }
+    if(JitCompiler::isSupported())
+    {
+        ASSERT_GT(contexts[0].getJitStats().entries, entries);
+    }
+}
+
+TEST(Interpreter, asyncFunctions)
+{
+    Interpreter interpreter;
+    std::string output;
+    interpreter.setOutput(OutputSink::memory(output));
+    int readied = 0;
+    interpreter.setReadyHandler([&readied]() { readied++; });
+    std::vector<Completion> waiting;
+    interpreter.registerAsyncFunction("later", [&waiting](Completion completion) { waiting.push_back(completion); });
+    interpreter.registerAsyncFunction("now", [](Completion completion, const std::string &text)
+    {
+        completion.resolve(text + "!");
+    });
+
+    AST ast(Lexer::lexString(R"sfl(
+        function twice() begin return later() * 2; end
+        print(now("a"), " ");
+        print(twice() + later());
+    )sfl"));
+    ASSERT_EQ(interpreter.run(ast, RunLimits()), RunStatus::Waiting);
+    ASSERT_EQ(output, "a! ");
+    ASSERT_TRUE(interpreter.isSuspended());
+    ASSERT_EQ(interpreter.resume(), RunStatus::Waiting);
+    ASSERT_EQ(waiting.size(), 1u);
+
+    waiting[0].resolve(5);
+    ASSERT_TRUE(waiting[0].isDone());
+    ASSERT_EQ(readied, 1);
+    ASSERT_EQ(interpreter.resume(), RunStatus::Waiting);
+    ASSERT_EQ(waiting.size(), 2u);
+    waiting[1].resolve(::Value::createNumber(1));
+    waiting[1].resolve(100); // only the first counts
+    ASSERT_EQ(readied, 2);
+    ASSERT_EQ(interpreter.resume(), RunStatus::Finished);
+    ASSERT_EQ(output, "a! 11");
+}
+
+TEST(Interpreter, asyncFunctionErrors)
+{
+    Interpreter interpreter;
+    int readied = 0;
+    interpreter.setReadyHandler([&readied]() { readied++; });
+    std::vector<Completion> waiting;
+    interpreter.registerAsyncFunction("later", [&waiting](Completion completion) { waiting.push_back(completion); });
+    interpreter.registerAsyncFunction("fail", [](Completion completion) { completion.reject("no luck"); });
+    interpreter.registerAsyncFunction("twice", [](Completion completion, double x) { completion.resolve(x * 2); });
+
+    ASSERT_THROW(runCapturingOutput(interpreter, "print(fail());"), InterpreterError);
+    ASSERT_THROW(runCapturingOutput(interpreter, "print(twice(\"a\"));"), InterpreterError);
+    ASSERT_EQ(runCapturingOutput(interpreter, "print(twice(2));"), "4");
+
+    AST ast(Lexer::lexString("x = later(); print(x);"));
+    ASSERT_EQ(interpreter.run(ast, RunLimits()), RunStatus::Waiting);
+    waiting.back().reject("gone");
+    try
+    {
+        interpreter.resume();
+        FAIL();
+    }
+    catch(const InterpreterError &error)
+    {
+        ASSERT_STREQ(error.what(), "gone");
+    }
+    ASSERT_FALSE(interpreter.isSuspended());
+
+    // a run without limits cannot wait, and a run that is dropped is no longer readied
+    ASSERT_THROW(runCapturingOutput(interpreter, "print(later());"), InterpreterError);
+    ASSERT_FALSE(interpreter.isSuspended());
+    ASSERT_EQ(interpreter.run(ast, RunLimits()), RunStatus::Waiting);
+    ASSERT_EQ(interpreter.run(ast, RunLimits()), RunStatus::Waiting);
+    readied = 0;
+    waiting[waiting.size() - 2].resolve(1);
+    ASSERT_EQ(readied, 0);
+    waiting.back().resolve(2);
+    ASSERT_EQ(readied, 1);
+}
+
+// an async sleep(milliseconds) that finishes with the milliseconds slept
+static void registerSleep(Interpreter &interpreter, EventLoop &loop)
+{
+    interpreter.registerAsyncFunction("sleep", [&loop](Completion completion, double milliseconds)
+    {
+        auto delay = std::chrono::duration<double, std::milli>(milliseconds);
+        loop.after(std::chrono::duration_cast<EventLoop::Clock::duration>(delay), [completion, milliseconds]() mutable
+        {
+            completion.resolve(milliseconds);
+        });
+    });
+}
+
+TEST(EventLoop, manyScriptsWaitAtOnce)
+{
+    const int Scripts = 2000;
+    EventLoop loop;
+    AST ast(Lexer::lexString("t = 0; i = 0; while (i == 3) == 0 begin t = t + sleep(20); i = i + 1; end print(t);"));
+    std::vector<std::unique_ptr<Interpreter>> interpreters;
+    std::vector<std::string> outputs(Scripts);
+    int finished = 0;
+    for(int i = 0; i < Scripts; i++)
+    {
+        interpreters.push_back(std::make_unique<Interpreter>());
+        interpreters.back()->setOutput(OutputSink::memory(outputs[i]));
+        registerSleep(*interpreters.back(), loop);
+        loop.start(*interpreters.back(), ast, [&finished](std::exception_ptr error)
+        {
+            ASSERT_FALSE(error);
+            finished++;
+        });
+    }
+    ASSERT_EQ(loop.scriptsInFlight(), size_t(Scripts));
+
+    // one after another they would take two minutes
+    auto start = std::chrono::steady_clock::now();
+    loop.run();
+    ASSERT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(10));
+    ASSERT_EQ(finished, Scripts);
+    ASSERT_EQ(loop.scriptsInFlight(), 0u);
+    for(const auto &output : outputs)
+    {
+        ASSERT_EQ(output, "60");
+    }
+}
+
+TEST(EventLoop, standInService)
+{
+    // The service answers each "id:text" line with "id:<text>", answering the
+    // lines that arrive together in reverse order.
+    int sockets[2];
+    ASSERT_EQ(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sockets), 0);
+    std::thread service([fd = sockets[1]]()
+    {
+        std::string buffer;
+        char chunk[4096];
+        ssize_t count;
+        while((count = ::read(fd, chunk, sizeof(chunk))) > 0)
+        {
+            buffer.append(chunk, static_cast<size_t>(count));
+            std::vector<std::string> lines;
+            size_t end;
+            while((end = buffer.find('\n')) != std::string::npos)
+            {
+                lines.push_back(buffer.substr(0, end));
+                buffer.erase(0, end + 1);
+            }
+            std::string reply;
+            for(auto line = lines.rbegin(); line != lines.rend(); ++line)
+            {
+                size_t colon = line->find(':');
+                reply += line->substr(0, colon + 1) + "<" + line->substr(colon + 1) + ">\n";
+            }
+            for(size_t written = 0; written < reply.size();)
+            {
+                written += static_cast<size_t>(::write(fd, reply.data() + written, reply.size() - written));
+            }
+        }
+        ::close(fd);
+    });
+
+    EventLoop loop;
+    std::map<uint64_t, Completion> requests;
+    uint64_t nextRequest = 0;
+    std::string replies;
+    loop.watch(sockets[0], EPOLLIN, [&](uint32_t)
+    {
+        char chunk[4096];
+        ssize_t count = ::read(sockets[0], chunk, sizeof(chunk));
+        ASSERT_GT(count, 0);
+        replies.append(chunk, static_cast<size_t>(count));
+        size_t end;
+        while((end = replies.find('\n')) != std::string::npos)
+        {
+            size_t colon = replies.find(':');
+            auto request = requests.find(std::stoull(replies.substr(0, colon)));
+            request->second.resolve(replies.substr(colon + 1, end - colon - 1));
+            requests.erase(request);
+            replies.erase(0, end + 1);
+        }
+    });
+
+    const int Scripts = 300;
+    AST ast(Lexer::lexString(R"sfl(print(fetch(fetch(name) + "y"));)sfl"));
+    std::vector<std::unique_ptr<Interpreter>> interpreters;
+    std::vector<std::string> outputs(Scripts);
+    for(int i = 0; i < Scripts; i++)
+    {
+        interpreters.push_back(std::make_unique<Interpreter>());
+        Interpreter &interpreter = *interpreters.back();
+        interpreter.setOutput(OutputSink::memory(outputs[i]));
+        interpreter.setGlobalVariable("name", ::Value::createString(std::to_string(i)));
+        interpreter.registerAsyncFunction("fetch", [&](Completion completion, const std::string &text)
+        {
+            uint64_t id = nextRequest++;
+            requests.emplace(id, completion);
+            std::string line = std::to_string(id) + ":" + text + "\n";
+            ASSERT_EQ(::write(sockets[0], line.data(), line.size()), ssize_t(line.size()));
+        });
+        loop.start(interpreter, ast, [](std::exception_ptr error) { ASSERT_FALSE(error); });
+    }
+    loop.run();
+    loop.unwatch(sockets[0]);
+    ::shutdown(sockets[0], SHUT_WR);
+    service.join();
+    ::close(sockets[0]);
+
+    ASSERT_TRUE(requests.empty());
+    for(int i = 0; i < Scripts; i++)
+    {
+        ASSERT_EQ(outputs[i], "<<" + std::to_string(i) + ">y>");
+    }
+}
+
+TEST(EventLoop, busyAndFailingScripts)
+{
+    EventLoop loop;
+    loop.setSlice(1000);
+    std::vector<std::thread> workers;
+    std::vector<std::string> order;
+    std::vector<std::string> outputs(4);
+    std::vector<std::unique_ptr<Interpreter>> interpreters;
+    std::vector<std::unique_ptr<AST>> asts;
+    std::string failure;
+    const char *scripts[] =
+    {
+        "i = 0; while (i == 300000) == 0 begin i = i + 1; end print(i);",
+        "print(work(21));",
+        "print(work(0 - 1));",
+        "print(nothing);",
+    };
+    for(int i = 0; i < 4; i++)
+    {
+        interpreters.push_back(std::make_unique<Interpreter>());
+        Interpreter &interpreter = *interpreters.back();
+        interpreter.setOutput(OutputSink::memory(outputs[i]));
+        // finished on another thread, and handed back to the loop
+        interpreter.registerAsyncFunction("work", [&](Completion completion, double n)
+        {
+            workers.emplace_back([&loop, completion, n]()
+            {
+                loop.post([completion, n]() mutable
+                {
+                    if(n < 0) completion.reject("negative");
+                    else completion.resolve(n * 2);
+                });
+            });
+        });
+        asts.push_back(std::make_unique<AST>(Lexer::lexString(scripts[i])));
+        loop.start(interpreter, *asts.back(), [&order, &failure, i](std::exception_ptr error)
+        {
+            order.push_back(std::to_string(i));
+            try
+            {
+                if(error) std::rethrow_exception(error);
+            }
+            catch(const InterpreterError &e)
+            {
+                failure += e.what();
+                failure += ";";
+            }
+        });
+    }
+    loop.run();
+    for(auto &worker : workers)
+    {
+        worker.join();
+    }
+
+    ASSERT_EQ(order.size(), 4u);
+    ASSERT_EQ(order.back(), "0");
+    ASSERT_EQ(outputs[0], "300000");
+    ASSERT_EQ(outputs[1], "42");
+    ASSERT_THAT(failure, HasSubstr("negative;"));
+    ASSERT_THAT(failure, HasSubstr("nothing"));
+}
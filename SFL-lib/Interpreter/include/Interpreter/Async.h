@@ -0,0 +1,109 @@
+#pragma once
+
+#include <Interpreter/Bytecode.h>
+#include <Interpreter/Native.h>
+#include <Interpreter/Value.h>
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+// The result of an async native call, given once it is known. The function
+// gets a Completion when it is called and returns straight away, and the run
+// that made the call is suspended until resolve or reject is called. Nothing
+// blocks in the meantime, so the thread can run other scripts.
+//
+// Values are not thread safe, so a Completion must be finished on the thread
+// that runs the interpreter. Only the first resolve or reject counts.
+class Completion
+{
+public:
+    // the call returns value
+    void resolve(Value value);
+
+    // converted the way a registered function's result is
+    template<typename T>
+    void resolve(T result)
+    {
+        resolve(NativeResult<std::decay_t<T>>::make(std::move(result)));
+    }
+
+    // the call throws an InterpreterError with message
+    void reject(std::string message);
+
+    bool isDone() const;
+
+private:
+    friend class InterpreterImpl;
+    friend struct Execution;
+
+    struct State
+    {
+        Value result;
+        std::string error;
+        bool done = false;
+        bool failed = false;
+        std::function<void()> ready; // set once the run is waiting on this
+    };
+
+    explicit Completion(std::shared_ptr<State> state);
+
+    std::shared_ptr<State> state;
+};
+
+// As NativeBinding, for a callable whose first parameter is a Completion. The
+// rest are the arguments an SFL call passes.
+template<typename F>
+class AsyncNativeBinding
+{
+public:
+    typedef NativeSignature<F> Signature;
+
+    static NativeFunction make(std::string name, F function)
+    {
+        NativeFunction native;
+        native.name = name;
+        native.parameters = std::tuple_size<Arguments>::value;
+        native.start = &start;
+        native.target = std::make_shared<AsyncNativeBinding>(std::move(name), std::move(function));
+        return native;
+    }
+
+    AsyncNativeBinding(std::string name, F function)
+        : name(std::move(name)), function(std::move(function))
+    {}
+
+private:
+    template<typename Tuple>
+    struct Rest;
+
+    template<typename First, typename... Others>
+    struct Rest<std::tuple<First, Others...>>
+    {
+        static_assert(std::is_same<First, Completion>::value, "the first parameter must be a Completion");
+        typedef std::tuple<Others...> Type;
+    };
+
+    typedef typename Rest<typename Signature::Arguments>::Type Arguments;
+
+    static void start(const void *target, const Value *arguments, Completion completion)
+    {
+        // made non-const by make, so a callable may change its own state
+        auto &binding = *static_cast<AsyncNativeBinding *>(const_cast<void *>(target));
+        binding.invoke(arguments, std::move(completion),
+                       std::make_index_sequence<std::tuple_size<Arguments>::value>());
+    }
+
+    template<size_t... I>
+    void invoke(const Value *arguments, Completion completion, std::index_sequence<I...>)
+    {
+        function(std::move(completion),
+                 NativeArgument<std::tuple_element_t<I, Arguments>>::get(arguments[I], name, I)...);
+    }
+
+    std::string name;
+    F function;
+};
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <Interpreter/Value.h>
+#include <Interpreter/Profiler.h>
+
+#include <Parser/Parser.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+enum class OpCode : uint8_t
+{
+    PushConstant,   // operand: index into constants
+    LoadGlobal,     // operand: global slot
+    StoreGlobal,    // operand: global slot
+    LoadLocal,      // operand: offset into the current frame
+    StoreLocal,     // operand: offset into the current frame
+    Pop,
+
+    // The compiler emits the plain arithmetic instructions. The first time one
+    // runs it rewrites itself into the Numbers form if both operands are numbers,
+    // or the Generic form otherwise. A Numbers instruction that later sees
+    // anything else turns Generic for good.
+    Add,
+    Subtract,
+    Multiply,
+    Divide,
+    Equals,
+
+    AddNumbers,
+    SubtractNumbers,
+    MultiplyNumbers,
+    DivideNumbers,
+    EqualsNumbers,
+
+    AddGeneric,
+    SubtractGeneric,
+    MultiplyGeneric,
+    DivideGeneric,
+    EqualsGeneric,
+
+    Jump,           // operand: target instruction
+    JumpIfFalse,    // operand: target instruction, pops the condition
+    LoopIfTrue,     // operand: index into loops, pops the condition and jumps to the loop body
+
+    Call,           // operand: index into functions, with the arguments on the stack
+    Return,         // pops the result, drops the frame and pushes the result for the caller
+    CallNative,     // operand: index into natives, replaces the arguments with the result
+
+    Print,          // pops one value and writes it out
+
+    // only emitted when compiling for a Profiler
+    ProfileEnter,   // operand: profiler site
+    ProfileExit,
+
+    Halt,
+};
+
+struct Instruction
+{
+    OpCode op;
+    uint32_t operand;
+};
+
+// Gives every global variable name a dense slot index. An Interpreter keeps one
+// of these for its lifetime so slots stay valid across programs it runs.
+class SlotTable
+{
+public:
+    // returns the slot for name, adding a new one if it has not been seen before
+    uint32_t resolve(const std::string &name);
+
+    // returns the number of slots if name has not been seen before
+    uint32_t find(const std::string &name) const;
+
+    const std::string &name(uint32_t slot) const;
+    uint32_t size() const;
+
+private:
+    std::unordered_map<std::string, uint32_t> indices;
+    std::vector<std::string> names;
+};
+
+// The instructions of one while loop, so it can be handed to the JIT whole
+struct Loop
+{
+    uint32_t start; // the jump into the condition
+    uint32_t body;  // the first instruction of the body
+    uint32_t end;   // the instruction after the loop
+};
+
+// A call gives a function a frame on the value stack that holds its arguments
+// followed by the rest of its locals, all addressed by offset from the frame's
+// base. Everything about the layout is worked out when the function is compiled.
+struct Function
+{
+    std::string name;
+    uint32_t entry = 0;         // the first instruction of the body
+    uint32_t size = 0;          // instructions in the body, which is what a call is charged
+    uint32_t parameters = 0;
+    std::vector<std::string> locals; // by frame offset, starting with the parameters
+};
+
+class Completion;
+class ForeignLibrary;
+
+// A function implemented outside SFL. call is given target and the arguments
+// in order, and returns the result. An async function has start instead,
+// which is also given the Completion to finish once its result is known.
+struct NativeFunction
+{
+    std::string name;
+    uint32_t parameters = 0;
+    Value (*call)(const void *target, const Value *arguments) = nullptr;
+    void (*start)(const void *target, const Value *arguments, Completion completion) = nullptr;
+    std::shared_ptr<const void> target;
+};
+
+// A flat, self-contained form of an AST that the interpreter executes.
+// It does not reference the AST it was compiled from.
+//
+// The code of functions comes first and the top-level code follows from entry,
+// ending in Halt. Compiling into a Bytecode that already has code keeps its
+// functions, natives and libraries and replaces its top-level code.
+struct Bytecode
+{
+    std::vector<Instruction> code;
+    std::vector<Value> constants;
+    std::vector<Loop> loops;
+    std::vector<Function> functions;
+    std::unordered_map<std::string, uint32_t> functionIndices;
+    std::vector<NativeFunction> natives;
+    std::unordered_map<std::string, uint32_t> nativeIndices;
+
+    // imported by dll_import, newest last
+    std::vector<std::shared_ptr<const ForeignLibrary>> libraries;
+
+    // Set by the host. dll_import is a compile error unless it is, since a
+    // library it loads can do anything the process can.
+    bool importsAllowed = false;
+
+    // where the top-level code, its constants and its loops start
+    uint32_t entry = 0;
+    uint32_t topLevelConstants = 0;
+    uint32_t topLevelLoops = 0;
+
+    // the deepest the value stack gets within one frame
+    size_t maxStackDepth = 0;
+};
+
+class Compiler
+{
+public:
+    // resolves every variable in ast to a slot in slots before returning. With a
+    // profiler, every statement and expression is wrapped in a profiler site.
+    static Bytecode compile(const AST &ast, SlotTable &slots, Profiler *profiler = nullptr);
+
+    // adds the functions of ast to bytecode, replacing any with the same name,
+    // and makes the top level of ast its top-level code. If this throws,
+    // bytecode keeps the functions it had before.
+    static void compile(const AST &ast, SlotTable &slots, Bytecode &bytecode, Profiler *profiler = nullptr);
+};
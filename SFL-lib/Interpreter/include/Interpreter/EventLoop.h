@@ -0,0 +1,96 @@
+#pragma once
+
+#include <Interpreter/Interpreter.h>
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// Runs many scripts on one thread, together with the I/O their async
+// functions wait on. A script that calls an async function is suspended until
+// it completes, and the others run in the meantime, so thousands of scripts
+// can be waiting at once without a thread each. Scripts that only compute take
+// turns in slices of fuel, so none of them holds up the rest.
+//
+// The I/O is done with epoll: an async function starts its request, watches
+// the file descriptor or sets a timer, and finishes its Completion from the
+// callback. Everything but post must be called on the thread running the loop.
+class EventLoop
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    EventLoop();
+    ~EventLoop();
+
+    EventLoop(const EventLoop &) = delete;
+    EventLoop &operator=(const EventLoop &) = delete;
+
+    // callback is given the epoll events fd is ready for, until it is unwatched
+    void watch(int fd, uint32_t events, std::function<void(uint32_t)> callback);
+    void unwatch(int fd);
+
+    // calls callback once, no sooner than delay from now
+    void after(Clock::duration delay, std::function<void()> callback);
+
+    // Calls callback on the loop's thread. This is how work done on other
+    // threads gets back to the loop, and may be called from any thread.
+    void post(std::function<void()> callback);
+
+    // Runs ast on interpreter, taking turns with the other scripts. done is
+    // called once it finishes, with the exception it failed with if any. Both
+    // interpreter and ast must last until then, and interpreter's ready handler
+    // is the loop's until then.
+    void start(Interpreter &interpreter, const AST &ast, std::function<void(std::exception_ptr)> done);
+
+    // the fuel a script may use before the next gets a turn
+    void setSlice(uint64_t fuel);
+
+    // Returns once every script started has finished. It blocks while they
+    // are all waiting, so something must be set to finish their calls.
+    void run();
+
+    size_t scriptsInFlight() const;
+
+private:
+    struct Script
+    {
+        Interpreter *interpreter;
+        const AST *ast;
+        std::function<void(std::exception_ptr)> done;
+        bool started = false;
+        bool queued = false;
+    };
+
+    struct Timer
+    {
+        Clock::time_point when;
+        uint64_t order; // keeps timers due at the same time in the order they were set
+        std::function<void()> callback;
+    };
+
+    void schedule(uint64_t id);
+    void step(uint64_t id);
+    void poll(bool block);
+    void runPosted();
+    void runTimers();
+
+    int epoll;
+    int wakeup; // an eventfd that post writes to
+    std::unordered_map<int, std::function<void(uint32_t)>> watched;
+    std::vector<Timer> timers; // a heap, soonest first
+    uint64_t timersSet = 0;
+
+    std::mutex postedMutex;
+    std::vector<std::function<void()>> posted;
+
+    std::unordered_map<uint64_t, Script> scripts;
+    std::deque<uint64_t> ready;
+    uint64_t nextId = 0;
+    uint64_t slice = 100000;
+};
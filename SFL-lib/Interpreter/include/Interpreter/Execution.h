@@ -0,0 +1,48 @@
+#pragma once
+
+#include <Interpreter/Async.h>
+#include <Interpreter/Bytecode.h>
+#include <Interpreter/Jit.h>
+#include <Interpreter/Value.h>
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+// Where a run of a Bytecode has got to. It is kept between calls into the
+// interpreter, so a run that was suspended carries on from where it stopped,
+// and the stacks keep their capacity from one run to the next.
+struct Execution
+{
+    struct Frame
+    {
+        uint32_t returnTo;  // instruction
+        size_t base;        // of the caller's frame
+        uint32_t function;  // the one called
+    };
+
+    std::vector<Value> stack; // frames and the values being worked on, in one block
+    std::vector<Frame> frames;
+    uint32_t pc = 0;
+    size_t base = 0;          // of the current frame
+    bool suspended = false;
+    std::unique_ptr<JitTier> jit; // null unless the JIT is on
+    std::shared_ptr<Completion::State> pending; // the async call being waited on, if any
+
+    // Called when the async call a suspended run is waiting on completes. It
+    // is set up by the host rather than by a run, so clear leaves it.
+    std::function<void()> ready;
+
+    Execution() = default;
+    Execution(Execution &&) = default;
+    Execution &operator=(Execution &&other);
+    ~Execution();
+
+    // sets up a run of the top-level code of bytecode, with the JIT if jitStats is given
+    void start(const Bytecode &bytecode, JitStats *jitStats);
+
+    // drops whatever a run left behind, suspended or not. A call still
+    // pending is left to finish, but nothing waits on it any more.
+    void clear();
+};
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <Interpreter/Value.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// A shared library opened by dll_import. It stays loaded for as long as any
+// function bound from it does.
+class ForeignLibrary
+{
+public:
+    // throws an InterpreterError if the library cannot be loaded
+    explicit ForeignLibrary(std::string path);
+    ~ForeignLibrary();
+
+    ForeignLibrary(const ForeignLibrary &) = delete;
+    ForeignLibrary &operator=(const ForeignLibrary &) = delete;
+
+    // returns null if the library has no such symbol
+    void *find(const std::string &symbol) const;
+
+    const std::string &getPath() const;
+
+private:
+    std::string path;
+    void *handle;
+};
+
+// A C function bound by dll_bind to a signature such as "double(double, string)".
+//
+// The signature is parsed once, when the function is bound, and picks a stub
+// that calls the function through a pointer of exactly its C type. A call
+// converts each argument straight into the register-sized slot the stub
+// passes on, so it looks nothing up and allocates nothing.
+//
+//     int, long   a number, rounded towards zero
+//     double      a number
+//     string      a const char * to the characters of a string, which must not be kept
+//     buffer      a const char * and a size_t length, passed as two arguments
+//     void        no result, only as the return type
+//
+// A string result is copied, and a null one gives undefined. Strings are
+// passed without copying unless the Value only covers part of its buffer and
+// so has no terminator.
+class ForeignFunction
+{
+public:
+    // arguments after strings are split into their C parts
+    static constexpr uint32_t MaxArguments = 6;
+
+    enum class Type : uint8_t
+    {
+        Void,
+        Int,
+        Long,
+        Double,
+        String,
+        Buffer,
+    };
+
+    // throws an InterpreterError if the signature cannot be parsed
+    ForeignFunction(std::string name, std::shared_ptr<const ForeignLibrary> library, void *address,
+                    const std::string &signature);
+
+    // how many values an SFL call passes
+    uint32_t parameterCount() const;
+
+    Value call(const Value *arguments) const;
+
+    // the shape of NativeFunction::call
+    static Value call(const void *function, const Value *arguments);
+
+    const std::string &getName() const;
+
+    // the raw argument slots a stub passes on, each as an integer or a double
+    union Slot
+    {
+        int64_t integer;
+        double real;
+    };
+    typedef Value (*Stub)(void *address, const Slot *slots);
+
+private:
+    std::string name;
+    std::shared_ptr<const ForeignLibrary> library;
+    void *address;
+    Stub stub;
+    Type parameters[MaxArguments];
+    uint32_t parameterTotal = 0;
+};
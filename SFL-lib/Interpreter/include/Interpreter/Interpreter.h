@@ -1,19 +1,103 @@
 #pragma once
 
 #include <Interpreter/Value.h>
+#include <Interpreter/Async.h>
+#include <Interpreter/Bytecode.h>
+#include <Interpreter/Execution.h>
+#include <Interpreter/Profiler.h>
+#include <Interpreter/Jit.h>
+#include <Interpreter/Native.h>
+#include <Interpreter/OutputSink.h>
+#include <Interpreter/RunLimits.h>
 
 #include <Parser/Parser.h>
 
-#include <unordered_map>
+#include <vector>
+#include <functional>
+#include <memory>
+#include <iostream>
 
 class Interpreter
 {
 public:
     void run(const AST &ast);
 
+    // Runs ast until it finishes or reaches limits, when it is suspended. A
+    // suspended run carries on from where it stopped with resume, which gets
+    // limits of its own, so one thread can take turns running many
+    // interpreters. Running another program drops a suspended run.
+    RunStatus run(const AST &ast, const RunLimits &limits);
+    RunStatus resume(const RunLimits &limits = RunLimits());
+    bool isSuspended() const;
+
+    // name based access for hosts. Running code reads and writes slots directly.
     Value getGlobalVariable(const std::string &name) const;
     void setGlobalVariable(const std::string &name, Value value);
 
+    // Makes function callable from SFL by name, with as many arguments as it
+    // has parameters. Its parameter and result types pick their conversions
+    // from and to Value at compile time (see NativeArgument and NativeResult).
+    // Calls are bound to it when a program is compiled; registering the same
+    // name again replaces it for programs that were compiled before, so the
+    // replacement has to take as many arguments.
+    template<typename F>
+    void registerFunction(const std::string &name, F function)
+    {
+        registerNative(NativeBinding<std::decay_t<F>>::make(name, std::move(function)));
+    }
+
+    // As registerFunction, for a function that finishes later. Its first
+    // parameter is the Completion it finishes, and the rest are the SFL
+    // arguments. Until it is finished a run that calls it is suspended with
+    // RunStatus::Waiting, and resume returns Waiting again straight away.
+    template<typename F>
+    void registerAsyncFunction(const std::string &name, F function)
+    {
+        registerNative(AsyncNativeBinding<std::decay_t<F>>::make(name, std::move(function)));
+    }
+
+    // Called when the async call a suspended run is waiting on is finished,
+    // from inside resolve or reject, so the run can be resumed. It should only
+    // schedule that rather than resume the run itself.
+    void setReadyHandler(std::function<void()> handler);
+
+    // Programs run while profiling is on are counted and timed per statement and
+    // expression. When it is off no profiling code is compiled in at all.
+    // Turning it off discards what was collected.
+    void setProfiling(bool enabled);
+
+    // null unless profiling is on
+    const Profiler *getProfiler() const;
+
+    // print writes to std::cout unless given another sink. The sink is flushed
+    // at the end of every run, even one that fails.
+    void setOutput(OutputSink sink);
+    OutputSink &getOutput();
+
+    // Off by default. When on, hot while loops that only do number arithmetic
+    // on globals are compiled to machine code. It stays off on targets the JIT
+    // does not support.
+    void setJit(bool enabled);
+    bool isJitEnabled() const;
+    const JitStats &getJitStats() const;
+
+    // Off by default. When on, programs may load shared libraries with
+    // dll_import and call into them, which lets them do anything the host can.
+    // Only turn it on for trusted code.
+    void setForeignImports(bool allowed);
+    bool areForeignImportsAllowed() const;
+
 private:
-    std::unordered_map<std::string, Value> globals;
+    void registerNative(NativeFunction native);
+    void abandon();
+    RunStatus carryOn(const RunLimits &limits);
+
+    SlotTable slotTable;
+    Bytecode bytecode; // the functions defined so far, and the code of the last run
+    Execution execution;
+    std::vector<Value> globals; // indexed by slot, undefined until assigned
+    std::unique_ptr<Profiler> profiler;
+    OutputSink output = OutputSink::stream(std::cout);
+    bool jitEnabled = false;
+    JitStats jitStats;
 };
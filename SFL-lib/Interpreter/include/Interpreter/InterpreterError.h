@@ -1,3 +1,5 @@
+#pragma once
+
 #include <Parser/Parser.h>
 
 #include <stdexcept>
@@ -7,6 +9,13 @@
 class InterpreterError : public std::runtime_error
 {
 public:
-    InterpreterError(std::string error, AST::Node *node = nullptr);
-    AST::Node *node;
+    InterpreterError(std::string error, const AST::Node *node = nullptr);
+
+    // only valid while the AST it came from is. Errors raised while running
+    // compiled code have no node.
+    const AST::Node *node;
+
+    // where node came from, or -1. Kept so the error can outlive the AST.
+    int32_t lineNumber;
+    int32_t colPosition;
 };
\ No newline at end of file
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <Interpreter/Bytecode.h>
+#include <Interpreter/Value.h>
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// A while loop compiled to x86-64 machine code. It reads and writes the
+// globals directly, keeping every temporary in an SSE register.
+//
+// It charges its iterations to the interpreter's fuel the same way the
+// interpreter does, and leaves at the back edge where the fuel runs out.
+//
+// Only loops that do number arithmetic on globals are compiled, so the only
+// thing that can make the code wrong is a global holding something other than
+// a number when the loop is entered. That is checked on every entry, and a
+// failed check leaves the loop to the interpreter for that pass.
+class JitLoop
+{
+public:
+    ~JitLoop();
+
+    static constexpr uint32_t NotRun = UINT32_MAX;
+
+    // runs the loop until it ends or budget drops to zero or below, and returns
+    // the instruction to carry on from. Returns NotRun without doing anything
+    // if a global the loop uses does not hold a number.
+    uint32_t run(Value *globals, int64_t &budget) const;
+
+private:
+    friend class JitCompiler;
+
+    JitLoop() = default;
+    JitLoop(const JitLoop &) = delete;
+    JitLoop &operator=(const JitLoop &) = delete;
+
+    void *code = nullptr;
+    size_t size = 0;
+
+    std::vector<uint32_t> loaded; // must be numbers on entry
+    std::vector<uint32_t> stored; // must be numbers or undefined on entry
+};
+
+class JitCompiler
+{
+public:
+    // false on targets the JIT cannot generate code for
+    static bool isSupported();
+
+    // returns null if the loop does anything other than number arithmetic on globals
+    static std::unique_ptr<JitLoop> compile(const Bytecode &bytecode, const Loop &loop);
+};
+
+struct JitStats
+{
+    uint32_t compiled = 0;  // loops turned into machine code
+    uint32_t rejected = 0;  // hot loops that could not be compiled
+    uint64_t entries = 0;   // times compiled code ran a loop
+    uint64_t deopts = 0;    // times a type check sent a compiled loop back to the interpreter
+};
+
+// Decides when the loops of one Bytecode are hot enough to compile, and keeps
+// the code for as long as the Bytecode runs.
+class JitTier
+{
+public:
+    // back edges a loop takes before it is compiled
+    static constexpr uint32_t Threshold = 64;
+
+    JitTier(const Bytecode &bytecode, JitStats &stats);
+
+    // Points the tier at the Bytecode and stats it works for again. Their
+    // owner may have moved while a run was suspended, so this is done before
+    // every run.
+    void attach(const Bytecode &bytecode, JitStats &stats);
+
+    // called when loop is about to run another iteration. Returns the
+    // instruction to carry on from if compiled code ran the loop, as for
+    // JitLoop::run, or JitLoop::NotRun if it did not.
+    uint32_t run(uint32_t loop, Value *globals, int64_t &budget);
+
+private:
+    const Bytecode *bytecode;
+    JitStats *stats;
+    std::vector<uint32_t> counts;
+    std::vector<bool> tried;
+    std::vector<std::unique_ptr<JitLoop>> compiled;
+};
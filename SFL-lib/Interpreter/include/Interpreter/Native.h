@@ -0,0 +1,237 @@
+#pragma once
+
+#include <Interpreter/Bytecode.h>
+#include <Interpreter/InterpreterError.h>
+#include <Interpreter/Value.h>
+
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+// How a C++ parameter of type T is read from the Value an SFL call passes.
+// get checks the Value holds the right type and throws otherwise; that check
+// is the only thing decided at run time. Specialize it for other types.
+template<typename T, typename Enable = void>
+struct NativeArgument;
+
+// How a C++ result of type T becomes a Value. Specialize it for other types.
+template<typename T, typename Enable = void>
+struct NativeResult;
+
+template<>
+struct NativeArgument<Value>
+{
+    static const Value &get(const Value &value, const std::string &, uint32_t)
+    {
+        return value;
+    }
+};
+
+template<typename T>
+struct NativeArgument<T, std::enable_if_t<std::is_floating_point<T>::value>>
+{
+    static T get(const Value &value, const std::string &name, uint32_t index)
+    {
+        if(!value.isNumber()) fail(name, index);
+        return static_cast<T>(value.getNumber());
+    }
+
+    [[noreturn]] static void fail(const std::string &name, uint32_t index)
+    {
+        throw InterpreterError("Argument " + std::to_string(index + 1) + " of " + name + " must be a number");
+    }
+};
+
+// numbers are rounded towards zero, and must fit
+template<typename T>
+struct NativeArgument<T, std::enable_if_t<std::is_integral<T>::value && !std::is_same<T, bool>::value>>
+{
+    static T get(const Value &value, const std::string &name, uint32_t index)
+    {
+        if(!value.isNumber() ||
+           !(value.getNumber() > static_cast<double>(std::numeric_limits<T>::min()) - 1) ||
+           !(value.getNumber() < static_cast<double>(std::numeric_limits<T>::max()) + 1))
+        {
+            fail(name, index);
+        }
+        return static_cast<T>(value.getNumber());
+    }
+
+    [[noreturn]] static void fail(const std::string &name, uint32_t index)
+    {
+        throw InterpreterError("Argument " + std::to_string(index + 1) + " of " + name +
+                               " must be a number that fits in an integer");
+    }
+};
+
+// true the way an if condition is: a number that is exactly 1, or a string
+// that is not empty
+template<>
+struct NativeArgument<bool>
+{
+    static bool get(const Value &value, const std::string &, uint32_t)
+    {
+        return value.asBool();
+    }
+};
+
+// borrowed from the Value, so only valid during the call
+template<>
+struct NativeArgument<std::string_view>
+{
+    static std::string_view get(const Value &value, const std::string &name, uint32_t index)
+    {
+        if(!value.isString()) fail(name, index);
+        return value.getString();
+    }
+
+    [[noreturn]] static void fail(const std::string &name, uint32_t index)
+    {
+        throw InterpreterError("Argument " + std::to_string(index + 1) + " of " + name + " must be a string");
+    }
+};
+
+template<>
+struct NativeArgument<std::string>
+{
+    static std::string get(const Value &value, const std::string &name, uint32_t index)
+    {
+        return std::string(NativeArgument<std::string_view>::get(value, name, index));
+    }
+};
+
+template<>
+struct NativeResult<Value>
+{
+    static Value make(Value result)
+    {
+        return result;
+    }
+};
+
+template<typename T>
+struct NativeResult<T, std::enable_if_t<std::is_arithmetic<T>::value>>
+{
+    static Value make(T result)
+    {
+        return Value::createNumber(static_cast<double>(result));
+    }
+};
+
+template<>
+struct NativeResult<std::string>
+{
+    static Value make(std::string result)
+    {
+        return Value::createString(std::move(result));
+    }
+};
+
+template<>
+struct NativeResult<std::string_view>
+{
+    static Value make(std::string_view result)
+    {
+        return Value::createString(std::string(result));
+    }
+};
+
+// null gives undefined
+template<>
+struct NativeResult<const char *>
+{
+    static Value make(const char *result)
+    {
+        return result ? Value::createString(std::string(result)) : Value();
+    }
+};
+
+// The parameter and result types of a function, function pointer or object
+// with one operator().
+template<typename F>
+struct NativeSignature : NativeSignature<decltype(&F::operator())>
+{};
+
+template<typename R, typename... Args>
+struct NativeSignature<R (*)(Args...)>
+{
+    typedef R Result;
+    typedef std::tuple<std::decay_t<Args>...> Arguments;
+};
+
+template<typename R, typename... Args>
+struct NativeSignature<R (*)(Args...) noexcept> : NativeSignature<R (*)(Args...)>
+{};
+
+template<typename C, typename R, typename... Args>
+struct NativeSignature<R (C::*)(Args...)> : NativeSignature<R (*)(Args...)>
+{};
+
+template<typename C, typename R, typename... Args>
+struct NativeSignature<R (C::*)(Args...) const> : NativeSignature<R (*)(Args...)>
+{};
+
+template<typename C, typename R, typename... Args>
+struct NativeSignature<R (C::*)(Args...) noexcept> : NativeSignature<R (*)(Args...)>
+{};
+
+template<typename C, typename R, typename... Args>
+struct NativeSignature<R (C::*)(Args...) const noexcept> : NativeSignature<R (*)(Args...)>
+{};
+
+// Wraps a C++ callable as a NativeFunction. Which conversion each argument
+// and the result go through is settled here, when the template is
+// instantiated, so a call only checks the types of the Values it is given.
+template<typename F>
+class NativeBinding
+{
+public:
+    typedef NativeSignature<F> Signature;
+    typedef typename Signature::Arguments Arguments;
+    typedef typename Signature::Result Result;
+
+    static NativeFunction make(std::string name, F function)
+    {
+        NativeFunction native;
+        native.name = name;
+        native.parameters = std::tuple_size<Arguments>::value;
+        native.call = &call;
+        native.target = std::make_shared<NativeBinding>(std::move(name), std::move(function));
+        return native;
+    }
+
+    NativeBinding(std::string name, F function)
+        : name(std::move(name)), function(std::move(function))
+    {}
+
+private:
+    static Value call(const void *target, const Value *arguments)
+    {
+        // made non-const by make, so a callable may change its own state
+        auto &binding = *static_cast<NativeBinding *>(const_cast<void *>(target));
+        return binding.invoke(arguments, std::make_index_sequence<std::tuple_size<Arguments>::value>());
+    }
+
+    template<size_t... I>
+    Value invoke(const Value *arguments, std::index_sequence<I...>)
+    {
+        if constexpr(std::is_void<Result>::value)
+        {
+            function(NativeArgument<std::tuple_element_t<I, Arguments>>::get(arguments[I], name, I)...);
+            return Value();
+        }
+        else
+        {
+            return NativeResult<std::decay_t<Result>>::make(
+                function(NativeArgument<std::tuple_element_t<I, Arguments>>::get(arguments[I], name, I)...));
+        }
+    }
+
+    std::string name;
+    F function;
+};
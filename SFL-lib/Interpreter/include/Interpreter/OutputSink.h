@@ -0,0 +1,59 @@
+#pragma once
+
+#include <Interpreter/Value.h>
+
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+// Where print writes to. Output is collected in a buffer and handed to the
+// target in large chunks: when the buffer fills up, when flush is called, and
+// when the sink is destroyed. The Interpreter also flushes after every run.
+class OutputSink
+{
+public:
+    typedef std::function<void(std::string_view)> Target;
+
+    enum class NumberFormat
+    {
+        Fixed,      // six decimals with trailing zeros dropped, like Value::asString
+        Shortest,   // the fewest digits that read back as the same number
+    };
+
+    static constexpr size_t DefaultCapacity = 64 * 1024;
+
+    explicit OutputSink(Target target, size_t capacity = DefaultCapacity);
+
+    // writes with write(2). The descriptor is not closed.
+    static OutputSink fileDescriptor(int fd, size_t capacity = DefaultCapacity);
+
+    // appends to output, which must outlive the sink
+    static OutputSink memory(std::string &output, size_t capacity = DefaultCapacity);
+
+    // writes to out, which must outlive the sink
+    static OutputSink stream(std::ostream &out, size_t capacity = DefaultCapacity);
+
+    OutputSink(OutputSink &&other) noexcept;
+    OutputSink &operator=(OutputSink &&other) noexcept;
+    ~OutputSink();
+
+    void write(std::string_view text);
+    void write(double number);
+    void write(const Value &value);
+
+    void flush();
+
+    void setNumberFormat(NumberFormat format);
+
+private:
+    // makes room for at least size more characters, flushing if need be
+    char *reserve(size_t size);
+
+    Target target;
+    std::unique_ptr<char[]> buffer;
+    size_t capacity;
+    size_t used = 0;
+    NumberFormat numberFormat = NumberFormat::Fixed;
+};
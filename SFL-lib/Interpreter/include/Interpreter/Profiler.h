@@ -0,0 +1,61 @@
+#pragma once
+
+#include <Parser/Parser.h>
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <string_view>
+#include <tuple>
+#include <vector>
+
+// Counts and times the statements and expressions of profiled programs. Each
+// node is a site keyed by its line:col, so running the same source again adds
+// to the same entries.
+//
+// Inclusive time covers the node and everything it evaluates, exclusive time
+// leaves out the time spent in its child nodes.
+class Profiler
+{
+public:
+    struct Entry
+    {
+        int lineNumber;
+        int colPosition;
+        AST::Node::Type type;
+
+        uint64_t count = 0;
+        std::chrono::steady_clock::duration inclusive{};
+        std::chrono::steady_clock::duration exclusive{};
+    };
+
+    // returns the site for node, adding one if its position has not been seen
+    uint32_t site(const AST::Node *node);
+
+    void enter(uint32_t site);
+    void exit();
+
+    // exits every entered site, for when a run stops part way through
+    void unwind();
+
+    const std::vector<Entry> &entries() const;
+
+    // sorted by exclusive time, most first
+    std::vector<Entry> hotSpots() const;
+
+    // prints the hottest sites, along with their line of source if it is given
+    void report(std::ostream &out, std::string_view source = {}, size_t limit = 20) const;
+
+private:
+    struct Frame
+    {
+        uint32_t site;
+        std::chrono::steady_clock::time_point start;
+        std::chrono::steady_clock::duration children;
+    };
+
+    std::vector<Entry> sites;
+    std::map<std::tuple<int, int, AST::Node::Type>, uint32_t> indices;
+    std::vector<Frame> stack;
+};
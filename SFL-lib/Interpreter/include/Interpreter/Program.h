@@ -0,0 +1,105 @@
+#pragma once
+
+#include <Interpreter/Bytecode.h>
+#include <Interpreter/Execution.h>
+#include <Interpreter/Jit.h>
+#include <Interpreter/OutputSink.h>
+#include <Interpreter/RunLimits.h>
+#include <Interpreter/Value.h>
+#include <Interpreter/WorkerPool.h>
+
+#include <Parser/Parser.h>
+
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// A program compiled once so it can be run any number of times, from any
+// number of threads at once. Nothing in a Program changes after it is built and
+// it does not refer back to the AST it came from.
+class Program
+{
+public:
+    // ast may only use dll_import if foreignImports is true (see Interpreter::setForeignImports)
+    explicit Program(const AST &ast, bool foreignImports = false);
+
+    const Bytecode &getBytecode() const;
+    const SlotTable &getSlots() const;
+
+private:
+    friend class Context;
+
+    // a copy of the bytecode that one Context can rewrite as it runs
+    Bytecode instantiate() const;
+
+    SlotTable slots;
+    Bytecode bytecode;
+};
+
+// One independent run of a Program: its globals, output and the instructions
+// it has quickened. A Context must only be used by one thread at a time, but
+// any number of them can run the same Program on different threads without
+// sharing anything that changes.
+class Context
+{
+public:
+    explicit Context(std::shared_ptr<const Program> program);
+
+    // runs the program against this context's globals, which persist between runs
+    void run();
+
+    // as for Interpreter, a run that reaches limits is suspended until it is resumed
+    RunStatus run(const RunLimits &limits);
+    RunStatus resume(const RunLimits &limits = RunLimits());
+    bool isSuspended() const;
+
+    // makes every global undefined again and drops a suspended run, keeping
+    // the quickened instructions
+    void reset();
+
+    // only names the program uses have globals
+    Value getGlobalVariable(const std::string &name) const;
+    void setGlobalVariable(const std::string &name, Value value);
+
+    // print writes to std::cout unless given another sink. The sink is flushed
+    // at the end of every run, even one that fails.
+    void setOutput(OutputSink sink);
+    OutputSink &getOutput();
+
+    void setJit(bool enabled);
+    const JitStats &getJitStats() const;
+
+    const Program &getProgram() const;
+
+private:
+    RunStatus carryOn(const RunLimits &limits);
+
+    std::shared_ptr<const Program> program;
+    Bytecode bytecode;
+    Execution execution;
+    std::vector<Value> globals;
+    OutputSink output = OutputSink::stream(std::cout);
+    bool jitEnabled = false;
+    JitStats jitStats;
+};
+
+// Runs batches of Contexts on a WorkerPool. Workers claim the next context
+// with one atomic increment, so nothing is locked while a batch runs.
+class ContextRunner
+{
+public:
+    // the thread calling run works too, so count - 1 are started. A count of 0
+    // means one per hardware thread.
+    explicit ContextRunner(unsigned count = 0);
+
+    // runs every context once and returns when they have all finished. The
+    // result holds what each context threw, or null for those that succeeded.
+    std::vector<std::exception_ptr> run(std::vector<Context> &contexts);
+
+    unsigned threadCount() const;
+
+private:
+    WorkerPool pool;
+};
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <Interpreter/Interpreter.h>
+
+#include <string>
+#include <string_view>
+
+// Runs a program as it is typed. Input is fed in line by line and each
+// complete statement is lexed, parsed and run on its own, against globals that
+// live as long as the Repl. Only the statement being entered is ever
+// processed, so the cost of a line does not grow with the session.
+class Repl
+{
+public:
+    enum class Status
+    {
+        Ran,        // everything fed so far has run
+        Incomplete, // waiting for the rest of a statement
+        Failed,     // the statement was dropped; see getError
+    };
+
+    // adds a line of input and runs it if that completes a statement
+    Status feed(std::string_view line);
+
+    // drops a statement that has only been partly entered
+    void reset();
+
+    // what went wrong the last time feed returned Failed
+    const std::string &getError() const;
+
+    Interpreter &getInterpreter();
+
+private:
+    Interpreter interpreter;
+    std::string pending;
+    std::string error;
+};
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+// How far one call to run or resume may go before the run is suspended.
+//
+// Fuel is roughly a number of instructions. It is only charged where a program
+// can go back on itself: each loop iteration costs the length of the loop and
+// each call the length of the function called. Straight-line code in between
+// is free, so a run can go over by one loop body or function.
+struct RunLimits
+{
+    static constexpr uint64_t Unlimited = UINT64_MAX;
+
+    uint64_t fuel = Unlimited;
+
+    // checked every CheckInterval units of fuel, since reading the clock costs
+    // far more than a loop iteration
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+
+    static constexpr uint64_t CheckInterval = 1 << 16;
+
+    static RunLimits withFuel(uint64_t fuel)
+    {
+        RunLimits limits;
+        limits.fuel = fuel;
+        return limits;
+    }
+
+    static RunLimits within(std::chrono::steady_clock::duration time)
+    {
+        RunLimits limits;
+        limits.deadline = std::chrono::steady_clock::now() + time;
+        return limits;
+    }
+};
+
+enum class RunStatus
+{
+    Finished,
+    OutOfFuel,      // suspended, and can be resumed
+    PastDeadline,   // suspended, and can be resumed
+    Waiting,        // suspended until the async call it made completes
+};
@@ -1,12 +1,31 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
-#include <variant>
+#include <string_view>
 
+// A 16 byte tagged value. Numbers are stored inline and strings live in a
+// reference counted heap buffer so copying a Value never copies characters.
+//
+// A string Value is the first length characters of its buffer. Buffers only
+// ever grow at the end, so concatenating onto a Value that covers its whole
+// buffer appends in place and the result shares the buffer. Older Values keep
+// seeing their shorter prefix, which makes building a string in a loop
+// amortized O(1) per step without any Value changing under its holders.
 class Value
 {
 public:
+    // an undefined value, used for variables that have not been assigned yet
+    Value();
+
+    Value(const Value &other);
+    Value(Value &&other) noexcept;
+    Value &operator=(const Value &other);
+    Value &operator=(Value &&other) noexcept;
+    ~Value();
+
     static Value createString(const std::string &v);
+    static Value createString(std::string &&v);
     static Value createNumber(double v);
 
     static Value add(const Value &a, const Value &b);
@@ -15,17 +34,167 @@ public:
     static Value div(const Value &a, const Value &b);
     static Value equals(const Value &a, const Value &b);
 
+    bool isUndefined() const { return tag == Tag::Undefined; }
+    bool isNumber() const { return tag == Tag::Number; }
+    bool isString() const { return tag == Tag::String; }
+
+    // unchecked accessors, only valid when the matching is* is true
+    double getNumber() const { return number; }
+    // Points into the shared buffer, which a concatenation onto any Value
+    // sharing it may reallocate. Only use it until the next add or run, and
+    // copy it to keep it longer.
+    std::string_view getString() const { return std::string_view(string->buffer.data(), length); }
+    // the characters of a string, or null if the buffer goes on past them
+    // without a '\0'. Valid for as long as getString is.
+    const char *getTerminatedString() const
+    {
+        return string->buffer.data()[length] == '\0' ? string->buffer.data() : nullptr;
+    }
+
     std::string getTypeAsString() const;
     std::string asString() const;
     bool asBool() const;
 
+    // the most characters formatNumber writes: a sign, 309 digits and 7 for the decimals
+    static constexpr size_t MaxNumberLength = 320;
+
+    // writes number the way asString shows it and returns the length
+    static size_t formatNumber(double number, char *out);
+
 private:
-    typedef std::variant<double, std::string> Data;
-    Data data;
+    friend class JitCompiler; // generates code that reads and writes number Values
+
+    struct StringObject
+    {
+        uint32_t refCount;
+        std::string buffer;
+    };
+
+    enum class Tag : uint8_t
+    {
+        Undefined,
+        Number,
+        String,
+    };
+
+    Tag tag;
+    uint32_t length; // characters of string->buffer this Value covers
+    union
+    {
+        double number;
+        StringObject *string;
+    };
+
+    bool bothNumbers(const Value &other) const { return tag == Tag::Number && other.tag == Tag::Number; }
 
-    static void requireTypeMatch(const Value &a, const Value &b, std::string opName);
+    void retain() const;
+    void release();
 
-    Value() = delete;
-    explicit Value(const Data &data);
-    explicit Value(const bool &data);
+    // throws for operands that are not both numbers. verb is used when the types match.
+    [[noreturn]] static void throwNotNumbers(const Value &a, const Value &b, const char *opName, const char *verb);
+    static void requireTypeMatch(const Value &a, const Value &b, const char *opName);
+    static Value addSlow(const Value &a, const Value &b);
+    static Value concat(const Value &a, const Value &b);
+    static Value equalsSlow(const Value &a, const Value &b);
+
+    explicit Value(double data);
+    // takes over one reference to data
+    explicit Value(StringObject *data, uint32_t length);
 };
+
+inline Value::Value()
+    : tag(Tag::Undefined), length(0), number(0)
+{}
+
+inline Value::Value(double data)
+    : tag(Tag::Number), length(0), number(data)
+{}
+
+inline Value::Value(StringObject *data, uint32_t length)
+    : tag(Tag::String), length(length), string(data)
+{}
+
+inline Value::Value(const Value &other)
+    : tag(other.tag), length(other.length), number(other.number)
+{
+    retain();
+}
+
+inline Value::Value(Value &&other) noexcept
+    : tag(other.tag), length(other.length), number(other.number)
+{
+    other.tag = Tag::Undefined;
+}
+
+inline Value &Value::operator=(const Value &other)
+{
+    other.retain();
+    release();
+    tag = other.tag;
+    length = other.length;
+    number = other.number;
+    return *this;
+}
+
+inline Value &Value::operator=(Value &&other) noexcept
+{
+    if(this != &other)
+    {
+        release();
+        tag = other.tag;
+        length = other.length;
+        number = other.number;
+        other.tag = Tag::Undefined;
+    }
+    return *this;
+}
+
+inline Value::~Value()
+{
+    release();
+}
+
+inline void Value::retain() const
+{
+    if(tag == Tag::String) string->refCount++;
+}
+
+inline void Value::release()
+{
+    if(tag == Tag::String && --string->refCount == 0) delete string;
+}
+
+inline Value Value::createNumber(double v)
+{
+    return Value(v);
+}
+
+inline Value Value::add(const Value &a, const Value &b)
+{
+    if(a.bothNumbers(b)) return Value(a.number + b.number);
+    return addSlow(a, b);
+}
+
+inline Value Value::sub(const Value &a, const Value &b)
+{
+    if(!a.bothNumbers(b)) throwNotNumbers(a, b, "subtraction", "subtract");
+    return Value(a.number - b.number);
+}
+
+inline Value Value::mul(const Value &a, const Value &b)
+{
+    if(!a.bothNumbers(b)) throwNotNumbers(a, b, "multiply", "multiply");
+    return Value(a.number * b.number);
+}
+
+inline Value Value::div(const Value &a, const Value &b)
+{
+    if(!a.bothNumbers(b)) throwNotNumbers(a, b, "divide", "divide");
+    return Value(a.number / b.number);
+}
+
+inline Value Value::equals(const Value &a, const Value &b)
+{
+    if(a.bothNumbers(b)) return Value(a.number == b.number ? 1.0 : 0.0);
+    return equalsSlow(a, b);
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of threads that all work on one job at a time. The thread that
+// hands over a job works on it too, so a pool of count workers starts
+// count - 1 threads.
+class WorkerPool
+{
+public:
+    // a count of 0 means one per hardware thread
+    explicit WorkerPool(unsigned count = 0);
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool &) = delete;
+    WorkerPool &operator=(const WorkerPool &) = delete;
+
+    // Calls job once on every worker with its number, the calling thread
+    // being worker 0, and returns once every call has returned. job must
+    // not throw, and may refer to anything that lives until run returns.
+    void run(const std::function<void(unsigned)> &job);
+
+    unsigned workerCount() const;
+
+private:
+    void work(unsigned worker);
+
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    const std::function<void(unsigned)> *current = nullptr; // the job being run, if any
+    uint64_t generation = 0;
+    unsigned busy = 0; // threads still working on it
+    bool stopping = false;
+};
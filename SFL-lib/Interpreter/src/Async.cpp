@@ -0,0 +1,34 @@
+#include <Interpreter/Async.h>
+
+#include <utility>
+
+Completion::Completion(std::shared_ptr<State> state)
+    : state(std::move(state))
+{}
+
+void Completion::resolve(Value value)
+{
+    if(state->done) return;
+    state->result = std::move(value);
+    state->done = true;
+    // taken out first, as it may start the run that drops this state
+    std::function<void()> ready;
+    ready.swap(state->ready);
+    if(ready) ready();
+}
+
+void Completion::reject(std::string message)
+{
+    if(state->done) return;
+    state->error = std::move(message);
+    state->failed = true;
+    state->done = true;
+    std::function<void()> ready;
+    ready.swap(state->ready);
+    if(ready) ready();
+}
+
+bool Completion::isDone() const
+{
+    return state->done;
+}
@@ -0,0 +1,713 @@
+#include <Interpreter/Bytecode.h>
+#include <Interpreter/Foreign.h>
+#include <Interpreter/InterpreterError.h>
+
+#include <algorithm>
+
+class CompilerImpl
+{
+public:
+    typedef AST::Node Node;
+
+    CompilerImpl(const AST &ast, SlotTable &slots, Bytecode &bytecode, Profiler *profiler)
+        : ast(ast), slots(slots), bytecode(bytecode), profiler(profiler),
+          slotForSymbol(ast.symbols().size(), NoSlot), localForSymbol(ast.symbols().size(), NoSlot),
+          printSymbol(ast.symbols().find("print")), importSymbol(ast.symbols().find("dll_import")),
+          bindSymbol(ast.symbols().find("dll_bind"))
+    {
+        // the old top-level code has run its course
+        bytecode.code.resize(bytecode.entry);
+        bytecode.constants.resize(bytecode.topLevelConstants);
+        bytecode.loops.resize(bytecode.topLevelLoops);
+
+        Checkpoint checkpoint(bytecode);
+        try
+        {
+            const Node *root = ast.getRoot();
+            verifyType(root, Node::Type::Block);
+
+            // every function is declared and every library bound before any code
+            // is compiled, so calls can come before definitions and functions can
+            // call each other
+            for(uint32_t i = 0; i < root->childCount; i++)
+            {
+                const Node *child = root->child(i);
+                if(child->type == Node::Type::Function)
+                {
+                    declared.push_back(declare(child, checkpoint));
+                }
+                else if(isForeign(child) && child->name == importSymbol)
+                {
+                    import(child);
+                }
+                else if(isForeign(child))
+                {
+                    bind(child, checkpoint);
+                }
+            }
+            for(size_t i = 0, next = 0; i < root->childCount; i++)
+            {
+                if(root->child(i)->type == Node::Type::Function)
+                {
+                    function(root->child(i), declared[next++]);
+                }
+            }
+
+            bytecode.entry = here();
+            bytecode.topLevelConstants = static_cast<uint32_t>(bytecode.constants.size());
+            bytecode.topLevelLoops = static_cast<uint32_t>(bytecode.loops.size());
+            depth = 0;
+            for(uint32_t i = 0; i < root->childCount; i++)
+            {
+                if(root->child(i)->type != Node::Type::Function && !isForeign(root->child(i)))
+                {
+                    statement(root->child(i));
+                }
+            }
+            emit(OpCode::Halt);
+        }
+        catch(...)
+        {
+            checkpoint.restore(bytecode);
+            throw;
+        }
+    }
+
+    void block(const AST::Node *root)
+    {
+        verifyType(root, AST::Node::Type::Block);
+        for(uint32_t i = 0; i < root->childCount; i++)
+        {
+            statement(root->child(i));
+        }
+    }
+
+    void statement(const AST::Node *root)
+    {
+        ProfileSite site(*this, root);
+        if(root->type == AST::Node::Type::Assign)
+        {
+            expression(root->child(1));
+            store(root->child(0));
+            pop(1);
+        }
+        else if(root->type == AST::Node::Type::FunctionCall)
+        {
+            if(isForeign(root))
+            {
+                throw InterpreterError(std::string(ast.name(root)) + " can only be used at the top level", root);
+            }
+            if(root->name == printSymbol)
+            {
+                for(uint32_t i = 0; i < root->childCount; i++)
+                {
+                    expression(root->child(i));
+                    emit(OpCode::Print);
+                    pop(1);
+                }
+            }
+            else
+            {
+                call(root);
+                emit(OpCode::Pop);
+                pop(1);
+            }
+        }
+        else if(root->type == AST::Node::Type::Return)
+        {
+            if(!inFunction)
+            {
+                throw InterpreterError("Cannot return from outside a function", root);
+            }
+            if(root->childCount != 0)
+            {
+                expression(root->child(0));
+            }
+            else
+            {
+                constant(Value());
+            }
+            // the sites this return leaves would otherwise never be exited
+            for(size_t i = 0; i < openSites; i++)
+            {
+                emit(OpCode::ProfileExit);
+            }
+            emit(OpCode::Return);
+            pop(1);
+        }
+        else if(root->type == AST::Node::Type::Function)
+        {
+            throw InterpreterError("Functions can only be defined at the top level", root);
+        }
+        else if(root->type == AST::Node::Type::If)
+        {
+            expression(root->child(0));
+            auto skip = emit(OpCode::JumpIfFalse);
+            pop(1);
+            block(root->child(1));
+            patch(skip);
+        }
+        else if(root->type == AST::Node::Type::While)
+        {
+            // the condition sits after the body so each iteration only takes one branch
+            auto enter = emit(OpCode::Jump);
+            auto body = here();
+            block(root->child(1));
+            patch(enter);
+            expression(root->child(0));
+
+            auto loop = static_cast<uint32_t>(bytecode.loops.size());
+            bytecode.loops.push_back(Loop{enter, body, 0});
+            emit(OpCode::LoopIfTrue, loop);
+            pop(1);
+            bytecode.loops[loop].end = here();
+        }
+        else if(root->type == AST::Node::Type::Block)
+        {
+            block(root);
+        }
+        else
+        {
+            throw InterpreterError("Expression result is unused", root);
+        }
+    }
+
+    void expression(const AST::Node *root)
+    {
+        ProfileSite site(*this, root);
+        if(root->type == AST::Node::Type::Number)
+        {
+            constant(Value::createNumber(root->number));
+        }
+        else if(root->type == AST::Node::Type::String)
+        {
+            constant(Value::createString(std::string(ast.name(root))));
+        }
+        else if(root->type == AST::Node::Type::Variable)
+        {
+            uint32_t local = inFunction ? localForSymbol[root->name] : NoSlot;
+            if(local != NoSlot)
+            {
+                emit(OpCode::LoadLocal, local);
+            }
+            else
+            {
+                emit(OpCode::LoadGlobal, slot(root));
+            }
+            push();
+        }
+        else if(root->type == AST::Node::Type::Add)
+        {
+            binary(root, OpCode::Add);
+        }
+        else if(root->type == AST::Node::Type::Subtract)
+        {
+            binary(root, OpCode::Subtract);
+        }
+        else if(root->type == AST::Node::Type::Multiply)
+        {
+            binary(root, OpCode::Multiply);
+        }
+        else if(root->type == AST::Node::Type::Divide)
+        {
+            binary(root, OpCode::Divide);
+        }
+        else if(root->type == AST::Node::Type::Equals)
+        {
+            binary(root, OpCode::Equals);
+        }
+        else if(root->type == AST::Node::Type::FunctionCall)
+        {
+            if(root->name == printSymbol)
+            {
+                throw InterpreterError("Function " + std::string(ast.name(root)) + " does not return a value", root);
+            }
+            call(root);
+        }
+        else
+        {
+            throw InterpreterError("Internal error: unexpected AST::Node type in expression", root);
+        }
+    }
+
+private:
+    // brackets the code emitted while it is alive with ProfileEnter/ProfileExit
+    class ProfileSite
+    {
+    public:
+        ProfileSite(CompilerImpl &compiler, const AST::Node *node)
+            : compiler(compiler)
+        {
+            if(compiler.profiler)
+            {
+                compiler.emit(OpCode::ProfileEnter, compiler.profiler->site(node));
+                compiler.openSites++;
+            }
+        }
+
+        ~ProfileSite()
+        {
+            if(compiler.profiler)
+            {
+                compiler.emit(OpCode::ProfileExit);
+                compiler.openSites--;
+            }
+        }
+
+    private:
+        CompilerImpl &compiler;
+    };
+
+    // What a failed compile has to undo. Code only ever grows past the marks,
+    // but functions that were redefined have to be put back as they were.
+    class Checkpoint
+    {
+    public:
+        explicit Checkpoint(const Bytecode &bytecode)
+            : code(bytecode.code.size()), constants(bytecode.constants.size()), loops(bytecode.loops.size()),
+              functions(bytecode.functions.size()), natives(bytecode.natives.size()),
+              libraries(bytecode.libraries.size()), entry(bytecode.entry),
+              topLevelConstants(bytecode.topLevelConstants), topLevelLoops(bytecode.topLevelLoops)
+        {}
+
+        void redefining(uint32_t index, const Function &function)
+        {
+            replaced.emplace_back(index, function);
+        }
+
+        void rebinding(uint32_t index, const NativeFunction &native)
+        {
+            rebound.emplace_back(index, native);
+        }
+
+        void restore(Bytecode &bytecode)
+        {
+            for(uint32_t index = functions; index < bytecode.functions.size(); index++)
+            {
+                bytecode.functionIndices.erase(bytecode.functions[index].name);
+            }
+            bytecode.functions.resize(functions);
+            for(auto &function : replaced)
+            {
+                bytecode.functions[function.first] = std::move(function.second);
+            }
+            for(uint32_t index = natives; index < bytecode.natives.size(); index++)
+            {
+                bytecode.nativeIndices.erase(bytecode.natives[index].name);
+            }
+            bytecode.natives.resize(natives);
+            for(auto &native : rebound)
+            {
+                bytecode.natives[native.first] = std::move(native.second);
+            }
+            bytecode.libraries.resize(libraries);
+            bytecode.code.resize(code);
+            bytecode.constants.resize(constants);
+            bytecode.loops.resize(loops);
+            bytecode.entry = entry;
+            bytecode.topLevelConstants = topLevelConstants;
+            bytecode.topLevelLoops = topLevelLoops;
+
+            // the old top-level code is gone, so leave one that does nothing
+            bytecode.code.push_back(Instruction{OpCode::Halt, 0});
+        }
+
+    private:
+        size_t code, constants, loops, functions, natives, libraries;
+        uint32_t entry, topLevelConstants, topLevelLoops;
+        std::vector<std::pair<uint32_t, Function>> replaced;
+        std::vector<std::pair<uint32_t, NativeFunction>> rebound;
+    };
+
+    // adds the function or takes over the one with the same name, so calls
+    // compiled earlier run the new body. Those calls pass as many arguments as
+    // the old one took, so the new one has to take as many.
+    uint32_t declare(const Node *root, Checkpoint &checkpoint)
+    {
+        std::string name(ast.name(root));
+        if(root->name == printSymbol)
+        {
+            throw InterpreterError("Cannot redefine the builtin function " + name, root);
+        }
+        if(bytecode.nativeIndices.count(name) != 0)
+        {
+            throw InterpreterError("Cannot redefine the native function " + name, root);
+        }
+
+        Function function;
+        function.name = name;
+        function.parameters = root->childCount - 1;
+        for(uint32_t i = 0; i < function.parameters; i++)
+        {
+            std::string parameter(ast.name(root->child(i)));
+            if(std::find(function.locals.begin(), function.locals.end(), parameter) != function.locals.end())
+            {
+                throw InterpreterError("Function " + name + " has two parameters named " + parameter, root->child(i));
+            }
+            function.locals.push_back(std::move(parameter));
+        }
+
+        auto result = bytecode.functionIndices.insert({name, static_cast<uint32_t>(bytecode.functions.size())});
+        uint32_t index = result.first->second;
+        if(result.second)
+        {
+            bytecode.functions.push_back(std::move(function));
+        }
+        else if(std::find(declared.begin(), declared.end(), index) != declared.end())
+        {
+            throw InterpreterError("Function " + name + " is defined twice", root);
+        }
+        else if(bytecode.functions[index].parameters != function.parameters)
+        {
+            throw InterpreterError("Cannot redefine " + name + " with " + std::to_string(function.parameters) +
+                                   " parameters, because it already takes " +
+                                   std::to_string(bytecode.functions[index].parameters), root);
+        }
+        else
+        {
+            checkpoint.redefining(index, bytecode.functions[index]);
+            bytecode.functions[index] = std::move(function);
+        }
+        return index;
+    }
+
+    void function(const Node *root, uint32_t index)
+    {
+        const Node *body = root->child(root->childCount - 1);
+        std::vector<uint32_t> symbols;
+        auto addLocal = [&](const Node *variable, uint32_t offset)
+        {
+            localForSymbol[variable->name] = offset;
+            symbols.push_back(variable->name);
+        };
+
+        Function &function = bytecode.functions[index];
+        for(uint32_t i = 0; i < function.parameters; i++)
+        {
+            addLocal(root->child(i), i);
+        }
+
+        // Variables assigned anywhere in the body are locals for all of it.
+        // Functions whose name ends in ! may change globals instead, so
+        // only their parameters are local.
+        std::string_view name = ast.name(root);
+        if(name.back() != '!')
+        {
+            collectLocals(body, [&](const Node *variable)
+            {
+                if(localForSymbol[variable->name] == NoSlot)
+                {
+                    addLocal(variable, static_cast<uint32_t>(function.locals.size()));
+                    function.locals.emplace_back(ast.name(variable));
+                }
+            });
+        }
+
+        function.entry = here();
+        inFunction = true;
+        depth = 0;
+        block(body);
+        // falling off the end returns nothing
+        constant(Value());
+        emit(OpCode::Return);
+        pop(1);
+        inFunction = false;
+        function.size = here() - function.entry;
+
+        for(uint32_t symbol : symbols)
+        {
+            localForSymbol[symbol] = NoSlot;
+        }
+    }
+
+    template<typename Visit>
+    void collectLocals(const Node *root, const Visit &visit)
+    {
+        if(root->type == Node::Type::Assign)
+        {
+            visit(root->child(0));
+        }
+        for(uint32_t i = 0; i < root->childCount; i++)
+        {
+            collectLocals(root->child(i), visit);
+        }
+    }
+
+    // leaves the result on the stack
+    void call(const Node *root)
+    {
+        std::string name(ast.name(root));
+        if(isForeign(root))
+        {
+            throw InterpreterError(name + " can only be used as a statement at the top level", root);
+        }
+
+        OpCode op = OpCode::Call;
+        uint32_t index, parameters;
+        auto found = bytecode.functionIndices.find(name);
+        if(found != bytecode.functionIndices.end())
+        {
+            index = found->second;
+            parameters = bytecode.functions[index].parameters;
+        }
+        else
+        {
+            found = bytecode.nativeIndices.find(name);
+            if(found == bytecode.nativeIndices.end())
+            {
+                throw InterpreterError("Unknown function " + name, root);
+            }
+            op = OpCode::CallNative;
+            index = found->second;
+            parameters = bytecode.natives[index].parameters;
+        }
+        if(root->childCount != parameters)
+        {
+            throw InterpreterError("Function " + name + " takes " + std::to_string(parameters) +
+                                   " arguments but was given " + std::to_string(root->childCount), root);
+        }
+
+        for(uint32_t i = 0; i < root->childCount; i++)
+        {
+            expression(root->child(i));
+        }
+        emit(op, index);
+        pop(root->childCount);
+        push();
+    }
+
+    bool isForeign(const Node *root) const
+    {
+        return root->type == Node::Type::FunctionCall && (root->name == importSymbol || root->name == bindSymbol);
+    }
+
+    // the arguments of dll_import and dll_bind are only ever string literals
+    std::string literal(const Node *root, uint32_t count, uint32_t index)
+    {
+        if(root->childCount != count)
+        {
+            throw InterpreterError(std::string(ast.name(root)) + " takes " + std::to_string(count) +
+                                   " arguments but was given " + std::to_string(root->childCount), root);
+        }
+        const Node *argument = root->child(index);
+        if(argument->type != Node::Type::String)
+        {
+            throw InterpreterError("The arguments of " + std::string(ast.name(root)) + " must be strings", argument);
+        }
+        return std::string(ast.name(argument));
+    }
+
+    // dll_import("library.so")
+    void import(const Node *root)
+    {
+        std::string path = literal(root, 1, 0);
+        if(!bytecode.importsAllowed)
+        {
+            throw InterpreterError("Cannot import " + path + " because foreign imports are turned off", root);
+        }
+        for(const auto &library : bytecode.libraries)
+        {
+            if(library->getPath() == path) return;
+        }
+        try
+        {
+            bytecode.libraries.push_back(std::make_shared<const ForeignLibrary>(path));
+        }
+        catch(const InterpreterError &e)
+        {
+            throw InterpreterError(e.what(), root);
+        }
+    }
+
+    // dll_bind("function", "signature"), looked up in the newest library that has it
+    void bind(const Node *root, Checkpoint &checkpoint)
+    {
+        std::string name = literal(root, 2, 0);
+        std::string signature = literal(root, 2, 1);
+        if(name == "print" || bytecode.functionIndices.count(name) != 0)
+        {
+            throw InterpreterError("Cannot bind " + name + " because it is already a function", root);
+        }
+
+        void *address = nullptr;
+        std::shared_ptr<const ForeignLibrary> library;
+        for(auto iter = bytecode.libraries.rbegin(); iter != bytecode.libraries.rend() && !address; iter++)
+        {
+            address = (*iter)->find(name);
+            library = *iter;
+        }
+        if(!address)
+        {
+            throw InterpreterError("None of the imported libraries has a function named " + name, root);
+        }
+
+        NativeFunction native;
+        try
+        {
+            auto function = std::make_shared<const ForeignFunction>(name, std::move(library), address, signature);
+            native.name = name;
+            native.parameters = function->parameterCount();
+            native.call = &ForeignFunction::call;
+            native.target = std::move(function);
+        }
+        catch(const InterpreterError &e)
+        {
+            throw InterpreterError(e.what(), root);
+        }
+
+        auto result = bytecode.nativeIndices.insert({name, static_cast<uint32_t>(bytecode.natives.size())});
+        uint32_t index = result.first->second;
+        if(result.second)
+        {
+            bytecode.natives.push_back(std::move(native));
+        }
+        else if(std::find(bound.begin(), bound.end(), index) != bound.end())
+        {
+            throw InterpreterError("Function " + name + " is bound twice", root);
+        }
+        else if(bytecode.natives[index].parameters != native.parameters)
+        {
+            // calls compiled earlier pass as many arguments as the old one took
+            throw InterpreterError("Cannot bind " + name + " with " + std::to_string(native.parameters) +
+                                   " parameters, because it already takes " +
+                                   std::to_string(bytecode.natives[index].parameters), root);
+        }
+        else
+        {
+            checkpoint.rebinding(index, bytecode.natives[index]);
+            bytecode.natives[index] = std::move(native);
+        }
+        bound.push_back(index);
+    }
+
+    void store(const Node *variable)
+    {
+        uint32_t local = inFunction ? localForSymbol[variable->name] : NoSlot;
+        if(local != NoSlot)
+        {
+            emit(OpCode::StoreLocal, local);
+        }
+        else
+        {
+            emit(OpCode::StoreGlobal, slot(variable));
+        }
+    }
+
+    void binary(const AST::Node *root, OpCode op)
+    {
+        expression(root->child(0));
+        expression(root->child(1));
+        emit(op);
+        pop(2);
+        push();
+    }
+
+    void constant(Value value)
+    {
+        emit(OpCode::PushConstant, static_cast<uint32_t>(bytecode.constants.size()));
+        bytecode.constants.push_back(std::move(value));
+        push();
+    }
+
+    // only the first use of each symbol has to look its name up in the slot table
+    uint32_t slot(const AST::Node *variable)
+    {
+        uint32_t &slot = slotForSymbol[variable->name];
+        if(slot == NoSlot)
+        {
+            slot = slots.resolve(std::string(ast.name(variable)));
+        }
+        return slot;
+    }
+
+    // returns the index of the emitted instruction so jumps can be patched later
+    uint32_t emit(OpCode op, uint32_t operand = 0)
+    {
+        bytecode.code.push_back(Instruction{op, operand});
+        return here() - 1;
+    }
+
+    uint32_t here() const
+    {
+        return static_cast<uint32_t>(bytecode.code.size());
+    }
+
+    void patch(uint32_t jump)
+    {
+        bytecode.code[jump].operand = here();
+    }
+
+    void push()
+    {
+        depth++;
+        if(depth > bytecode.maxStackDepth) bytecode.maxStackDepth = depth;
+    }
+
+    void pop(size_t n)
+    {
+        depth -= n;
+    }
+
+    void verifyType(const AST::Node *root, AST::Node::Type type)
+    {
+        if(root->type != type)
+        {
+            throw InterpreterError("Internal error: expected different AST::Node type");
+        }
+    }
+
+    static constexpr uint32_t NoSlot = SymbolTable::None;
+
+    const AST &ast;
+    SlotTable &slots;
+    Bytecode &bytecode;
+    Profiler *profiler;
+    std::vector<uint32_t> slotForSymbol;
+    std::vector<uint32_t> localForSymbol; // frame offsets in the function being compiled
+    std::vector<uint32_t> declared;       // functions defined by ast
+    std::vector<uint32_t> bound;          // natives bound by ast
+    uint32_t printSymbol;
+    uint32_t importSymbol;
+    uint32_t bindSymbol;
+    size_t depth = 0;
+    size_t openSites = 0;
+    bool inFunction = false;
+};
+
+uint32_t SlotTable::resolve(const std::string &name)
+{
+    auto result = indices.insert({name, static_cast<uint32_t>(names.size())});
+    if(result.second)
+    {
+        names.push_back(name);
+    }
+    return result.first->second;
+}
+
+uint32_t SlotTable::find(const std::string &name) const
+{
+    auto iter = indices.find(name);
+    return iter != indices.end() ? iter->second : size();
+}
+
+const std::string &SlotTable::name(uint32_t slot) const
+{
+    return names[slot];
+}
+
+uint32_t SlotTable::size() const
+{
+    return static_cast<uint32_t>(names.size());
+}
+
+Bytecode Compiler::compile(const AST &ast, SlotTable &slots, Profiler *profiler)
+{
+    Bytecode bytecode;
+    compile(ast, slots, bytecode, profiler);
+    return bytecode;
+}
+
+void Compiler::compile(const AST &ast, SlotTable &slots, Bytecode &bytecode, Profiler *profiler)
+{
+    CompilerImpl(ast, slots, bytecode, profiler);
+}
@@ -0,0 +1,247 @@
+#include <Interpreter/EventLoop.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <system_error>
+#include <utility>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+namespace
+{
+    [[noreturn]] void fail(const char *what, int error = errno)
+    {
+        throw std::system_error(error, std::generic_category(), what);
+    }
+
+    // a heap of timers ordered by this puts the soonest on top
+    template<typename Timer>
+    bool later(const Timer &a, const Timer &b)
+    {
+        return a.when != b.when ? a.when > b.when : a.order > b.order;
+    }
+}
+
+EventLoop::EventLoop()
+    : epoll(::epoll_create1(EPOLL_CLOEXEC)), wakeup(-1)
+{
+    if(epoll < 0)
+    {
+        fail("epoll_create1");
+    }
+    wakeup = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if(wakeup < 0)
+    {
+        int error = errno;
+        ::close(epoll);
+        fail("eventfd", error);
+    }
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.fd = wakeup;
+    ::epoll_ctl(epoll, EPOLL_CTL_ADD, wakeup, &event);
+}
+
+EventLoop::~EventLoop()
+{
+    for(auto &script : scripts)
+    {
+        script.second.interpreter->setReadyHandler(nullptr);
+    }
+    ::close(wakeup);
+    ::close(epoll);
+}
+
+void EventLoop::watch(int fd, uint32_t events, std::function<void(uint32_t)> callback)
+{
+    epoll_event event = {};
+    event.events = events;
+    event.data.fd = fd;
+    bool known = watched.count(fd) != 0;
+    if(::epoll_ctl(epoll, known ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &event) < 0)
+    {
+        fail("epoll_ctl");
+    }
+    watched[fd] = std::move(callback);
+}
+
+void EventLoop::unwatch(int fd)
+{
+    if(watched.erase(fd) != 0)
+    {
+        ::epoll_ctl(epoll, EPOLL_CTL_DEL, fd, nullptr);
+    }
+}
+
+void EventLoop::after(Clock::duration delay, std::function<void()> callback)
+{
+    timers.push_back(Timer{Clock::now() + delay, timersSet++, std::move(callback)});
+    std::push_heap(timers.begin(), timers.end(), later<Timer>);
+}
+
+void EventLoop::post(std::function<void()> callback)
+{
+    {
+        std::lock_guard<std::mutex> lock(postedMutex);
+        posted.push_back(std::move(callback));
+    }
+    uint64_t one = 1;
+    ssize_t written = ::write(wakeup, &one, sizeof(one));
+    (void)written; // only fails if the counter is already huge, which still wakes the loop
+}
+
+void EventLoop::start(Interpreter &interpreter, const AST &ast, std::function<void(std::exception_ptr)> done)
+{
+    uint64_t id = nextId++;
+    scripts.emplace(id, Script{&interpreter, &ast, std::move(done)});
+    interpreter.setReadyHandler([this, id]() { schedule(id); });
+    schedule(id);
+}
+
+void EventLoop::setSlice(uint64_t fuel)
+{
+    slice = fuel;
+}
+
+void EventLoop::run()
+{
+    while(!scripts.empty())
+    {
+        // only the scripts ready now get a turn, so I/O is looked at between rounds
+        for(size_t turns = ready.size(); turns > 0; turns--)
+        {
+            uint64_t id = ready.front();
+            ready.pop_front();
+            step(id);
+        }
+        if(!scripts.empty())
+        {
+            poll(ready.empty());
+        }
+    }
+}
+
+size_t EventLoop::scriptsInFlight() const
+{
+    return scripts.size();
+}
+
+void EventLoop::schedule(uint64_t id)
+{
+    auto script = scripts.find(id);
+    if(script != scripts.end() && !script->second.queued)
+    {
+        script->second.queued = true;
+        ready.push_back(id);
+    }
+}
+
+void EventLoop::step(uint64_t id)
+{
+    Script &script = scripts.at(id);
+    script.queued = false;
+    Interpreter &interpreter = *script.interpreter;
+    RunLimits limits = RunLimits::withFuel(slice);
+    std::exception_ptr error;
+    RunStatus status = RunStatus::Finished;
+    try
+    {
+        if(script.started)
+        {
+            status = interpreter.resume(limits);
+        }
+        else
+        {
+            script.started = true;
+            status = interpreter.run(*script.ast, limits);
+        }
+    }
+    catch(...)
+    {
+        error = std::current_exception();
+    }
+
+    if(status == RunStatus::OutOfFuel || status == RunStatus::PastDeadline)
+    {
+        schedule(id);
+    }
+    else if(status == RunStatus::Finished)
+    {
+        // looked up again, as the run may have started other scripts
+        auto finished = scripts.find(id);
+        auto done = std::move(finished->second.done);
+        scripts.erase(finished);
+        interpreter.setReadyHandler(nullptr);
+        done(error);
+    }
+}
+
+void EventLoop::poll(bool block)
+{
+    int timeout = 0;
+    if(block && timers.empty())
+    {
+        timeout = -1;
+    }
+    else if(block)
+    {
+        // rounded up, so a timer is never woken for early
+        auto wait = timers.front().when - Clock::now();
+        auto milliseconds = std::chrono::ceil<std::chrono::milliseconds>(wait).count();
+        timeout = static_cast<int>(std::clamp<decltype(milliseconds)>(milliseconds, 0, INT32_MAX));
+    }
+
+    epoll_event events[64];
+    int count = ::epoll_wait(epoll, events, 64, timeout);
+    if(count < 0 && errno != EINTR)
+    {
+        fail("epoll_wait");
+    }
+    for(int i = 0; i < count; i++)
+    {
+        int fd = events[i].data.fd;
+        if(fd == wakeup)
+        {
+            uint64_t value;
+            ssize_t read = ::read(wakeup, &value, sizeof(value));
+            (void)read;
+            runPosted();
+            continue;
+        }
+        // copied, as the callback may unwatch or rewatch its own descriptor
+        auto callback = watched.find(fd);
+        if(callback != watched.end())
+        {
+            auto handler = callback->second;
+            handler(events[i].events);
+        }
+    }
+    runTimers();
+}
+
+void EventLoop::runPosted()
+{
+    std::vector<std::function<void()>> callbacks;
+    {
+        std::lock_guard<std::mutex> lock(postedMutex);
+        callbacks.swap(posted);
+    }
+    for(auto &callback : callbacks)
+    {
+        callback();
+    }
+}
+
+void EventLoop::runTimers()
+{
+    auto now = Clock::now();
+    while(!timers.empty() && timers.front().when <= now)
+    {
+        std::pop_heap(timers.begin(), timers.end(), later<Timer>);
+        auto callback = std::move(timers.back().callback);
+        timers.pop_back();
+        callback();
+    }
+}
@@ -0,0 +1,326 @@
+#include <Interpreter/Foreign.h>
+#include <Interpreter/InterpreterError.h>
+
+#include <array>
+#include <cctype>
+#include <climits>
+#include <cmath>
+#include <type_traits>
+#include <utility>
+
+#include <dlfcn.h>
+
+// Pointers and sizes are passed as 64 bit integers. Every 64 bit ABI this is
+// built for passes them the same way, so the stubs only have to tell integers
+// from doubles: one stub for each return type and each sequence of up to
+// MaxArguments integers and doubles.
+namespace
+{
+    typedef ForeignFunction::Type Type;
+    typedef ForeignFunction::Slot Slot;
+    typedef ForeignFunction::Stub Stub;
+
+    static_assert(sizeof(void *) == sizeof(int64_t) && sizeof(size_t) == sizeof(int64_t),
+                  "pointers and sizes are passed as 64 bit integers");
+
+    // bit i of a mask is set if argument i is a double
+    template<uint32_t Mask, size_t I>
+    using ArgumentType = std::conditional_t<((Mask >> I) & 1) != 0, double, int64_t>;
+
+    template<uint32_t Mask, size_t I>
+    ArgumentType<Mask, I> unpack(const Slot &slot)
+    {
+        if constexpr(((Mask >> I) & 1) != 0) return slot.real;
+        else return slot.integer;
+    }
+
+    template<typename Result, uint32_t Mask, size_t... I>
+    Result callAs(void *address, const Slot *slots, std::index_sequence<I...>)
+    {
+        typedef Result (*Function)(ArgumentType<Mask, I>...);
+        return reinterpret_cast<Function>(address)(unpack<Mask, I>(slots[I])...);
+    }
+
+    template<Type Return, uint32_t Count, uint32_t Mask>
+    Value stub(void *address, const Slot *slots)
+    {
+        auto arguments = std::make_index_sequence<Count>();
+        if constexpr(Return == Type::Void)
+        {
+            callAs<void, Mask>(address, slots, arguments);
+            return Value();
+        }
+        else if constexpr(Return == Type::Int)
+        {
+            return Value::createNumber(callAs<int, Mask>(address, slots, arguments));
+        }
+        else if constexpr(Return == Type::Long)
+        {
+            return Value::createNumber(static_cast<double>(callAs<long, Mask>(address, slots, arguments)));
+        }
+        else if constexpr(Return == Type::Double)
+        {
+            return Value::createNumber(callAs<double, Mask>(address, slots, arguments));
+        }
+        else
+        {
+            const char *result = callAs<const char *, Mask>(address, slots, arguments);
+            return result ? Value::createString(std::string(result)) : Value();
+        }
+    }
+
+    // shapes are numbered by argument count, then mask: (1 << count) - 1 + mask
+    constexpr size_t ShapeCount = (size_t(1) << (ForeignFunction::MaxArguments + 1)) - 1;
+
+    constexpr uint32_t countOf(size_t shape)
+    {
+        uint32_t count = 0;
+        while(((shape + 1) >> (count + 1)) != 0) count++;
+        return count;
+    }
+
+    constexpr uint32_t maskOf(size_t shape)
+    {
+        return static_cast<uint32_t>(shape + 1 - (size_t(1) << countOf(shape)));
+    }
+
+    template<Type Return, size_t... Shape>
+    constexpr std::array<Stub, ShapeCount> stubsReturning(std::index_sequence<Shape...>)
+    {
+        return {{&stub<Return, countOf(Shape), maskOf(Shape)>...}};
+    }
+
+    // indexed by return type, which the Type enum starts with
+    const std::array<Stub, ShapeCount> stubs[] =
+    {
+        stubsReturning<Type::Void>(std::make_index_sequence<ShapeCount>()),
+        stubsReturning<Type::Int>(std::make_index_sequence<ShapeCount>()),
+        stubsReturning<Type::Long>(std::make_index_sequence<ShapeCount>()),
+        stubsReturning<Type::Double>(std::make_index_sequence<ShapeCount>()),
+        stubsReturning<Type::String>(std::make_index_sequence<ShapeCount>()),
+    };
+
+    class SignatureParser
+    {
+    public:
+        SignatureParser(const std::string &name, const std::string &signature)
+            : name(name), signature(signature)
+        {}
+
+        Type type()
+        {
+            skipSpaces();
+            size_t start = position;
+            while(position < signature.size() && std::isalpha(static_cast<unsigned char>(signature[position])))
+            {
+                position++;
+            }
+            std::string word = signature.substr(start, position - start);
+            if(word == "void") return Type::Void;
+            if(word == "int") return Type::Int;
+            if(word == "long") return Type::Long;
+            if(word == "double") return Type::Double;
+            if(word == "string") return Type::String;
+            if(word == "buffer") return Type::Buffer;
+            fail(word.empty() ? "expected a type" : "unknown type " + word);
+        }
+
+        // consumes c if it comes next
+        bool accept(char c)
+        {
+            skipSpaces();
+            if(position < signature.size() && signature[position] == c)
+            {
+                position++;
+                return true;
+            }
+            return false;
+        }
+
+        void expect(char c)
+        {
+            if(!accept(c)) fail(std::string("expected '") + c + "'");
+        }
+
+        bool atEnd()
+        {
+            skipSpaces();
+            return position == signature.size();
+        }
+
+        [[noreturn]] void fail(const std::string &problem) const
+        {
+            throw InterpreterError("Bad signature \"" + signature + "\" for " + name + ": " + problem);
+        }
+
+    private:
+        void skipSpaces()
+        {
+            while(position < signature.size() && std::isspace(static_cast<unsigned char>(signature[position])))
+            {
+                position++;
+            }
+        }
+
+        const std::string &name;
+        const std::string &signature;
+        size_t position = 0;
+    };
+
+    [[noreturn]] void badArgument(const std::string &name, uint32_t index, const char *expected)
+    {
+        throw InterpreterError("Argument " + std::to_string(index + 1) + " of " + name + " must be " + expected);
+    }
+}
+
+ForeignLibrary::ForeignLibrary(std::string path)
+    : path(std::move(path)), handle(::dlopen(this->path.c_str(), RTLD_NOW | RTLD_LOCAL))
+{
+    if(!handle)
+    {
+        throw InterpreterError("Could not import " + this->path + ": " + ::dlerror());
+    }
+}
+
+ForeignLibrary::~ForeignLibrary()
+{
+    ::dlclose(handle);
+}
+
+void *ForeignLibrary::find(const std::string &symbol) const
+{
+    return ::dlsym(handle, symbol.c_str());
+}
+
+const std::string &ForeignLibrary::getPath() const
+{
+    return path;
+}
+
+ForeignFunction::ForeignFunction(std::string name, std::shared_ptr<const ForeignLibrary> library, void *address,
+                                 const std::string &signature)
+    : name(std::move(name)), library(std::move(library)), address(address)
+{
+    SignatureParser parser(this->name, signature);
+    Type result = parser.type();
+    if(result == Type::Buffer)
+    {
+        parser.fail("a buffer cannot be returned");
+    }
+
+    uint32_t count = 0; // C arguments
+    uint32_t mask = 0;
+    parser.expect('(');
+    if(!parser.accept(')'))
+    {
+        do
+        {
+            Type parameter = parser.type();
+            if(parameter == Type::Void)
+            {
+                parser.fail("void is only a return type");
+            }
+            uint32_t size = parameter == Type::Buffer ? 2 : 1;
+            if(count + size > MaxArguments)
+            {
+                parser.fail("more than " + std::to_string(MaxArguments) + " arguments");
+            }
+            if(parameter == Type::Double)
+            {
+                mask |= 1u << count;
+            }
+            count += size;
+            parameters[parameterTotal++] = parameter;
+        }
+        while(parser.accept(','));
+        parser.expect(')');
+    }
+    if(!parser.atEnd())
+    {
+        parser.fail("unexpected text after the arguments");
+    }
+
+    stub = stubs[static_cast<size_t>(result)][(size_t(1) << count) - 1 + mask];
+}
+
+uint32_t ForeignFunction::parameterCount() const
+{
+    return parameterTotal;
+}
+
+Value ForeignFunction::call(const Value *arguments) const
+{
+    Slot slots[MaxArguments];
+    // only for strings that have to be copied to get a terminator
+    std::string copies[MaxArguments];
+    uint32_t next = 0;
+    for(uint32_t i = 0; i < parameterTotal; i++)
+    {
+        const Value &argument = arguments[i];
+        switch(parameters[i])
+        {
+        case Type::Int:
+        {
+            // the callee only reads the low 32 bits, which would be another number
+            if(!argument.isNumber() || !(argument.getNumber() > INT_MIN - 1.0 && argument.getNumber() < INT_MAX + 1.0))
+            {
+                badArgument(name, i, "a number that fits in an int");
+            }
+            slots[next++].integer = static_cast<int>(argument.getNumber());
+            break;
+        }
+
+        case Type::Long:
+        {
+            // anything outside this range would be undefined to convert
+            if(!argument.isNumber() || !(std::fabs(argument.getNumber()) < 9.2e18))
+            {
+                badArgument(name, i, "a number that fits in an integer");
+            }
+            slots[next++].integer = static_cast<int64_t>(argument.getNumber());
+            break;
+        }
+
+        case Type::Double:
+            if(!argument.isNumber()) badArgument(name, i, "a number");
+            slots[next++].real = argument.getNumber();
+            break;
+
+        case Type::String:
+        {
+            if(!argument.isString()) badArgument(name, i, "a string");
+            const char *characters = argument.getTerminatedString();
+            if(!characters)
+            {
+                copies[i] = std::string(argument.getString());
+                characters = copies[i].c_str();
+            }
+            slots[next++].integer = reinterpret_cast<intptr_t>(characters);
+            break;
+        }
+
+        case Type::Buffer:
+        {
+            if(!argument.isString()) badArgument(name, i, "a string");
+            std::string_view characters = argument.getString();
+            slots[next++].integer = reinterpret_cast<intptr_t>(characters.data());
+            slots[next++].integer = static_cast<int64_t>(characters.size());
+            break;
+        }
+
+        case Type::Void:
+            break;
+        }
+    }
+    return stub(address, slots);
+}
+
+Value ForeignFunction::call(const void *function, const Value *arguments)
+{
+    return static_cast<const ForeignFunction *>(function)->call(arguments);
+}
+
+const std::string &ForeignFunction::getName() const
+{
+    return name;
+}
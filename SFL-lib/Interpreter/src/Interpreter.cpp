@@ -1,149 +1,652 @@
 #include <Interpreter/Interpreter.h>
 #include <Interpreter/InterpreterError.h>
+#include <Interpreter/Bytecode.h>
+#include <Interpreter/Execution.h>
+#include <Interpreter/Jit.h>
+#include <Interpreter/Program.h>
 
+#include <algorithm>
+#include <chrono>
+#include <limits>
 #include <vector>
-#include <optional>
+#include <functional>
+#include <iostream>
 
 
 class InterpreterImpl
 {
 public:
-    InterpreterImpl(Interpreter &interpreter) : interpreter(interpreter) {};
-
-    void block(const AST::Node *root)
+    // instructions in bytecode are rewritten into quicker forms as they run.
+    // profiler may be null.
+    InterpreterImpl(Bytecode &bytecode, const SlotTable &slots, std::vector<Value> &globals,
+                    OutputSink &output, Profiler *profiler, Execution &execution)
+        : bytecode(bytecode), slots(slots), globals(globals), output(output), profiler(profiler),
+          execution(execution), jit(execution.jit.get()), stack(execution.stack), frames(execution.frames)
     {
-        verifyType(root, AST::Node::Type::Block);
-        for(const auto &child : root->children)
-        {
-            statement(child.get());
-        }
+        stack.reserve(std::max<size_t>(bytecode.maxStackDepth, 256));
+        frames.reserve(64);
+        globals.resize(slots.size());
     }
 
-    void statement(const AST::Node *root)
+    // calls nested deeper than this are taken to be runaway recursion
+    static constexpr size_t MaxCallDepth = 100000;
+
+    // carries on from where execution got to, until the program ends or
+    // limits are reached and it is suspended
+    RunStatus run(const RunLimits &runLimits)
     {
-        if(root->type == AST::Node::Type::Assign)
+        limits = runLimits;
+        spent = 0;
+        newSlice();
+
+        if(execution.pending)
         {
-            assign(root);
+            if(!execution.pending->done)
+            {
+                return RunStatus::Waiting;
+            }
+            auto pending = std::move(execution.pending);
+            if(pending->failed)
+            {
+                throw InterpreterError(pending->error);
+            }
+            stack.push_back(std::move(pending->result));
         }
-        else if(root->type == AST::Node::Type::FunctionCall)
+
+        Instruction *code = bytecode.code.data();
+        Instruction *pc = code + execution.pc;
+        size_t base = execution.base; // of the current frame
+        execution.suspended = false;
+        while(true)
         {
-            // our one function for now :)
-            if(root->lexeme.name == "print")
+            Instruction &instruction = *pc++;
+            switch(instruction.op)
             {
-                for(const auto &child : root->children)
+            case OpCode::PushConstant:
+                stack.push_back(bytecode.constants[instruction.operand]);
+                break;
+
+            case OpCode::LoadGlobal:
+            {
+                const auto &global = globals[instruction.operand];
+                if(global.isUndefined())
                 {
-                    std::cout << expression(child.get()).asString();
+                    throw InterpreterError("Could not find a variable by the name " + slots.name(instruction.operand));
                 }
+                stack.push_back(global);
+                break;
             }
-            else
+
+            case OpCode::StoreGlobal:
+                globals[instruction.operand] = pop();
+                break;
+
+            case OpCode::LoadLocal:
             {
-                throw 0; // TODO
+                const auto &local = stack[base + instruction.operand];
+                if(local.isUndefined())
+                {
+                    const Function &function = bytecode.functions[frames.back().function];
+                    throw InterpreterError("Could not find a variable by the name " + function.locals[instruction.operand]);
+                }
+                stack.push_back(local);
+                break;
             }
-        }
-        else if(root->type == AST::Node::Type::If)
-        {
-            if(expression(root->children[0].get()).asBool())
+
+            case OpCode::StoreLocal:
+                stack[base + instruction.operand] = pop();
+                break;
+
+            case OpCode::Pop:
+                stack.pop_back();
+                break;
+
+            case OpCode::Add:
+                quicken(instruction, OpCode::AddNumbers, OpCode::AddGeneric);
+                binary(Value::add);
+                break;
+
+            case OpCode::Subtract:
+                quicken(instruction, OpCode::SubtractNumbers, OpCode::SubtractGeneric);
+                binary(Value::sub);
+                break;
+
+            case OpCode::Multiply:
+                quicken(instruction, OpCode::MultiplyNumbers, OpCode::MultiplyGeneric);
+                binary(Value::mul);
+                break;
+
+            case OpCode::Divide:
+                quicken(instruction, OpCode::DivideNumbers, OpCode::DivideGeneric);
+                binary(Value::div);
+                break;
+
+            case OpCode::Equals:
+                quicken(instruction, OpCode::EqualsNumbers, OpCode::EqualsGeneric);
+                binary(Value::equals);
+                break;
+
+            case OpCode::AddNumbers:
+                if(numbersOnTop()) numbers(std::plus<double>());
+                else generalize(instruction, OpCode::AddGeneric, Value::add);
+                break;
+
+            case OpCode::SubtractNumbers:
+                if(numbersOnTop()) numbers(std::minus<double>());
+                else generalize(instruction, OpCode::SubtractGeneric, Value::sub);
+                break;
+
+            case OpCode::MultiplyNumbers:
+                if(numbersOnTop()) numbers(std::multiplies<double>());
+                else generalize(instruction, OpCode::MultiplyGeneric, Value::mul);
+                break;
+
+            case OpCode::DivideNumbers:
+                if(numbersOnTop()) numbers(std::divides<double>());
+                else generalize(instruction, OpCode::DivideGeneric, Value::div);
+                break;
+
+            case OpCode::EqualsNumbers:
+                if(numbersOnTop()) numbers([](double a, double b) { return a == b ? 1.0 : 0.0; });
+                else generalize(instruction, OpCode::EqualsGeneric, Value::equals);
+                break;
+
+            case OpCode::AddGeneric:
+                binary(Value::add);
+                break;
+
+            case OpCode::SubtractGeneric:
+                binary(Value::sub);
+                break;
+
+            case OpCode::MultiplyGeneric:
+                binary(Value::mul);
+                break;
+
+            case OpCode::DivideGeneric:
+                binary(Value::div);
+                break;
+
+            case OpCode::EqualsGeneric:
+                binary(Value::equals);
+                break;
+
+            case OpCode::Jump:
+                pc = code + instruction.operand;
+                break;
+
+            case OpCode::JumpIfFalse:
+                if(!pop().asBool()) pc = code + instruction.operand;
+                break;
+
+            case OpCode::LoopIfTrue:
+                if(pop().asBool())
+                {
+                    const Loop &loop = bytecode.loops[instruction.operand];
+                    // compiled code starts from the condition again and charges
+                    // this iteration itself
+                    uint32_t resume = jit ? jit->run(instruction.operand, globals.data(), budget) : JitLoop::NotRun;
+                    if(resume != JitLoop::NotRun)
+                    {
+                        pc = code + resume;
+                    }
+                    else
+                    {
+                        pc = code + loop.body;
+                        budget -= loop.end - loop.body;
+                    }
+                    if(budget <= 0 && !refill())
+                    {
+                        return suspend(pc - code, base);
+                    }
+                }
+                break;
+
+            case OpCode::Call:
             {
-                block(root->children[1].get());
+                // the arguments already on the stack become the first locals
+                const Function &function = bytecode.functions[instruction.operand];
+                if(frames.size() == MaxCallDepth)
+                {
+                    throw InterpreterError("Too many nested calls to " + function.name);
+                }
+                frames.push_back(Execution::Frame{static_cast<uint32_t>(pc - code), base, instruction.operand});
+                base = stack.size() - function.parameters;
+                stack.resize(base + function.locals.size());
+                pc = code + function.entry;
+                budget -= function.size;
+                if(budget <= 0 && !refill())
+                {
+                    return suspend(pc - code, base);
+                }
+                break;
             }
-        }
-        else if(root->type == AST::Node::Type::While)
-        {
-            while(expression(root->children[0].get()).asBool())
+
+            case OpCode::Return:
             {
-                block(root->children[1].get());
+                Value result = pop();
+                stack.resize(base);
+                stack.push_back(std::move(result));
+                pc = code + frames.back().returnTo;
+                base = frames.back().base;
+                frames.pop_back();
+                break;
+            }
+
+            case OpCode::CallNative:
+            {
+                const NativeFunction &native = bytecode.natives[instruction.operand];
+                size_t first = stack.size() - native.parameters;
+                if(native.start)
+                {
+                    auto state = std::make_shared<Completion::State>();
+                    native.start(native.target.get(), stack.data() + first, Completion(state));
+                    stack.resize(first);
+                    if(!state->done)
+                    {
+                        // the result is pushed by whichever run finds it done
+                        state->ready = execution.ready;
+                        execution.pending = std::move(state);
+                        status = RunStatus::Waiting;
+                        return suspend(pc - code, base);
+                    }
+                    if(state->failed)
+                    {
+                        throw InterpreterError(state->error);
+                    }
+                    stack.push_back(std::move(state->result));
+                    break;
+                }
+                Value result = native.call(native.target.get(), stack.data() + first);
+                stack.resize(first);
+                stack.push_back(std::move(result));
+                break;
+            }
+
+            case OpCode::Print:
+                output.write(stack.back());
+                stack.pop_back();
+                break;
+
+            case OpCode::ProfileEnter:
+                profiler->enter(instruction.operand);
+                break;
+
+            case OpCode::ProfileExit:
+                profiler->exit();
+                break;
+
+            case OpCode::Halt:
+                return RunStatus::Finished;
             }
-        }
-        else
-        {
-            throw 0; // TODO
         }
     }
 
-    void assign(const AST::Node *root)
+private:
+    Value pop()
     {
-        verifyType(root, AST::Node::Type::Assign);
-        interpreter.setGlobalVariable(root->children[0]->lexeme.name, expression(root->children[1].get()));
+        Value top = std::move(stack.back());
+        stack.pop_back();
+        return top;
     }
 
-    Value expression(const AST::Node *root)
+    void binary(Value (*op)(const Value &, const Value &))
     {
-        auto valueOpt = value(root);
-        if(valueOpt)
-        {
-            return *valueOpt;
-        }
-        
-        // must be an expression then
-        
-        if(root->type == AST::Node::Type::Add)
-        {
-            return Value::add(expression(root->children[0].get()), expression(root->children[1].get()));
-        }
-        else if(root->type == AST::Node::Type::Subtract)
-        {
-            return Value::sub(expression(root->children[0].get()), expression(root->children[1].get()));
-        }
-        else if(root->type == AST::Node::Type::Multiply)
-        {
-            return Value::mul(expression(root->children[0].get()), expression(root->children[1].get()));
-        }
-        else if(root->type == AST::Node::Type::Divide)
-        {
-            return Value::div(expression(root->children[0].get()), expression(root->children[1].get()));
-        }
-        else if(root->type == AST::Node::Type::Equals)
-        {
-            return Value::equals(expression(root->children[0].get()), expression(root->children[1].get()));
-        }
-        else
-        {
-            throw 0; // TODO
-        }
+        Value rhs = pop();
+        stack.back() = op(stack.back(), rhs);
+    }
+
+    bool numbersOnTop() const
+    {
+        return stack.back().isNumber() && stack[stack.size() - 2].isNumber();
+    }
+
+    // the fast path of a quickened instruction, once numbersOnTop has been checked
+    template<typename Op>
+    void numbers(Op op)
+    {
+        double rhs = stack.back().getNumber();
+        stack.pop_back();
+        stack.back() = Value::createNumber(op(stack.back().getNumber(), rhs));
+    }
+
+    // the first run of an arithmetic instruction picks the form it continues as
+    void quicken(Instruction &instruction, OpCode numbersForm, OpCode genericForm)
+    {
+        instruction.op = numbersOnTop() ? numbersForm : genericForm;
     }
 
-    std::optional<Value> value(const AST::Node *root)
+    void generalize(Instruction &instruction, OpCode genericForm, Value (*op)(const Value &, const Value &))
     {
-        if(root->type == AST::Node::Type::Number)
+        instruction.op = genericForm;
+        binary(op);
+    }
+
+    // Fuel is counted down in budget, which only covers as much as can be
+    // spent before the limits have to be looked at again. That keeps the
+    // check at each back edge and call to one subtraction and branch.
+    void newSlice()
+    {
+        uint64_t left = limits.fuel - spent;
+        if(limits.deadline != std::chrono::steady_clock::time_point::max())
         {
-            return std::optional<Value>(Value::createNumber(std::stod(root->lexeme.name)));
+            left = std::min(left, RunLimits::CheckInterval);
         }
-        else if(root->type == AST::Node::Type::String)
+        slice = static_cast<int64_t>(std::min<uint64_t>(left, std::numeric_limits<int64_t>::max()));
+        budget = slice;
+    }
+
+    // called once budget has run out. Returns false if the run has to stop.
+    bool refill()
+    {
+        spent += static_cast<uint64_t>(slice - budget);
+        if(spent >= limits.fuel)
         {
-            return std::optional<Value>(Value::createString(root->lexeme.name));
+            status = RunStatus::OutOfFuel;
+            return false;
         }
-        else if(root->type == AST::Node::Type::Variable)
+        if(limits.deadline != std::chrono::steady_clock::time_point::max() &&
+           std::chrono::steady_clock::now() >= limits.deadline)
         {
-            return std::optional<Value>(interpreter.getGlobalVariable(root->lexeme.name));
+            status = RunStatus::PastDeadline;
+            return false;
         }
-        else
+        newSlice();
+        return true;
+    }
+
+    RunStatus suspend(ptrdiff_t pc, size_t base)
+    {
+        execution.pc = static_cast<uint32_t>(pc);
+        execution.base = base;
+        execution.suspended = true;
+        return status;
+    }
+
+    Bytecode &bytecode;
+    const SlotTable &slots;
+    std::vector<Value> &globals;
+    OutputSink &output;
+    Profiler *profiler;
+    Execution &execution;
+    JitTier *jit;
+    std::vector<Value> &stack;
+    std::vector<Execution::Frame> &frames;
+
+    RunLimits limits;
+    int64_t budget = 0;
+    int64_t slice = 0;  // what budget was last set to
+    uint64_t spent = 0; // fuel used up by earlier slices
+    RunStatus status = RunStatus::Finished;
+};
+
+void Execution::start(const Bytecode &bytecode, JitStats *jitStats)
+{
+    clear();
+    pc = bytecode.entry;
+    if(jitStats)
+    {
+        jit = std::make_unique<JitTier>(bytecode, *jitStats);
+    }
+}
+
+Execution &Execution::operator=(Execution &&other)
+{
+    if(this != &other)
+    {
+        clear();
+        stack = std::move(other.stack);
+        frames = std::move(other.frames);
+        pc = other.pc;
+        base = other.base;
+        suspended = other.suspended;
+        jit = std::move(other.jit);
+        pending = std::move(other.pending);
+        ready = std::move(other.ready);
+        other.clear();
+    }
+    return *this;
+}
+
+Execution::~Execution()
+{
+    clear();
+}
+
+void Execution::clear()
+{
+    if(pending)
+    {
+        pending->ready = nullptr;
+        pending.reset();
+    }
+    stack.clear();
+    frames.clear();
+    pc = 0;
+    base = 0;
+    suspended = false;
+    jit.reset();
+}
+
+void Interpreter::run(const AST &ast)
+{
+    if(run(ast, RunLimits()) == RunStatus::Waiting)
+    {
+        abandon();
+        throw InterpreterError("The program is waiting on an async function, which needs a run with limits");
+    }
+}
+
+RunStatus Interpreter::run(const AST &ast, const RunLimits &limits)
+{
+    abandon();
+    // functions stay compiled from one run to the next
+    Compiler::compile(ast, slotTable, bytecode, profiler.get());
+    execution.start(bytecode, jitEnabled ? &jitStats : nullptr);
+    return carryOn(limits);
+}
+
+RunStatus Interpreter::resume(const RunLimits &limits)
+{
+    if(!execution.suspended)
+    {
+        throw InterpreterError("There is no suspended run to resume");
+    }
+    return carryOn(limits);
+}
+
+bool Interpreter::isSuspended() const
+{
+    return execution.suspended;
+}
+
+void Interpreter::abandon()
+{
+    if(execution.suspended && profiler)
+    {
+        profiler->unwind();
+    }
+    execution.clear();
+}
+
+RunStatus Interpreter::carryOn(const RunLimits &limits)
+{
+    if(execution.jit)
+    {
+        execution.jit->attach(bytecode, jitStats);
+    }
+    RunStatus status;
+    try
+    {
+        status = InterpreterImpl(bytecode, slotTable, globals, output, profiler.get(), execution).run(limits);
+    }
+    catch(...)
+    {
+        execution.clear();
+        if(profiler) profiler->unwind();
+        output.flush();
+        throw;
+    }
+    output.flush();
+    return status;
+}
+
+// these live here rather than with the rest of Context because they drive InterpreterImpl
+
+void Context::run()
+{
+    if(run(RunLimits()) == RunStatus::Waiting)
+    {
+        execution.clear();
+        throw InterpreterError("The program is waiting on an async function, which needs a run with limits");
+    }
+}
+
+RunStatus Context::run(const RunLimits &limits)
+{
+    execution.start(bytecode, jitEnabled ? &jitStats : nullptr);
+    return carryOn(limits);
+}
+
+RunStatus Context::resume(const RunLimits &limits)
+{
+    if(!execution.suspended)
+    {
+        throw InterpreterError("There is no suspended run to resume");
+    }
+    return carryOn(limits);
+}
+
+bool Context::isSuspended() const
+{
+    return execution.suspended;
+}
+
+RunStatus Context::carryOn(const RunLimits &limits)
+{
+    // this context may have moved since the run was suspended
+    if(execution.jit)
+    {
+        execution.jit->attach(bytecode, jitStats);
+    }
+    RunStatus status;
+    try
+    {
+        status = InterpreterImpl(bytecode, program->getSlots(), globals, output, nullptr, execution).run(limits);
+    }
+    catch(...)
+    {
+        execution.clear();
+        output.flush();
+        throw;
+    }
+    output.flush();
+    return status;
+}
+
+void Interpreter::registerNative(NativeFunction native)
+{
+    if(native.name == "print" || native.name == "dll_import" || native.name == "dll_bind" ||
+       bytecode.functionIndices.count(native.name) != 0)
+    {
+        throw InterpreterError("Cannot register " + native.name + " because it is already a function");
+    }
+    auto result = bytecode.nativeIndices.insert({native.name, static_cast<uint32_t>(bytecode.natives.size())});
+    if(result.second)
+    {
+        bytecode.natives.push_back(std::move(native));
+    }
+    else
+    {
+        NativeFunction &old = bytecode.natives[result.first->second];
+        if(old.parameters != native.parameters)
         {
-            return std::nullopt;
+            // calls compiled earlier pass as many arguments as the old one took
+            throw InterpreterError("Cannot register " + native.name + " with " + std::to_string(native.parameters) +
+                                   " parameters, because it already takes " + std::to_string(old.parameters));
         }
+        old = std::move(native);
     }
+}
 
-private:
-    void verifyType(const AST::Node *root, AST::Node::Type type)
+void Interpreter::setReadyHandler(std::function<void()> handler)
+{
+    execution.ready = std::move(handler);
+    if(execution.pending)
+    {
+        execution.pending->ready = execution.ready;
+    }
+}
+
+void Interpreter::setOutput(OutputSink sink)
+{
+    output = std::move(sink);
+}
+
+OutputSink &Interpreter::getOutput()
+{
+    return output;
+}
+
+void Interpreter::setProfiling(bool enabled)
+{
+    if(!enabled)
     {
-        if(root->type != type)
+        // Functions compiled while profiling stay compiled, so their sites are
+        // turned into jumps to the next instruction. A later profiler would
+        // not know them.
+        for(uint32_t i = 0; profiler && i < bytecode.code.size(); i++)
         {
-            throw InterpreterError("Internal error: expected different AST::Node type");
+            Instruction &instruction = bytecode.code[i];
+            if(instruction.op == OpCode::ProfileEnter || instruction.op == OpCode::ProfileExit)
+            {
+                instruction = Instruction{OpCode::Jump, i + 1};
+            }
         }
+        profiler.reset();
+    }
+    else if(!profiler)
+    {
+        profiler = std::make_unique<Profiler>();
     }
+}
 
-    Interpreter &interpreter;
-};
+const Profiler *Interpreter::getProfiler() const
+{
+    return profiler.get();
+}
 
-void Interpreter::run(const AST &ast)
+void Interpreter::setJit(bool enabled)
 {
-    InterpreterImpl(*this).block(ast.getRoot());
+    jitEnabled = enabled && JitCompiler::isSupported();
+}
+
+bool Interpreter::isJitEnabled() const
+{
+    return jitEnabled;
+}
+
+void Interpreter::setForeignImports(bool allowed)
+{
+    bytecode.importsAllowed = allowed;
+}
+
+bool Interpreter::areForeignImportsAllowed() const
+{
+    return bytecode.importsAllowed;
+}
+
+const JitStats &Interpreter::getJitStats() const
+{
+    return jitStats;
 }
 
 Value Interpreter::getGlobalVariable(const std::string &name) const
 {
-    if(globals.count(name) == 1)
+    uint32_t slot = slotTable.find(name);
+    if(slot < globals.size() && !globals[slot].isUndefined())
     {
-        return globals.at(name);
+        return globals[slot];
     }
     else
     {
@@ -153,5 +656,10 @@ Value Interpreter::getGlobalVariable(const std::string &name) const
 
 void Interpreter::setGlobalVariable(const std::string &name, Value value)
 {
-    globals.insert({name, value});
+    uint32_t slot = slotTable.resolve(name);
+    if(slot >= globals.size())
+    {
+        globals.resize(slot + 1);
+    }
+    globals[slot] = std::move(value);
 }
@@ -1,6 +1,7 @@
 #include <Interpreter/InterpreterError.h>
 
 
-InterpreterError::InterpreterError(std::string error, AST::Node *node)
-    : std::runtime_error(error), node(node)
+InterpreterError::InterpreterError(std::string error, const AST::Node *node)
+    : std::runtime_error(error), node(node), lineNumber(node ? node->lineNumber : -1),
+      colPosition(node ? node->colPosition : -1)
 {}
@@ -0,0 +1,488 @@
+#include <Interpreter/Jit.h>
+
+#include <cstddef>
+#include <cstring>
+
+#if defined(__x86_64__) && !defined(_WIN32)
+#define SFL_JIT_X86_64 1
+#include <sys/mman.h>
+#endif
+
+#ifdef SFL_JIT_X86_64
+
+// Emits the handful of x86-64 instructions the JIT needs. Register numbers are
+// the hardware ones: xmm0-15, and rdi holds the globals pointer throughout.
+class Assembler
+{
+public:
+    // F2 0F 58 addsd, 5C subsd, 59 mulsd, 5E divsd; 66 0F 2E ucomisd
+    void sse(uint8_t prefix, uint8_t op, int reg, int rm)
+    {
+        byte(prefix);
+        rex(false, reg, rm);
+        byte(0x0F);
+        byte(op);
+        modrm(3, reg, rm);
+    }
+
+    // movsd xmm, [rdi + disp]
+    void loadNumber(int reg, int32_t disp)
+    {
+        memory(0xF2, 0x10, reg, disp);
+    }
+
+    // movsd [rdi + disp], xmm
+    void storeNumber(int reg, int32_t disp)
+    {
+        memory(0xF2, 0x11, reg, disp);
+    }
+
+    // mov byte [rdi + disp], imm
+    void storeByte(int32_t disp, uint8_t value)
+    {
+        byte(0xC6);
+        modrm(2, 0, 7);
+        dword(disp);
+        byte(value);
+    }
+
+    // mov dword [rdi + disp], imm
+    void storeDword(int32_t disp, uint32_t value)
+    {
+        byte(0xC7);
+        modrm(2, 0, 7);
+        dword(disp);
+        dword(value);
+    }
+
+    // mov rax, bits; movq xmm, rax
+    void loadConstant(int reg, double value)
+    {
+        uint64_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        byte(0x48);
+        byte(0xB8);
+        dword(static_cast<uint32_t>(bits));
+        dword(static_cast<uint32_t>(bits >> 32));
+
+        byte(0x66);
+        rex(true, reg, 0);
+        byte(0x0F);
+        byte(0x6E);
+        modrm(3, reg, 0);
+    }
+
+    // mov r8, [rsi]: the budget lives in r8 while the loop runs
+    void loadBudget()
+    {
+        bytes({0x4C, 0x8B, 0x06});
+    }
+
+    // sub r8, cost
+    void chargeBudget(uint32_t cost)
+    {
+        bytes({0x49, 0x81, 0xE8});
+        dword(cost);
+    }
+
+    // taken while the budget left by the last chargeBudget is above zero
+    void jumpIfBudgetLeft(uint32_t target)
+    {
+        bytes({0x0F, 0x8F});
+        branch(target);
+    }
+
+    // mov eax, resume; mov [rsi], r8; ret
+    void exit(uint32_t resume)
+    {
+        byte(0xB8);
+        dword(resume);
+        bytes({0x4C, 0x89, 0x06});
+        ret();
+    }
+
+    // reg = 1.0 if the flags of a ucomisd say equal, else 0.0
+    void flagsToNumber(int reg)
+    {
+        bytes({0x0F, 0x94, 0xC0}); // sete al
+        bytes({0x0F, 0x9B, 0xC1}); // setnp cl
+        bytes({0x20, 0xC8});       // and al, cl
+        bytes({0x0F, 0xB6, 0xC0}); // movzx eax, al
+
+        // cvtsi2sd xmm, eax
+        byte(0xF2);
+        rex(false, reg, 0);
+        byte(0x0F);
+        byte(0x2A);
+        modrm(3, reg, 0);
+    }
+
+    // jumps are emitted with a placeholder and patched once every target is known
+
+    void jump(uint32_t target)
+    {
+        byte(0xE9);
+        branch(target);
+    }
+
+    // taken when the last ucomisd found its operands not equal, or unordered
+    void jumpIfNotEqual(uint32_t target)
+    {
+        bytes({0x0F, 0x8A});
+        branch(target);
+        bytes({0x0F, 0x85});
+        branch(target);
+    }
+
+    void ret()
+    {
+        byte(0xC3);
+    }
+
+    size_t offset() const
+    {
+        return code.size();
+    }
+
+    // offsets holds the code offset of every instruction index a jump can target
+    void patchBranches(const std::vector<size_t> &offsets)
+    {
+        for(const auto &fixup : fixups)
+        {
+            int32_t rel = static_cast<int32_t>(offsets[fixup.target] - (fixup.at + 4));
+            std::memcpy(&code[fixup.at], &rel, sizeof(rel));
+        }
+    }
+
+    std::vector<uint8_t> code;
+
+private:
+    struct Fixup
+    {
+        size_t at;
+        uint32_t target;
+    };
+
+    void memory(uint8_t prefix, uint8_t op, int reg, int32_t disp)
+    {
+        byte(prefix);
+        rex(false, reg, 7);
+        byte(0x0F);
+        byte(op);
+        modrm(2, reg, 7);
+        dword(disp);
+    }
+
+    void rex(bool wide, int reg, int rm)
+    {
+        uint8_t value = 0x40 | (wide ? 8 : 0) | ((reg & 8) ? 4 : 0) | ((rm & 8) ? 1 : 0);
+        if(value != 0x40) byte(value);
+    }
+
+    void modrm(int mod, int reg, int rm)
+    {
+        byte(static_cast<uint8_t>((mod << 6) | ((reg & 7) << 3) | (rm & 7)));
+    }
+
+    void branch(uint32_t target)
+    {
+        fixups.push_back(Fixup{code.size(), target});
+        dword(0);
+    }
+
+    void byte(uint8_t value)
+    {
+        code.push_back(value);
+    }
+
+    void bytes(std::initializer_list<uint8_t> values)
+    {
+        code.insert(code.end(), values);
+    }
+
+    void dword(uint32_t value)
+    {
+        for(int i = 0; i < 4; i++) byte(static_cast<uint8_t>(value >> (i * 8)));
+    }
+
+    std::vector<Fixup> fixups;
+};
+
+// The value stack lives in xmm0-14, one register per depth. xmm15 holds 1.0
+// for testing conditions the way Value::asBool does. The code is called as
+// uint32_t (Value *globals, int64_t *budget), so rdi holds the globals and rsi
+// the budget, which is kept in r8 until the code returns.
+class JitCompilerImpl
+{
+public:
+    static constexpr int MaxDepth = 15;
+    static constexpr int One = 15;
+
+    JitCompilerImpl(const Bytecode &bytecode, const Loop &loop, uint8_t numberTag)
+        : bytecode(bytecode), loop(loop), numberTag(numberTag), offsets(loop.end + 1, 0)
+    {}
+
+    bool compile()
+    {
+        assembler.loadConstant(One, 1.0);
+        assembler.loadBudget();
+
+        int depth = 0;
+        for(uint32_t i = loop.start; i < loop.end; i++)
+        {
+            offsets[i] = assembler.offset();
+            const Instruction &instruction = bytecode.code[i];
+            switch(instruction.op)
+            {
+            case OpCode::PushConstant:
+            {
+                const Value &constant = bytecode.constants[instruction.operand];
+                if(!constant.isNumber() || depth == MaxDepth) return false;
+                assembler.loadConstant(depth++, constant.getNumber());
+                break;
+            }
+
+            case OpCode::LoadGlobal:
+                if(depth == MaxDepth || !useSlot(instruction.operand, isLoaded, loaded)) return false;
+                assembler.loadNumber(depth++, numberOffset(instruction.operand));
+                break;
+
+            case OpCode::StoreGlobal:
+                if(!useSlot(instruction.operand, isStored, stored)) return false;
+                depth--;
+                assembler.storeByte(tagOffset(instruction.operand), numberTag);
+                assembler.storeDword(lengthOffset(instruction.operand), 0);
+                assembler.storeNumber(depth, numberOffset(instruction.operand));
+                break;
+
+            // the Generic forms have seen other types, so they are left out
+
+            case OpCode::Add:
+            case OpCode::AddNumbers:
+                depth--;
+                assembler.sse(0xF2, 0x58, depth - 1, depth);
+                break;
+
+            case OpCode::Subtract:
+            case OpCode::SubtractNumbers:
+                depth--;
+                assembler.sse(0xF2, 0x5C, depth - 1, depth);
+                break;
+
+            case OpCode::Multiply:
+            case OpCode::MultiplyNumbers:
+                depth--;
+                assembler.sse(0xF2, 0x59, depth - 1, depth);
+                break;
+
+            case OpCode::Divide:
+            case OpCode::DivideNumbers:
+                depth--;
+                assembler.sse(0xF2, 0x5E, depth - 1, depth);
+                break;
+
+            case OpCode::Equals:
+            case OpCode::EqualsNumbers:
+                depth--;
+                assembler.sse(0x66, 0x2E, depth - 1, depth);
+                assembler.flagsToNumber(depth - 1);
+                break;
+
+            case OpCode::Jump:
+                if(depth != 0 || !inLoop(instruction.operand)) return false;
+                assembler.jump(instruction.operand);
+                break;
+
+            case OpCode::JumpIfFalse:
+                depth--;
+                if(depth != 0 || !inLoop(instruction.operand)) return false;
+                assembler.sse(0x66, 0x2E, depth, One);
+                assembler.jumpIfNotEqual(instruction.operand);
+                break;
+
+            case OpCode::LoopIfTrue:
+            {
+                // the back edge of this loop, or of one nested in it
+                depth--;
+                const Loop &inner = bytecode.loops[instruction.operand];
+                if(depth != 0 || !inLoop(inner.body)) return false;
+                assembler.sse(0x66, 0x2E, depth, One);
+                assembler.jumpIfNotEqual(i + 1);
+                // charged as the interpreter charges it, and left here once it runs out
+                assembler.chargeBudget(inner.end - inner.body);
+                assembler.jumpIfBudgetLeft(inner.body);
+                assembler.exit(inner.body);
+                break;
+            }
+
+            default:
+                // printing, profiling and anything else is left to the interpreter
+                return false;
+            }
+        }
+
+        offsets[loop.end] = assembler.offset();
+        assembler.exit(loop.end);
+        assembler.patchBranches(offsets);
+        return true;
+    }
+
+    Assembler assembler;
+    std::vector<uint32_t> loaded;
+    std::vector<uint32_t> stored;
+
+private:
+    // slots are addressed with a 32 bit displacement from the globals pointer
+    static constexpr uint32_t MaxSlot = (1u << 26);
+
+    // adds slot to slots the first time it is seen
+    bool useSlot(uint32_t slot, std::vector<bool> &seen, std::vector<uint32_t> &slots)
+    {
+        if(slot >= MaxSlot) return false;
+        if(slot >= seen.size()) seen.resize(slot + 1);
+        if(!seen[slot])
+        {
+            seen[slot] = true;
+            slots.push_back(slot);
+        }
+        return true;
+    }
+
+    bool inLoop(uint32_t target) const
+    {
+        return target >= loop.start && target <= loop.end;
+    }
+
+    static int32_t tagOffset(uint32_t slot) { return static_cast<int32_t>(slot * sizeof(Value)); }
+    static int32_t lengthOffset(uint32_t slot) { return tagOffset(slot) + 4; }
+    static int32_t numberOffset(uint32_t slot) { return tagOffset(slot) + 8; }
+
+    const Bytecode &bytecode;
+    const Loop &loop;
+    uint8_t numberTag;
+    std::vector<size_t> offsets; // code offset of each instruction, by index
+    std::vector<bool> isLoaded;
+    std::vector<bool> isStored;
+};
+
+#endif
+
+JitLoop::~JitLoop()
+{
+#ifdef SFL_JIT_X86_64
+    if(code) munmap(code, size);
+#endif
+}
+
+uint32_t JitLoop::run(Value *globals, int64_t &budget) const
+{
+    for(uint32_t slot : loaded)
+    {
+        if(!globals[slot].isNumber()) return NotRun;
+    }
+    for(uint32_t slot : stored)
+    {
+        if(!globals[slot].isNumber() && !globals[slot].isUndefined()) return NotRun;
+    }
+
+    return reinterpret_cast<uint32_t (*)(Value *, int64_t *)>(code)(globals, &budget);
+}
+
+bool JitCompiler::isSupported()
+{
+#ifdef SFL_JIT_X86_64
+    return true;
+#else
+    return false;
+#endif
+}
+
+std::unique_ptr<JitLoop> JitCompiler::compile(const Bytecode &bytecode, const Loop &loop)
+{
+#ifdef SFL_JIT_X86_64
+    // the generated code relies on this layout
+    static_assert(offsetof(Value, tag) == 0 && sizeof(Value::Tag) == 1, "tag is the first byte");
+    static_assert(offsetof(Value, length) == 4, "length follows the tag");
+    static_assert(offsetof(Value, number) == 8, "number is the second word");
+
+    JitCompilerImpl impl(bytecode, loop, static_cast<uint8_t>(Value::Tag::Number));
+    if(!impl.compile())
+    {
+        return nullptr;
+    }
+
+    // written while writable, then made executable, so it is never both
+    const std::vector<uint8_t> &machineCode = impl.assembler.code;
+    void *memory = mmap(nullptr, machineCode.size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(memory == MAP_FAILED)
+    {
+        return nullptr;
+    }
+    std::memcpy(memory, machineCode.data(), machineCode.size());
+    if(mprotect(memory, machineCode.size(), PROT_READ | PROT_EXEC) != 0)
+    {
+        munmap(memory, machineCode.size());
+        return nullptr;
+    }
+
+    std::unique_ptr<JitLoop> compiled(new JitLoop());
+    compiled->code = memory;
+    compiled->size = machineCode.size();
+    compiled->loaded = std::move(impl.loaded);
+    compiled->stored = std::move(impl.stored);
+    return compiled;
+#else
+    (void)bytecode;
+    (void)loop;
+    return nullptr;
+#endif
+}
+
+JitTier::JitTier(const Bytecode &bytecode, JitStats &stats)
+    : bytecode(&bytecode), stats(&stats), counts(bytecode.loops.size(), 0),
+      tried(bytecode.loops.size(), false), compiled(bytecode.loops.size())
+{}
+
+void JitTier::attach(const Bytecode &bytecode, JitStats &stats)
+{
+    this->bytecode = &bytecode;
+    this->stats = &stats;
+}
+
+uint32_t JitTier::run(uint32_t loop, Value *globals, int64_t &budget)
+{
+    uint32_t &count = counts[loop];
+    if(count < Threshold && ++count < Threshold)
+    {
+        return JitLoop::NotRun;
+    }
+
+    if(!tried[loop])
+    {
+        tried[loop] = true;
+        compiled[loop] = JitCompiler::compile(*bytecode, bytecode->loops[loop]);
+        if(compiled[loop])
+        {
+            stats->compiled++;
+        }
+        else
+        {
+            stats->rejected++;
+        }
+    }
+
+    if(!compiled[loop])
+    {
+        return JitLoop::NotRun;
+    }
+    uint32_t resume = compiled[loop]->run(globals, budget);
+    if(resume == JitLoop::NotRun)
+    {
+        // wait as long again before checking the types once more
+        stats->deopts++;
+        count = 0;
+        return JitLoop::NotRun;
+    }
+    stats->entries++;
+    return resume;
+}
@@ -0,0 +1,156 @@
+#include <Interpreter/OutputSink.h>
+#include <Interpreter/InterpreterError.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+
+#include <unistd.h>
+
+OutputSink::OutputSink(Target target, size_t capacity)
+    : target(std::move(target)), buffer(new char[std::max(capacity, Value::MaxNumberLength)]),
+      capacity(std::max(capacity, Value::MaxNumberLength))
+{}
+
+OutputSink OutputSink::fileDescriptor(int fd, size_t capacity)
+{
+    return OutputSink([fd](std::string_view text)
+    {
+        while(!text.empty())
+        {
+            ssize_t written = ::write(fd, text.data(), text.size());
+            if(written < 0)
+            {
+                if(errno == EINTR) continue;
+                throw InterpreterError(std::string("Could not write output: ") + std::strerror(errno));
+            }
+            text.remove_prefix(static_cast<size_t>(written));
+        }
+    }, capacity);
+}
+
+OutputSink OutputSink::memory(std::string &output, size_t capacity)
+{
+    return OutputSink([&output](std::string_view text)
+    {
+        output.append(text);
+    }, capacity);
+}
+
+OutputSink OutputSink::stream(std::ostream &out, size_t capacity)
+{
+    return OutputSink([&out](std::string_view text)
+    {
+        out.write(text.data(), static_cast<std::streamsize>(text.size()));
+        out.flush();
+    }, capacity);
+}
+
+OutputSink::OutputSink(OutputSink &&other) noexcept
+    : target(std::move(other.target)), buffer(std::move(other.buffer)), capacity(other.capacity),
+      used(other.used), numberFormat(other.numberFormat)
+{
+    other.used = 0;
+}
+
+OutputSink &OutputSink::operator=(OutputSink &&other) noexcept
+{
+    if(this != &other)
+    {
+        try
+        {
+            flush();
+        }
+        catch(...)
+        {
+            // nowhere to report it
+        }
+        target = std::move(other.target);
+        buffer = std::move(other.buffer);
+        capacity = other.capacity;
+        used = other.used;
+        numberFormat = other.numberFormat;
+        other.used = 0;
+    }
+    return *this;
+}
+
+OutputSink::~OutputSink()
+{
+    try
+    {
+        flush();
+    }
+    catch(...)
+    {
+        // nowhere to report it
+    }
+}
+
+void OutputSink::write(std::string_view text)
+{
+    if(text.size() > capacity)
+    {
+        // too big to buffer, so skip the copy
+        flush();
+        target(text);
+        return;
+    }
+    std::memcpy(reserve(text.size()), text.data(), text.size());
+    used += text.size();
+}
+
+void OutputSink::write(double number)
+{
+    char *out = reserve(Value::MaxNumberLength);
+    if(numberFormat == NumberFormat::Shortest)
+    {
+        used += std::to_chars(out, out + Value::MaxNumberLength, number).ptr - out;
+    }
+    else
+    {
+        used += Value::formatNumber(number, out);
+    }
+}
+
+void OutputSink::write(const Value &value)
+{
+    if(value.isString())
+    {
+        write(value.getString());
+    }
+    else if(value.isNumber())
+    {
+        write(value.getNumber());
+    }
+    else
+    {
+        throw InterpreterError("Cannot use an undefined value");
+    }
+}
+
+void OutputSink::flush()
+{
+    if(used != 0)
+    {
+        // cleared first so a target that throws does not get the same text twice
+        size_t size = used;
+        used = 0;
+        target(std::string_view(buffer.get(), size));
+    }
+}
+
+void OutputSink::setNumberFormat(NumberFormat format)
+{
+    numberFormat = format;
+}
+
+char *OutputSink::reserve(size_t size)
+{
+    if(capacity - used < size)
+    {
+        flush();
+    }
+    return buffer.get() + used;
+}
@@ -0,0 +1,126 @@
+#include <Interpreter/Profiler.h>
+
+#include <algorithm>
+#include <cstdio>
+
+typedef std::chrono::steady_clock Clock;
+
+static const char *typeName(AST::Node::Type type)
+{
+    switch(type)
+    {
+    case AST::Node::Type::Block:        return "Block";
+    case AST::Node::Type::If:           return "If";
+    case AST::Node::Type::While:        return "While";
+    case AST::Node::Type::Assign:       return "Assign";
+    case AST::Node::Type::Add:          return "Add";
+    case AST::Node::Type::Subtract:     return "Subtract";
+    case AST::Node::Type::Multiply:     return "Multiply";
+    case AST::Node::Type::Divide:       return "Divide";
+    case AST::Node::Type::Equals:       return "Equals";
+    case AST::Node::Type::Variable:     return "Variable";
+    case AST::Node::Type::Number:       return "Number";
+    case AST::Node::Type::String:       return "String";
+    case AST::Node::Type::FunctionCall: return "FunctionCall";
+    case AST::Node::Type::Function:     return "Function";
+    case AST::Node::Type::Return:       return "Return";
+    default:                            return "Error";
+    }
+}
+
+// returns the given 1 based line of source without its indentation
+static std::string_view sourceLine(std::string_view source, int lineNumber)
+{
+    size_t start = 0;
+    for(int line = 1; line < lineNumber; line++)
+    {
+        start = source.find('\n', start);
+        if(start == std::string_view::npos) return {};
+        start++;
+    }
+    size_t end = std::min(source.find('\n', start), source.size());
+    start = std::min(source.find_first_not_of(" \t", start), end);
+    return source.substr(start, end - start);
+}
+
+static double milliseconds(Clock::duration duration)
+{
+    return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+uint32_t Profiler::site(const AST::Node *node)
+{
+    auto result = indices.insert({{node->lineNumber, node->colPosition, node->type}, static_cast<uint32_t>(sites.size())});
+    if(result.second)
+    {
+        Entry entry;
+        entry.lineNumber = node->lineNumber;
+        entry.colPosition = node->colPosition;
+        entry.type = node->type;
+        sites.push_back(entry);
+    }
+    return result.first->second;
+}
+
+void Profiler::enter(uint32_t site)
+{
+    stack.push_back(Frame{site, Clock::now(), Clock::duration::zero()});
+}
+
+void Profiler::exit()
+{
+    Frame frame = stack.back();
+    stack.pop_back();
+
+    Clock::duration elapsed = Clock::now() - frame.start;
+    Entry &entry = sites[frame.site];
+    entry.count++;
+    entry.inclusive += elapsed;
+    entry.exclusive += elapsed - frame.children;
+
+    if(!stack.empty())
+    {
+        stack.back().children += elapsed;
+    }
+}
+
+void Profiler::unwind()
+{
+    while(!stack.empty())
+    {
+        exit();
+    }
+}
+
+const std::vector<Profiler::Entry> &Profiler::entries() const
+{
+    return sites;
+}
+
+std::vector<Profiler::Entry> Profiler::hotSpots() const
+{
+    std::vector<Entry> sorted = sites;
+    std::stable_sort(sorted.begin(), sorted.end(), [](const Entry &a, const Entry &b)
+    {
+        return a.exclusive > b.exclusive;
+    });
+    return sorted;
+}
+
+void Profiler::report(std::ostream &out, std::string_view source, size_t limit) const
+{
+    char row[128];
+    std::snprintf(row, sizeof(row), "%12s %12s %10s  %-9s %-13s%s\n", "exclusive ms", "inclusive ms", "count", "line:col", "node", source.empty() ? "" : "source");
+    out << row;
+
+    std::vector<Entry> sorted = hotSpots();
+    for(size_t i = 0; i < sorted.size() && i < limit; i++)
+    {
+        const Entry &entry = sorted[i];
+        std::string position = std::to_string(entry.lineNumber) + ":" + std::to_string(entry.colPosition);
+        std::snprintf(row, sizeof(row), "%12.3f %12.3f %10llu  %-9s %-13s",
+            milliseconds(entry.exclusive), milliseconds(entry.inclusive), static_cast<unsigned long long>(entry.count),
+            position.c_str(), typeName(entry.type));
+        out << row << sourceLine(source, entry.lineNumber) << '\n';
+    }
+}
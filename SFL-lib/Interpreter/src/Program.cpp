@@ -0,0 +1,142 @@
+#include <Interpreter/Program.h>
+#include <Interpreter/InterpreterError.h>
+
+#include <algorithm>
+#include <atomic>
+
+Program::Program(const AST &ast, bool foreignImports)
+{
+    bytecode.importsAllowed = foreignImports;
+    Compiler::compile(ast, slots, bytecode);
+}
+
+const Bytecode &Program::getBytecode() const
+{
+    return bytecode;
+}
+
+const SlotTable &Program::getSlots() const
+{
+    return slots;
+}
+
+Bytecode Program::instantiate() const
+{
+    Bytecode copy;
+    copy.code = bytecode.code;
+    copy.loops = bytecode.loops;
+    copy.functions = bytecode.functions;
+    copy.functionIndices = bytecode.functionIndices;
+    copy.natives = bytecode.natives;
+    copy.nativeIndices = bytecode.nativeIndices;
+    copy.libraries = bytecode.libraries;
+    copy.entry = bytecode.entry;
+    copy.topLevelConstants = bytecode.topLevelConstants;
+    copy.topLevelLoops = bytecode.topLevelLoops;
+    copy.maxStackDepth = bytecode.maxStackDepth;
+
+    // copying a string Value would bump a reference count other threads are
+    // bumping too, so every context gets strings of its own
+    copy.constants.reserve(bytecode.constants.size());
+    for(const Value &constant : bytecode.constants)
+    {
+        if(constant.isString())
+        {
+            copy.constants.push_back(Value::createString(std::string(constant.getString())));
+        }
+        else
+        {
+            copy.constants.push_back(constant);
+        }
+    }
+    return copy;
+}
+
+Context::Context(std::shared_ptr<const Program> program)
+    : program(std::move(program)), bytecode(this->program->instantiate()),
+      globals(this->program->getSlots().size())
+{}
+
+void Context::reset()
+{
+    execution.clear();
+    for(Value &global : globals)
+    {
+        global = Value();
+    }
+}
+
+Value Context::getGlobalVariable(const std::string &name) const
+{
+    uint32_t slot = program->getSlots().find(name);
+    if(slot < globals.size() && !globals[slot].isUndefined())
+    {
+        return globals[slot];
+    }
+    throw InterpreterError("Could not find a variable by the name " + name);
+}
+
+void Context::setGlobalVariable(const std::string &name, Value value)
+{
+    uint32_t slot = program->getSlots().find(name);
+    if(slot >= globals.size())
+    {
+        throw InterpreterError("The program does not use a variable by the name " + name);
+    }
+    globals[slot] = std::move(value);
+}
+
+void Context::setOutput(OutputSink sink)
+{
+    output = std::move(sink);
+}
+
+OutputSink &Context::getOutput()
+{
+    return output;
+}
+
+void Context::setJit(bool enabled)
+{
+    jitEnabled = enabled && JitCompiler::isSupported();
+}
+
+const JitStats &Context::getJitStats() const
+{
+    return jitStats;
+}
+
+const Program &Context::getProgram() const
+{
+    return *program;
+}
+
+ContextRunner::ContextRunner(unsigned count)
+    : pool(count)
+{}
+
+std::vector<std::exception_ptr> ContextRunner::run(std::vector<Context> &contexts)
+{
+    std::vector<std::exception_ptr> errors(contexts.size());
+    std::atomic<size_t> next{0};
+    pool.run([&](unsigned)
+    {
+        for(size_t i = next++; i < contexts.size(); i = next++)
+        {
+            try
+            {
+                contexts[i].run();
+            }
+            catch(...)
+            {
+                errors[i] = std::current_exception();
+            }
+        }
+    });
+    return errors;
+}
+
+unsigned ContextRunner::threadCount() const
+{
+    return pool.workerCount();
+}
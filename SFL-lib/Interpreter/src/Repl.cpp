@@ -0,0 +1,72 @@
+#include <Interpreter/Repl.h>
+#include <Interpreter/InterpreterError.h>
+
+#include <Parser/Optimizer.h>
+
+Repl::Status Repl::feed(std::string_view line)
+{
+    pending.append(line);
+    pending.push_back('\n');
+
+    try
+    {
+        LexemeStream lexemes(pending);
+        AST ast(lexemes);
+        Optimizer::optimize(ast);
+        pending.clear();
+        interpreter.run(ast);
+        return Status::Ran;
+    }
+    catch(const ParserError &e)
+    {
+        // running out of input part way through only means there is more to come
+        if(e.lexeme.type == Lexeme::Type::EndOfFile)
+        {
+            return Status::Incomplete;
+        }
+        error = e.what();
+        if(e.lexeme.lineNumber >= 0)
+        {
+            error += " at " + std::to_string(e.lexeme.lineNumber) + ":" + std::to_string(e.lexeme.colPosition);
+        }
+    }
+    catch(const LexerError &e)
+    {
+        // a string can span lines, so one that is still open may yet be closed
+        if(std::string_view(e.what()) == "String did not terminate")
+        {
+            return Status::Incomplete;
+        }
+        error = e.what();
+        if(e.line >= 0)
+        {
+            error += " at " + std::to_string(e.line) + ":" + std::to_string(e.col);
+        }
+    }
+    catch(const InterpreterError &e)
+    {
+        // globals keep whatever the statement did before it failed
+        error = e.what();
+        if(e.lineNumber >= 0)
+        {
+            error += " at " + std::to_string(e.lineNumber) + ":" + std::to_string(e.colPosition);
+        }
+    }
+    pending.clear();
+    return Status::Failed;
+}
+
+void Repl::reset()
+{
+    pending.clear();
+}
+
+const std::string &Repl::getError() const
+{
+    return error;
+}
+
+Interpreter &Repl::getInterpreter()
+{
+    return interpreter;
+}
@@ -1,120 +1,150 @@
 #include <Interpreter/Value.h>
 #include <Interpreter/InterpreterError.h>
 
-#include <type_traits>
+#include <algorithm>
+#include <charconv>
+#include <limits>
 
-Value Value::createString(const std::string &v)
+static_assert(sizeof(Value) == 16, "Value should stay two words");
+
+static uint32_t checkedLength(size_t length)
 {
-    return Value(Data(v));
+    if(length > std::numeric_limits<uint32_t>::max())
+    {
+        throw InterpreterError("String is too long");
+    }
+    return static_cast<uint32_t>(length);
 }
 
-Value Value::createNumber(double v)
+Value Value::createString(const std::string &v)
 {
-    return Value(Data(v));
+    uint32_t length = checkedLength(v.size());
+    return Value(new StringObject{1, v}, length);
 }
 
-void Value::requireTypeMatch(const Value &a, const Value &b, std::string opName)
+Value Value::createString(std::string &&v)
 {
-    if(a.data.index() != b.data.index())
-    {
-        throw InterpreterError("Cannot " + opName + " values with types " + a.getTypeAsString() + " and " + b.getTypeAsString());
-    }
+    uint32_t length = checkedLength(v.size());
+    return Value(new StringObject{1, std::move(v)}, length);
 }
 
-Value Value::add(const Value &a, const Value &b)
+void Value::requireTypeMatch(const Value &a, const Value &b, const char *opName)
 {
-    requireTypeMatch(a, b, "addition");
-    return std::visit([&b](auto&& arg1) -> Value
+    if(a.tag != b.tag)
     {
-        return Value(Data(arg1+std::get<std::decay_t<decltype(arg1)>>(b.data)));
-    }, a.data);
+        throw InterpreterError(std::string("Cannot ") + opName + " values with types " + a.getTypeAsString() + " and " + b.getTypeAsString());
+    }
 }
 
-Value Value::sub(const Value &a, const Value &b)
+void Value::throwNotNumbers(const Value &a, const Value &b, const char *opName, const char *verb)
 {
-    requireTypeMatch(a, b, "subtraction");
-    if(std::holds_alternative<std::string>(a.data))
-    {
-        throw InterpreterError("Cannot subtract two strings");
-    }
-    return Value(std::get<double>(a.data) - std::get<double>(b.data));
+    requireTypeMatch(a, b, opName);
+    throw InterpreterError(std::string("Cannot ") + verb + " two " + a.getTypeAsString() + "s");
 }
 
-Value Value::mul(const Value &a, const Value &b)
+Value Value::addSlow(const Value &a, const Value &b)
 {
-    requireTypeMatch(a, b, "multiply");
-    if(std::holds_alternative<std::string>(a.data))
+    requireTypeMatch(a, b, "addition");
+    if(!a.isString())
     {
-        throw InterpreterError("Cannot multiply two strings");
+        throwNotNumbers(a, b, "addition", "add");
     }
-    return Value(Data(std::get<double>(a.data) * std::get<double>(b.data)));
+    return concat(a, b);
 }
 
-Value Value::div(const Value &a, const Value &b)
+Value Value::concat(const Value &a, const Value &b)
 {
-    requireTypeMatch(a, b, "divide");
-    if(std::holds_alternative<std::string>(a.data))
+    uint32_t length = checkedLength(size_t(a.length) + b.length);
+    std::string &buffer = a.string->buffer;
+    if(a.length == buffer.size())
     {
-        throw InterpreterError("Cannot divide two strings");
+        // nothing has been appended after a yet, so extend its buffer in place
+        if(b.string == a.string)
+        {
+            buffer.append(std::string(b.getString()));
+        }
+        else
+        {
+            buffer.append(b.getString());
+        }
+        a.retain();
+        return Value(a.string, length);
     }
-    return Value(Data(std::get<double>(a.data) / std::get<double>(b.data)));
+
+    std::string result;
+    result.reserve(length);
+    result.append(a.getString());
+    result.append(b.getString());
+    return Value(new StringObject{1, std::move(result)}, length);
 }
 
-Value Value::equals(const Value &a, const Value &b)
+Value Value::equalsSlow(const Value &a, const Value &b)
 {
     requireTypeMatch(a, b, "check equals");
-    return std::visit([&b](auto&& arg1)
+    if(!a.isString())
     {
-        return Value(arg1==std::get<std::decay_t<decltype(arg1)>>(b.data));
-    }, a.data);
+        throwNotNumbers(a, b, "check equals", "compare");
+    }
+    return Value(a.getString() == b.getString() ? 1.0 : 0.0);
 }
 
 std::string Value::getTypeAsString() const
 {
-    if(std::holds_alternative<std::string>(data))
+    if(tag == Tag::String)
     {
         return "string";
     }
-    else
+    else if(tag == Tag::Number)
     {
         return "number";
     }
+    else
+    {
+        return "undefined";
+    }
 }
 
 std::string Value::asString() const
 {
-    if(std::holds_alternative<std::string>(data))
+    if(tag == Tag::String)
     {
-        return std::get<std::string>(data);
+        return std::string(getString());
+    }
+    else if(tag == Tag::Number)
+    {
+        char buffer[MaxNumberLength];
+        return std::string(buffer, formatNumber(number, buffer));
     }
     else
     {
-        auto str = std::to_string(std::get<double>(data));
-        size_t dec_loc = str.find('.');
-        size_t remove_loc = str.find_last_not_of('0') + 1;
-        if(dec_loc == remove_loc-1) remove_loc = dec_loc; // remove decimal too if no digits afterwards
+        throw InterpreterError("Cannot use an undefined value");
+    }
+}
 
-        str.erase ( remove_loc, std::string::npos );
-        return str;
+size_t Value::formatNumber(double number, char *out)
+{
+    // six decimals like printf's %f, with trailing zeros and a bare point dropped
+    char *end = std::to_chars(out, out + MaxNumberLength, number, std::chars_format::fixed, 6).ptr;
+    if(std::find(out, end, '.') != end)
+    {
+        while(end[-1] == '0') end--;
+        if(end[-1] == '.') end--;
     }
+    return end - out;
 }
 
 bool Value::asBool() const
 {
-    if(std::holds_alternative<std::string>(data))
+    if(tag == Tag::String)
     {
-        return std::get<std::string>(data) != "";
+        return length != 0;
+    }
+    else if(tag == Tag::Number)
+    {
+        return number == 1;
     }
     else
     {
-        return std::get<double>(data) == 1;
+        throw InterpreterError("Cannot use an undefined value");
     }
 }
-
-Value::Value(const Data &data)
-    : data(data)
-{}
-
-Value::Value(const bool &data) // convert bool to number as we don't have bool type yet.
-    : data(data ? 1 : 0)
-{}
@@ -0,0 +1,78 @@
+#include <Interpreter/WorkerPool.h>
+
+#include <algorithm>
+
+WorkerPool::WorkerPool(unsigned count)
+{
+    if(count == 0)
+    {
+        count = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for(unsigned worker = 1; worker < count; worker++)
+    {
+        threads.emplace_back(&WorkerPool::work, this, worker);
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for(auto &thread : threads)
+    {
+        thread.join();
+    }
+}
+
+void WorkerPool::run(const std::function<void(unsigned)> &job)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        current = &job;
+        busy = static_cast<unsigned>(threads.size());
+        generation++;
+    }
+    wake.notify_all();
+
+    job(0);
+
+    // Every thread has to be done with job before it goes out of scope. A
+    // thread that wakes up late still calls it, and finds nothing left to do.
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [&]() { return busy == 0; });
+    current = nullptr;
+}
+
+unsigned WorkerPool::workerCount() const
+{
+    return static_cast<unsigned>(threads.size()) + 1;
+}
+
+void WorkerPool::work(unsigned worker)
+{
+    uint64_t seen = 0;
+    while(true)
+    {
+        const std::function<void(unsigned)> *job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&]() { return stopping || generation != seen; });
+            if(stopping)
+            {
+                return;
+            }
+            seen = generation;
+            job = current;
+        }
+        (*job)(worker);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if(--busy == 0)
+        {
+            done.notify_all();
+        }
+    }
+}
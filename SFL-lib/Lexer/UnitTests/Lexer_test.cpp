@@ -107,6 +107,12 @@ TEST(Lexer, single)
     testSingleLexeme("a6", Lexeme::Type::Identifier);
     testSingleLexeme("3.14", Lexeme::Type::Number);
     testSingleLexeme(".2", Lexeme::Type::Number);
+    testSingleLexeme("function", Lexeme::Type::KwFunction);
+    testSingleLexeme("return", Lexeme::Type::KwReturn);
+    testSingleLexeme("end", Lexeme::Type::KwEnd);
+    testSingleLexeme("returns", Lexeme::Type::Identifier);
+    testSingleLexeme("ret", Lexeme::Type::Identifier);
+    testSingleLexeme("ending", Lexeme::Type::Identifier);
 
     EXPECT_THROW(Lexer::lexString("."), LexerError);
     EXPECT_THROW(Lexer::lexString(".."), LexerError);
@@ -114,6 +120,18 @@ TEST(Lexer, single)
     EXPECT_THROW(Lexer::lexString("1.1."), LexerError);
 }
 
+TEST(Lexer, numberValues)
+{
+    EXPECT_EQ(Lexer::lexString("123")[0].number, 123.0);
+    EXPECT_EQ(Lexer::lexString("3.14")[0].number, 3.14);
+    EXPECT_EQ(Lexer::lexString(".2")[0].number, 0.2);
+    EXPECT_EQ(Lexer::lexString("5.")[0].number, 5.0);
+    EXPECT_EQ(Lexer::lexString("0.1")[0].number, 0.1);
+    EXPECT_EQ(Lexer::lexString("a")[0].number, 0.0);
+
+    EXPECT_THROW(Lexer::lexString(std::string(400, '9')), LexerError);
+}
+
 TEST(Lexer, singleStrings)
 {
     ASSERT_THAT(Lexer::lexString(R"("")"), 
@@ -229,5 +247,123 @@ TEST(Lexer, comments)
         ElementsAre(LexemeEqNamePos("a", 1, 1), LexemeEqNamePos("+", 1, 3), LexemeEqNamePos("2", 1, 5)));
 }
 
+TEST(Lexer, symbols)
+{
+    const auto lexemes = Lexer::lexString("foo = bar + foo; print(\"foo\");");
+    ASSERT_EQ(lexemes.symbols().size(), 3);
+    ASSERT_EQ(lexemes[0].symbol, lexemes[4].symbol);
+    ASSERT_NE(lexemes[0].symbol, lexemes[2].symbol);
+    ASSERT_EQ(lexemes.symbols().name(lexemes[2].symbol), "bar");
+    ASSERT_EQ(lexemes.symbols().find("print"), lexemes[6].symbol);
+
+    // only identifiers are interned
+    ASSERT_EQ(lexemes[1].symbol, SymbolTable::None);
+    ASSERT_EQ(lexemes[8].symbol, SymbolTable::None);
+    ASSERT_EQ(lexemes.symbols().find("="), SymbolTable::None);
+}
+
+TEST(Lexer, listOwnsItsText)
+{
+    LexemeList copy;
+    {
+        std::string src = R"(name "plain" "esc\aped")";
+        copy = Lexer::lexString(src);
+        src.assign(src.size(), 'x');
+    }
+
+    ASSERT_THAT(copy, ElementsAre(LexemeEqName("name"), LexemeEqName("plain"), LexemeEqName("escaped")));
+    ASSERT_EQ(copy.symbols().name(copy[0].symbol), "name");
+}
+
+TEST(Lexer, stream)
+{
+    const std::string src = "a = 1; # comment\nprint(\"x\\ny\", a);";
+    const auto list = Lexer::lexString(src);
+
+    LexemeStream stream(src);
+    for(const auto &expected : list)
+    {
+        Lexeme lexeme = stream.next();
+        ASSERT_EQ(lexeme, expected);
+        ASSERT_EQ(lexeme.type, expected.type);
+        ASSERT_EQ(lexeme.symbol, expected.symbol);
+    }
+    ASSERT_EQ(stream.next().type, Lexeme::Type::EndOfFile);
+    ASSERT_EQ(stream.next().type, Lexeme::Type::EndOfFile);
+    ASSERT_EQ(stream.symbols().size(), list.symbols().size());
+
+    LexemeStream bad("a $");
+    ASSERT_EQ(bad.next().name, "a");
+    ASSERT_THROW(bad.next(), LexerError);
+}
+
+TEST(Lexer, longRuns)
+{
+    // runs longer than one scanning block, ending at every offset within one
+    for(size_t length = 1; length <= 40; length++)
+    {
+        const std::string word = "w" + std::string(length - 1, '_');
+        const std::string space(length, ' ');
+        ASSERT_THAT(Lexer::lexString(space + word + space + "+"),
+            ElementsAre(LexemeEqNamePos(word, 1, static_cast<int>(length + 1)),
+                        LexemeEqNamePos("+", 1, static_cast<int>(3 * length + 1))));
+    }
+
+    const std::string text = "line one\nstill a string, but a long one\n";
+    const auto src = "# a comment that is longer than sixteen characters\n\n   \"" + text + "\" x\n\t\t\"esc\\\"aped\nline\" y";
+    ASSERT_THAT(Lexer::lexString(src),
+        ElementsAre(LexemeEqNamePos(text, 3, 4), LexemeEqNamePos("x", 5, 3), LexemeEqNamePos("esc\"aped\nline", 6, 3), LexemeEqNamePos("y", 7, 7)));
+
+    ASSERT_THROW(Lexer::lexString("\"" + std::string(40, 'a')), LexerError);
+    ASSERT_THROW(Lexer::lexString("\"" + std::string(40, 'a') + "\\"), LexerError);
+}
+
+void expectSameLexemes(const LexemeList &actual, const LexemeList &expected)
+{
+    ASSERT_EQ(actual.size(), expected.size());
+    for(size_t i = 0; i < expected.size(); i++)
+    {
+        ASSERT_EQ(actual[i], expected[i]) << "lexeme " << i;
+        ASSERT_EQ(actual[i].type, expected[i].type);
+        ASSERT_EQ(actual[i].symbol, expected[i].symbol);
+        ASSERT_EQ(actual[i].number, expected[i].number);
+    }
+    ASSERT_EQ(actual.symbols().size(), expected.symbols().size());
+}
+
+TEST(Lexer, parallel)
+{
+    // strings that span lines, contain code, comments and escaped quotes and
+    // newlines, so some chunks start inside them
+    std::string src;
+    for(int i = 0; src.size() < 2000000; i++)
+    {
+        src += "x" + std::to_string(i % 1000) + " = " + std::to_string(i) + ".5; # \"not a string\n";
+        src += "s = \"a string\n  over lines # not a comment\n b = \\\"c\\\"; $\\\n" + std::string(i % 300, ' ') + "\";\n";
+        if(i % 7 == 0) src += "long = \"" + std::string(70000 * (i % 3), '\n') + "\";\n";
+        src += "\n   print(s, \"\\t\", a==b);\n";
+    }
+
+    const auto sequential = Lexer::lexString(src);
+    for(unsigned threads : {0u, 2u, 3u, 8u, 31u})
+    {
+        expectSameLexemes(Lexer::lexString(src, threads), sequential);
+    }
+
+    // the earliest error is reported, at the same place
+    const size_t middle = src.find("\n   print", src.size() / 2) + 1;
+    for(std::string bad : {src + "\n$ \"", src + "\n\"" + std::string(20, '\n'), "$" + src, src.substr(0, middle) + "$" + src})
+    {
+        LexerError expected("");
+        try { Lexer::lexString(bad); FAIL(); } catch(const LexerError &e) { expected = e; }
+        try { Lexer::lexString(bad, 5); FAIL(); } catch(const LexerError &e)
+        {
+            EXPECT_STREQ(e.what(), expected.what());
+            EXPECT_EQ(e.line, expected.line);
+            EXPECT_EQ(e.col, expected.col);
+        }
+    }
+}
+
 // TODO: error cases
 
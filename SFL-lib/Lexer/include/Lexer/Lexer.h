@@ -1,14 +1,21 @@
 #pragma once
 
+#include <Lexer/SymbolTable.h>
+
 #include <string>
+#include <string_view>
 #include <vector>
+#include <deque>
+#include <memory>
 #include <limits>
+#include <initializer_list>
 
 #include <iostream> // for the << operator (TODO: move me)
 
 struct Lexeme
 {
-    std::string name;
+    // points into the source code, or into owned storage for strings with escapes
+    std::string_view name;
     int lineNumber;
     int colPosition;
 
@@ -43,11 +50,18 @@ struct Lexeme
         KwWhile,
         KwBegin,
         KwEnd,
+        KwReturn,
         KeywordEnd,
 
         EndOfFile = std::numeric_limits<int>::max()
     } type;
 
+    // the decoded value of a Number lexeme so later stages never re-parse name
+    double number = 0;
+
+    // the interned id of an Identifier's name in the LexemeList's symbols
+    uint32_t symbol = SymbolTable::None;
+
     friend std::ostream& operator<<(std::ostream& os, const Lexeme& bar) {
         return os << "{" << bar.name << ", " << bar.lineNumber << ", " << bar.colPosition << "}";
     }
@@ -55,7 +69,91 @@ struct Lexeme
 
 bool operator ==(const Lexeme &a, const Lexeme &b); 
 
-typedef std::vector<Lexeme> LexemeList;
+// The lexemes of one source file. It keeps the source text and any unescaped
+// string literals alive, so the views in its lexemes stay valid for as long as
+// the list (or a copy of it) exists.
+class LexemeList
+{
+public:
+    typedef Lexeme value_type;
+    typedef std::vector<Lexeme>::const_iterator const_iterator;
+    typedef const_iterator iterator;
+    typedef std::vector<Lexeme>::size_type size_type;
+
+    LexemeList() = default;
+
+    // for lists built by hand. The names must outlive the list.
+    LexemeList(std::initializer_list<Lexeme> lexemes);
+
+    const_iterator begin() const { return lexemes.begin(); }
+    const_iterator end() const { return lexemes.end(); }
+    size_type size() const { return lexemes.size(); }
+    bool empty() const { return lexemes.empty(); }
+    const Lexeme &operator[](size_type i) const { return lexemes[i]; }
+
+    const SymbolTable &symbols() const { return symbolTable; }
+
+private:
+    friend class Lexer;
+
+    struct Storage
+    {
+        std::string source;
+        std::deque<std::string> unescapedStrings; // deque so the strings never move
+    };
+
+    std::shared_ptr<Storage> storage;
+    std::vector<Lexeme> lexemes;
+    SymbolTable symbolTable;
+};
+
+// Something the parser can pull lexemes from one at a time.
+class LexemeSource
+{
+public:
+    virtual ~LexemeSource() = default;
+
+    // returns an EndOfFile lexeme once there are no more
+    virtual Lexeme next() = 0;
+
+    // the table identifiers are interned into. The parser adds its own names to
+    // it and takes it over once it is done pulling lexemes.
+    virtual SymbolTable &symbols() = 0;
+};
+
+// Reads back the lexemes of a list. The list must outlive the source.
+class LexemeListSource : public LexemeSource
+{
+public:
+    LexemeListSource(const LexemeList &list);
+
+    Lexeme next() override;
+    SymbolTable &symbols() override;
+
+private:
+    const LexemeList &list;
+    LexemeList::const_iterator current;
+    SymbolTable symbolTable;
+};
+
+class LexemeImpl;
+
+// Lexes the source code on demand, so only the lexemes the parser is looking at
+// exist at once. The source code must outlive the stream.
+class LexemeStream : public LexemeSource
+{
+public:
+    LexemeStream(std::string_view sourceCode);
+    ~LexemeStream();
+
+    Lexeme next() override;
+    SymbolTable &symbols() override;
+
+private:
+    SymbolTable symbolTable;
+    std::deque<std::string> unescapedStrings;
+    std::unique_ptr<LexemeImpl> impl;
+};
 
 class LexerError : public std::runtime_error
 {
@@ -68,6 +166,10 @@ public:
 class Lexer
 {
 public:
-    static LexemeList lexString(const std::string &sourceCode);
-    static LexemeList lexFile(const std::string &filePath);
+    // With more than one thread, large sources are split at newlines and the
+    // pieces are lexed at the same time. The result is the same either way.
+    // 0 threads uses one per core.
+    static LexemeList lexString(const std::string &sourceCode, unsigned threads = 1);
+    static LexemeList lexString(std::string &&sourceCode, unsigned threads = 1);
+    static LexemeList lexFile(const std::string &filePath, unsigned threads = 1);
 };
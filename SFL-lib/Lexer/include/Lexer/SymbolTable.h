@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Interns names so that later stages can compare small integer ids instead
+// of strings. Ids are handed out densely in the order names are first seen.
+class SymbolTable
+{
+public:
+    static constexpr uint32_t None = std::numeric_limits<uint32_t>::max();
+
+    SymbolTable() = default;
+
+    // a table whose names view memory owned by someone else, which owner keeps
+    // alive. Nothing is copied; the lookup index is only built once a name is interned.
+    SymbolTable(std::vector<std::string_view> names, std::shared_ptr<const void> owner);
+
+    SymbolTable(const SymbolTable &other);
+    SymbolTable(SymbolTable &&other) = default;
+    SymbolTable &operator=(const SymbolTable &other);
+    SymbolTable &operator=(SymbolTable &&other) = default;
+
+    // returns the id of name, adding it if it has not been seen before
+    uint32_t intern(std::string_view name);
+
+    // returns None if name has not been interned
+    uint32_t find(std::string_view name) const;
+
+    // the returned view stays valid for as long as this table does
+    std::string_view name(uint32_t symbol) const;
+    uint32_t size() const;
+
+private:
+    // indexes the names that were given up front
+    void buildIndex();
+
+    std::deque<std::string> storage; // deque so interned strings never move
+    std::vector<std::string_view> names;
+    std::unordered_map<std::string_view, uint32_t> indices;
+    std::shared_ptr<const void> owner;
+    bool indexed = true;
+};
@@ -1,49 +1,44 @@
 #include <Lexer/Lexer.h>
 #include <fstream>
 #include <sstream>
-#include <map>
-#include <ctype.h> // isalpha, isspace, etc...
+#include <array>
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <thread>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 // ----- implementation functions -----
 
-class LexemeImpl
+enum CharClass : uint8_t
 {
-public:
-    typedef std::string::const_iterator iter;
-    LexemeImpl(iter _start, iter _end)
-    {
-        current = _start;
-        end = _end;
+    Other       = 0,
+    WordStart   = 1 << 0, // letters and _?!
+    Digit       = 1 << 1,
+    Space       = 1 << 2,
+    Operator    = 1 << 3, // single-char operators. Others are handled as special cases
+    Word        = WordStart | Digit,
+};
 
-        skipWhitespace();
-        while(!isDone())
-        {
-            int wordLine = line;
-            int wordCol = col;
-            try
-            {
-                getNext();
-            }
-            catch(const std::exception& e)
-            {
-                // append location information to all errors
-                throw LexerError(e.what(), line, col);
-            }
-            
-        }
-    }
+struct CharTable
+{
+    uint8_t classes[256];
+    Lexeme::Type operators[256];
+};
 
-    const std::map<std::string, Lexeme::Type> charToKeyword =
-    {
-        {"function",        Lexeme::Type::KwFunction},
-        {"if",              Lexeme::Type::KwIf},
-        {"while",           Lexeme::Type::KwWhile},
-        {"begin",           Lexeme::Type::KwBegin},
-        {"end",             Lexeme::Type::KwEnd},
-    };
+static constexpr CharTable makeCharTable()
+{
+    CharTable table = {};
+    for(int c = 'a'; c <= 'z'; c++) table.classes[c] = WordStart;
+    for(int c = 'A'; c <= 'Z'; c++) table.classes[c] = WordStart;
+    for(int c = '0'; c <= '9'; c++) table.classes[c] = Digit;
+    table.classes['_'] = table.classes['?'] = table.classes['!'] = WordStart;
+    for(char c : {' ', '\t', '\n', '\v', '\f', '\r'}) table.classes[(uint8_t)c] = Space;
 
-    // only includes single-char operators. Others are handled as special cases
-    const std::map<char, Lexeme::Type> charToOperator =
+    const std::pair<char, Lexeme::Type> operators[] =
     {
         {'+', Lexeme::Type::Plus},
         {'-', Lexeme::Type::Minus},
@@ -57,51 +52,228 @@ public:
         {',', Lexeme::Type::Comma},
         {'.', Lexeme::Type::Period},
     };
+    for(auto op : operators)
+    {
+        table.classes[(uint8_t)op.first] = Operator;
+        table.operators[(uint8_t)op.first] = op.second;
+    }
+    return table;
+}
+
+static constexpr CharTable charTable = makeCharTable();
 
-    void getNext()
+static bool hasClass(char c, uint8_t charClass)
+{
+    return charTable.classes[(uint8_t)c] & charClass;
+}
+
+struct Keyword
+{
+    std::string_view name;
+    Lexeme::Type type;
+};
+
+// Every keyword has a different length + first character + twice the last
+// character (mod 8), so one table probe and one compare decide whether a word
+// is a keyword.
+static constexpr size_t keywordHash(std::string_view word)
+{
+    return (word.size() + (uint8_t)word[0] + 2 * (uint8_t)word.back()) & 7;
+}
+
+static constexpr std::array<Keyword, 8> makeKeywordTable()
+{
+    const Keyword keywords[] =
     {
-        int wordLine = line;
-        int wordCol = col;
+        {"function",        Lexeme::Type::KwFunction},
+        {"if",              Lexeme::Type::KwIf},
+        {"while",           Lexeme::Type::KwWhile},
+        {"begin",           Lexeme::Type::KwBegin},
+        {"end",             Lexeme::Type::KwEnd},
+        {"return",          Lexeme::Type::KwReturn},
+    };
+
+    std::array<Keyword, 8> table = {};
+    for(auto keyword : keywords)
+    {
+        auto &slot = table[keywordHash(keyword.name)];
+        if(!slot.name.empty()) throw "keyword hash collision"; // fails the constexpr evaluation
+        slot = keyword;
+    }
+    return table;
+}
+
+static constexpr std::array<Keyword, 8> keywordTable = makeKeywordTable();
+
+static Lexeme::Type keywordType(std::string_view word)
+{
+    const Keyword &keyword = keywordTable[keywordHash(word)];
+    return keyword.name == word ? keyword.type : Lexeme::Type::Identifier;
+}
+
+// Scanning helpers. Each returns the first position in [p, end) that stops the
+// run. The SSE2 versions classify 16 bytes per step; the scalar loops finish
+// the tail and are used on their own where SSE2 is unavailable.
+
+#ifdef __SSE2__
+static int inRange(__m128i chunk, char low, char high)
+{
+    // signed compares, so bytes >= 0x80 are never in range
+    __m128i above = _mm_cmpgt_epi8(chunk, _mm_set1_epi8(low - 1));
+    __m128i below = _mm_cmplt_epi8(chunk, _mm_set1_epi8(high + 1));
+    return _mm_movemask_epi8(_mm_and_si128(above, below));
+}
+
+static int equal(__m128i chunk, char c)
+{
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, _mm_set1_epi8(c)));
+}
+
+static int trailingZeros(int mask)
+{
+    return __builtin_ctz(mask);
+}
+#endif
 
-        char c = peek();
-        if(isWordChar(c) && !isdigit(c))
+static const char *skipWordChars(const char *p, const char *end)
+{
+#ifdef __SSE2__
+    while(end - p >= 16)
+    {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        __m128i lower = _mm_or_si128(chunk, _mm_set1_epi8(0x20));
+        int word = inRange(lower, 'a', 'z') | inRange(chunk, '0', '9') |
+            equal(chunk, '_') | equal(chunk, '?') | equal(chunk, '!');
+        if(word != 0xFFFF) return p + trailingZeros(~word);
+        p += 16;
+    }
+#endif
+    while(p != end && hasClass(*p, Word)) p++;
+    return p;
+}
+
+static const char *skipSpaces(const char *p, const char *end)
+{
+#ifdef __SSE2__
+    while(end - p >= 16)
+    {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        int space = inRange(chunk, '\t', '\r') | equal(chunk, ' ');
+        if(space != 0xFFFF) return p + trailingZeros(~space);
+        p += 16;
+    }
+#endif
+    while(p != end && hasClass(*p, Space)) p++;
+    return p;
+}
+
+// finds the first of up to three characters (repeat one to look for fewer)
+static const char *findAny(const char *p, const char *end, char a, char b, char c)
+{
+#ifdef __SSE2__
+    while(end - p >= 16)
+    {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        int found = equal(chunk, a) | equal(chunk, b) | equal(chunk, c);
+        if(found != 0) return p + trailingZeros(found);
+        p += 16;
+    }
+#endif
+    while(p != end && *p != a && *p != b && *p != c) p++;
+    return p;
+}
+
+// Produces one lexeme at a time. Identifiers are interned into symbols and
+// strings with escapes are copied into unescapedStrings, both owned by the caller.
+//
+// Nothing but whitespace, comments and strings can span lines, so the line
+// number is only updated when one of those is skipped, by counting the
+// newlines in it. The column is the distance from the start of the line.
+class LexemeImpl
+{
+public:
+    typedef const char *iter;
+    LexemeImpl(std::string_view source, SymbolTable &symbols, std::deque<std::string> &unescapedStrings)
+        : symbols(symbols), unescapedStrings(unescapedStrings)
+    {
+        current = source.data();
+        end = current + source.size();
+        lineStart = current;
+
+        skipWhitespace();
+    }
+
+    // returns an EndOfFile lexeme once the source is used up
+    Lexeme next()
+    {
+        while(!isDone())
         {
-            std::string word = getWord();
-            Lexeme::Type type = Lexeme::Type::Identifier;
-            if(charToKeyword.count(word) == 1)
+            try
             {
-                type = charToKeyword.at(word);
+                if(getNext())
+                {
+                    return lexeme;
+                }
+            }
+            catch(const std::exception& e)
+            {
+                // append location information to all errors
+                throw LexerError(e.what(), line, col());
             }
+        }
+        return Lexeme{std::string_view(), line, col(), Lexeme::Type::EndOfFile};
+    }
 
-            lexemes.push_back(Lexeme{word, wordLine, wordCol, type});
+    // returns false if nothing but a comment was found
+    bool getNext()
+    {
+        int wordLine = line;
+        int wordCol = col();
+
+        char c = *current;
+        uint8_t charClass = charTable.classes[(uint8_t)c];
+        if(charClass & WordStart)
+        {
+            std::string_view word = getWord();
+            Lexeme::Type type = keywordType(word);
+            if(type != Lexeme::Type::Identifier)
+            {
+                produce(Lexeme{word, wordLine, wordCol, type});
+            }
+            else
+            {
+                produce(Lexeme{word, wordLine, wordCol, Lexeme::Type::Identifier, 0, symbols.intern(word)});
+            }
         }
-        else if(isdigit(c) || c == '.')
+        else if((charClass & Digit) || c == '.')
         {
-            lexemes.push_back(Lexeme{getNumber(), wordLine, wordCol, Lexeme::Type::Number});
+            std::string_view number = getNumber();
+            produce(Lexeme{number, wordLine, wordCol, Lexeme::Type::Number, parseNumber(number)});
         }
-        else if(charToOperator.count(c) == 1)
+        else if(charClass & Operator)
         {
-            advance(); // eat the token
+            iter start = current++; // eat the token
             
             if(c == '=' && peek() == '=')
             {
-                advance();
-                lexemes.push_back(Lexeme{"==", wordLine, wordCol, Lexeme::Type::Equality});
+                current++;
+                produce(Lexeme{std::string_view(start, 2), wordLine, wordCol, Lexeme::Type::Equality});
             }
             else
             {
-                auto type = charToOperator.at(c);
-                lexemes.push_back(Lexeme{std::string(1, c), wordLine, wordCol, type});
+                produce(Lexeme{std::string_view(start, 1), wordLine, wordCol, charTable.operators[(uint8_t)c]});
             }
         }
         else if(c == '"')
         {
-            lexemes.push_back(Lexeme{getString(), wordLine, wordCol, Lexeme::Type::String});
+            produce(Lexeme{getString(), wordLine, wordCol, Lexeme::Type::String});
         }
         else if(c == '#')
         {
             // TODO: turn the comment into a token so we can associate documentation with things
             eatComment();
+            skipWhitespace();
+            return false;
         }
         else
         {
@@ -109,28 +281,26 @@ public:
         }
         
         skipWhitespace();
+        return true;
     }
 
-    bool isWordChar(char c) const
+    void produce(const Lexeme &found)
     {
-        return isalnum(c) || c == '_' || c == '?' || c == '!';
+        lexeme = found;
     }
 
-    std::string getWord()
+    std::string_view getWord()
     {
         iter wordStart = current;
-        while(isWordChar(peek()))
-        {
-            advance();
-        }
-        return std::string(wordStart, current);
+        current = skipWordChars(current, end);
+        return std::string_view(wordStart, current - wordStart);
     }
 
-    std::string getNumber()
+    std::string_view getNumber()
     {
         iter wordStart = current;
         bool foundDecimal = false;
-        while(isdigit(peek()) || peek() == '.')
+        while(hasClass(peek(), Digit) || peek() == '.')
         {
             if(peek() == '.')
             {
@@ -143,7 +313,7 @@ public:
                     foundDecimal = true;
                 }
             }
-            advance();
+            current++;
         }
 
         // the case where there is just the decimal
@@ -152,61 +322,94 @@ public:
             throw LexerError("Unexpected token");
         }
 
-        return std::string(wordStart, current);
+        return std::string_view(wordStart, current - wordStart);
+    }
+
+    // from_chars is correctly rounded and ignores the locale, unlike stod
+    double parseNumber(std::string_view number) const
+    {
+        double value = 0;
+        auto result = std::from_chars(number.data(), number.data() + number.size(), value);
+        if(result.ec != std::errc())
+        {
+            throw LexerError("Number is out of range");
+        }
+        return value;
     }
 
-    std::string getString()
+    // strings without escapes are returned as a view of the source. Only strings
+    // with escapes are copied, into unescapedStrings.
+    std::string_view getString()
     {
-        std::string output;
-        advance(); // eat starting quote
+        current++; // eat starting quote
+        iter stringStart = current;
+        moveTo(findAny(current, end, '"', '\\', '\0'));
+
+        if(peek() == '"')
+        {
+            std::string_view contents(stringStart, current - stringStart);
+            current++; // eat ending quote
+            return contents;
+        }
+
+        std::string output(stringStart, current);
         while(peek() != '"')
         {
             if(peek() == '\0')
             {
+                moveTo(end);
                 throw LexerError("String did not terminate");
             }
 
-            if(peek() == '\\')
+            // must be an escape
+            current++;
+            if(isDone())
             {
-                advance();
-                char escaped = advance();
-                if(escaped == 't')
-                {
-                    output.push_back('\t');
-                }
-                else if(escaped == 'n')
-                {
-                    output.push_back('\n');
-                }
-                else
-                {
-                    output.push_back(escaped);
-                }
+                throw LexerError("String did not terminate");
+            }
+            char escaped = *current;
+            moveTo(current + 1);
+            if(escaped == 't')
+            {
+                output.push_back('\t');
+            }
+            else if(escaped == 'n')
+            {
+                output.push_back('\n');
             }
             else
             {
-                output.push_back(advance());
+                output.push_back(escaped);
             }
+
+            iter runStart = current;
+            moveTo(findAny(current, end, '"', '\\', '\0'));
+            output.append(runStart, current);
         }
-        advance(); // eat ending quote
-        return output;
+        current++; // eat ending quote
+        return unescapedStrings.emplace_back(std::move(output));
     }
 
     void eatComment()
     {
-        while(true)
-        {
-            char c = advance();
-            if(c == '\n' || c == '\0') break;
-        }
+        iter stop = findAny(current, end, '\n', '\0', '\0');
+        moveTo(stop == end ? end : stop + 1);
     }
 
     void skipWhitespace()
     {
-        while(isspace(peek()) && !isDone())
+        moveTo(skipSpaces(current, end));
+    }
+
+    // moves forward over text that may contain newlines
+    void moveTo(iter to)
+    {
+        for(iter newline = findAny(current, to, '\n', '\n', '\n'); newline != to; newline = findAny(newline + 1, to, '\n', '\n', '\n'))
         {
-            advance();
+            line += 1;
+            lineStart = newline + 1;
         }
+        current = to;
     }
 
     char peek() const
@@ -215,22 +418,9 @@ public:
         return *current;
     }
 
-    char advance()
+    int col() const
     {
-        if(isDone()) return '\0';
-
-        char t = *current;
-        current++;
-        if(t == '\n')
-        {
-            line += 1;
-            col = 1;
-        }
-        else
-        {
-            col += 1;
-        }
-        return t;
+        return static_cast<int>(current - lineStart) + 1;
     }
 
     bool isDone() const
@@ -239,14 +429,239 @@ public:
     }
 
     int line = 1;
-    int col = 1;
+    iter lineStart;
 
     iter current;
     iter end;
 
-    LexemeList lexemes;
+    SymbolTable &symbols;
+    std::deque<std::string> &unescapedStrings;
+    Lexeme lexeme;
+};
+
+
+
+// ----- parallel lexing -----
+//
+// The source is split into chunks that each start right after a newline, and
+// every chunk is lexed on its own thread as if it started outside of any token.
+// Comments end at newlines, so that guess is only wrong when a string literal
+// spans the boundary. A chunk keeps lexing past its end until a lexeme starts
+// at or after it, so the point where the next chunk really resumes is known.
+// Merging walks the chunks in order: when a chunk resumes exactly where its
+// guess started its lexemes are taken as they are, otherwise it is re-lexed
+// from the real resume point until it lines up with a lexeme the guess found.
+
+// sources are only split when every chunk gets at least this many bytes
+static constexpr size_t MinChunkSize = 64 * 1024;
+
+struct LexedChunk
+{
+    size_t start;       // offset of the first byte of the chunk
+    size_t end;         // offset just past its last byte
+    size_t begin;       // where the first lexeme (or comment) of the guess starts
+    size_t resume;      // where lexing continues after the last lexeme of the guess
+    int lineBase;       // lines before the chunk
+
+    std::vector<Lexeme> lexemes;
+    std::vector<size_t> starts; // offset of each lexeme in lexemes
+    SymbolTable symbols;
+    std::deque<std::string> unescapedStrings;
+
+    // the error the guess stopped at, if any
+    bool failed = false;
+    std::string error;
+    int errorLine = 0;
+    int errorCol = 0;
 };
 
+static void lexChunk(std::string_view source, LexedChunk &chunk)
+{
+    LexemeImpl impl(source.substr(chunk.start), chunk.symbols, chunk.unescapedStrings);
+    const char *base = source.data();
+    const char *chunkEnd = base + chunk.end;
+    chunk.begin = impl.current - base;
+
+    while(!impl.isDone() && impl.current < chunkEnd)
+    {
+        size_t start = impl.current - base;
+        try
+        {
+            if(impl.getNext())
+            {
+                chunk.lexemes.push_back(impl.lexeme);
+                chunk.starts.push_back(start);
+            }
+        }
+        catch(const std::exception &e)
+        {
+            chunk.failed = true;
+            chunk.error = e.what();
+            chunk.errorLine = impl.line;
+            chunk.errorCol = impl.col();
+            break;
+        }
+    }
+    chunk.resume = impl.current - base;
+}
+
+class ChunkMerger
+{
+public:
+    ChunkMerger(std::string_view source, SymbolTable &symbols, std::deque<std::string> &unescapedStrings, std::vector<Lexeme> &output)
+        : source(source), symbols(symbols), unescapedStrings(unescapedStrings), output(output)
+    {}
+
+    void merge(const LexedChunk &chunk)
+    {
+        // only whitespace comes before begin, so the guess started in the right place
+        if(position <= chunk.begin)
+        {
+            takeGuess(chunk, 0);
+            return;
+        }
+
+        // the guess started inside a token of an earlier chunk. Lex for real from
+        // where that token ended until we reach a lexeme the guess also found.
+        LexemeImpl impl(source.substr(chunk.start), symbols, unescapedStrings);
+        impl.moveTo(source.data() + position);
+        const char *chunkEnd = source.data() + chunk.end;
+        auto guess = std::lower_bound(chunk.starts.begin(), chunk.starts.end(), position);
+
+        while(!impl.isDone() && impl.current < chunkEnd)
+        {
+            position = impl.current - source.data();
+            while(guess != chunk.starts.end() && *guess < position) guess++;
+            if(guess != chunk.starts.end() && *guess == position)
+            {
+                takeGuess(chunk, guess - chunk.starts.begin());
+                return;
+            }
+
+            try
+            {
+                if(impl.getNext())
+                {
+                    Lexeme lexeme = impl.lexeme;
+                    lexeme.lineNumber += chunk.lineBase;
+                    output.push_back(lexeme);
+                }
+            }
+            catch(const std::exception &e)
+            {
+                throw LexerError(e.what(), impl.line + chunk.lineBase, impl.col());
+            }
+        }
+        position = impl.current - source.data();
+    }
+
+    // where the last merged chunk stopped lexing
+    size_t position = 0;
+
+private:
+    // appends the guessed lexemes of chunk from first on
+    void takeGuess(const LexedChunk &chunk, size_t first)
+    {
+        // symbols are interned in the order the lexemes appear, which hands out
+        // the same ids as lexing sequentially would
+        std::vector<uint32_t> symbolMap(chunk.symbols.size(), SymbolTable::None);
+        for(size_t i = first; i < chunk.lexemes.size(); i++)
+        {
+            Lexeme lexeme = chunk.lexemes[i];
+            lexeme.lineNumber += chunk.lineBase;
+            if(lexeme.symbol != SymbolTable::None)
+            {
+                uint32_t &symbol = symbolMap[lexeme.symbol];
+                if(symbol == SymbolTable::None) symbol = symbols.intern(lexeme.name);
+                lexeme.symbol = symbol;
+            }
+            if(!isInSource(lexeme.name))
+            {
+                lexeme.name = unescapedStrings.emplace_back(lexeme.name);
+            }
+            output.push_back(lexeme);
+        }
+
+        if(chunk.failed)
+        {
+            throw LexerError(chunk.error, chunk.errorLine + chunk.lineBase, chunk.errorCol);
+        }
+        position = chunk.resume;
+    }
+
+    bool isInSource(std::string_view name) const
+    {
+        return std::less_equal<const char *>()(source.data(), name.data()) &&
+            std::less_equal<const char *>()(name.data() + name.size(), source.data() + source.size());
+    }
+
+    std::string_view source;
+    SymbolTable &symbols;
+    std::deque<std::string> &unescapedStrings;
+    std::vector<Lexeme> &output;
+};
+
+static std::vector<LexedChunk> splitIntoChunks(std::string_view source, unsigned threads)
+{
+    size_t count = std::max<size_t>(1, std::min<size_t>(threads, source.size() / MinChunkSize));
+
+    std::vector<LexedChunk> chunks;
+    size_t start = 0;
+    for(size_t i = 1; i <= count && start < source.size(); i++)
+    {
+        size_t end = source.size();
+        if(i != count)
+        {
+            size_t target = std::max(start, source.size() / count * i);
+            const void *newline = std::memchr(source.data() + target, '\n', source.size() - target);
+            if(newline) end = static_cast<const char *>(newline) - source.data() + 1;
+        }
+
+        chunks.emplace_back();
+        chunks.back().start = start;
+        chunks.back().end = end;
+        start = end;
+    }
+    return chunks;
+}
+
+static void lexInParallel(std::string_view source, unsigned threads, SymbolTable &symbols,
+    std::deque<std::string> &unescapedStrings, std::vector<Lexeme> &lexemes)
+{
+    std::vector<LexedChunk> chunks = splitIntoChunks(source, threads);
+
+    auto work = [&](size_t i)
+    {
+        LexedChunk &chunk = chunks[i];
+        chunk.lineBase = static_cast<int>(std::count(source.data() + chunk.start, source.data() + chunk.end, '\n'));
+        lexChunk(source, chunk);
+    };
+
+    std::vector<std::thread> workers;
+    for(size_t i = 1; i < chunks.size(); i++)
+    {
+        workers.emplace_back(work, i);
+    }
+    work(0);
+    for(auto &worker : workers)
+    {
+        worker.join();
+    }
+
+    // each chunk counted its own newlines, which become the lines before the next
+    int lines = 0;
+    for(auto &chunk : chunks)
+    {
+        std::swap(lines, chunk.lineBase);
+        lines += chunk.lineBase;
+    }
+
+    ChunkMerger merger(source, symbols, unescapedStrings, lexemes);
+    for(const auto &chunk : chunks)
+    {
+        merger.merge(chunk);
+    }
+}
 
 // ----- public functions -----
 
@@ -262,17 +677,79 @@ bool operator ==(const Lexeme &a, const Lexeme &b)
         a.lineNumber == b.lineNumber;
 }
 
-LexemeList Lexer::lexString(const std::string &sourceCode)
+LexemeList::LexemeList(std::initializer_list<Lexeme> lexemes)
+    : lexemes(lexemes)
+{}
+
+LexemeListSource::LexemeListSource(const LexemeList &list)
+    : list(list), current(list.begin()), symbolTable(list.symbols())
+{}
+
+Lexeme LexemeListSource::next()
+{
+    if(current == list.end())
+    {
+        return Lexeme{std::string_view(), -1, -1, Lexeme::Type::EndOfFile};
+    }
+    return *current++;
+}
+
+SymbolTable &LexemeListSource::symbols()
 {
-    return LexemeImpl(sourceCode.begin(), sourceCode.end()).lexemes;
+    return symbolTable;
+}
+
+LexemeStream::LexemeStream(std::string_view sourceCode)
+    : impl(std::make_unique<LexemeImpl>(sourceCode, symbolTable, unescapedStrings))
+{}
+
+LexemeStream::~LexemeStream() = default;
+
+Lexeme LexemeStream::next()
+{
+    return impl->next();
+}
+
+SymbolTable &LexemeStream::symbols()
+{
+    return symbolTable;
+}
+
+LexemeList Lexer::lexString(const std::string &sourceCode, unsigned threads)
+{
+    return lexString(std::string(sourceCode), threads);
+}
+
+LexemeList Lexer::lexString(std::string &&sourceCode, unsigned threads)
+{
+    LexemeList list;
+    list.storage = std::make_shared<LexemeList::Storage>();
+    list.storage->source = std::move(sourceCode);
+
+    if(threads == 0)
+    {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    if(threads > 1)
+    {
+        lexInParallel(list.storage->source, threads, list.symbolTable, list.storage->unescapedStrings, list.lexemes);
+        return list;
+    }
+
+    LexemeImpl impl(list.storage->source, list.symbolTable, list.storage->unescapedStrings);
+    for(Lexeme lexeme = impl.next(); lexeme.type != Lexeme::Type::EndOfFile; lexeme = impl.next())
+    {
+        list.lexemes.push_back(lexeme);
+    }
+    return list;
 }
 
-LexemeList Lexer::lexFile(const std::string &filePath)
+LexemeList Lexer::lexFile(const std::string &filePath, unsigned threads)
 {
-    // TODO: use iterators here too.
     std::ifstream t(filePath);
     std::stringstream buffer;
     buffer << t.rdbuf();
 
-    return lexString(buffer.str());
+    return lexString(buffer.str(), threads);
 }
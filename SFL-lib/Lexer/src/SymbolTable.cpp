@@ -0,0 +1,87 @@
+#include <Lexer/SymbolTable.h>
+
+SymbolTable::SymbolTable(std::vector<std::string_view> names, std::shared_ptr<const void> owner)
+    : names(std::move(names)), owner(std::move(owner)), indexed(false)
+{}
+
+SymbolTable::SymbolTable(const SymbolTable &other)
+{
+    *this = other;
+}
+
+SymbolTable &SymbolTable::operator=(const SymbolTable &other)
+{
+    if(this != &other)
+    {
+        // the views in other point into its own storage, so copy every name.
+        // They are added one by one rather than interned so ids stay the same.
+        storage.clear();
+        names.clear();
+        indices.clear();
+        owner.reset();
+        indexed = true;
+        for(auto name : other.names)
+        {
+            std::string_view stored = storage.emplace_back(name);
+            indices.emplace(stored, size());
+            names.push_back(stored);
+        }
+    }
+    return *this;
+}
+
+uint32_t SymbolTable::intern(std::string_view name)
+{
+    if(!indexed)
+    {
+        buildIndex();
+    }
+
+    auto iter = indices.find(name);
+    if(iter != indices.end())
+    {
+        return iter->second;
+    }
+
+    uint32_t symbol = size();
+    std::string_view stored = storage.emplace_back(name);
+    names.push_back(stored);
+    indices.emplace(stored, symbol);
+    return symbol;
+}
+
+uint32_t SymbolTable::find(std::string_view name) const
+{
+    if(!indexed)
+    {
+        // not indexed yet, and a few lookups are cheaper than indexing everything
+        for(uint32_t symbol = 0; symbol < size(); symbol++)
+        {
+            if(names[symbol] == name) return symbol;
+        }
+        return None;
+    }
+
+    auto iter = indices.find(name);
+    return iter != indices.end() ? iter->second : None;
+}
+
+std::string_view SymbolTable::name(uint32_t symbol) const
+{
+    return names[symbol];
+}
+
+uint32_t SymbolTable::size() const
+{
+    return static_cast<uint32_t>(names.size());
+}
+
+void SymbolTable::buildIndex()
+{
+    indices.reserve(names.size());
+    for(uint32_t symbol = 0; symbol < size(); symbol++)
+    {
+        indices.emplace(names[symbol], symbol);
+    }
+    indexed = true;
+}
@@ -1,4 +1,12 @@
 #include <Parser/Parser.h>
+#include <Parser/ASTCache.h>
+#include <Parser/Optimizer.h>
+
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
 
 #include <gtest/gtest.h>
 // #include <gmock/gmock.h>
@@ -33,10 +41,10 @@ struct TypeTree
 void ASSERT_TREE_EQ(const AST::Node *root, const TypeTree &equivilent)
 {
     ASSERT_EQ(root->type, equivilent.type);
-    ASSERT_EQ(root->children.size(), equivilent.children.size());
-    for(size_t i = 0; i < root->children.size(); i++)
+    ASSERT_EQ(root->childCount, equivilent.children.size());
+    for(size_t i = 0; i < root->childCount; i++)
     {
-        ASSERT_TREE_EQ(root->children[i].get(), equivilent.children[i]);
+        ASSERT_TREE_EQ(root->child(i), equivilent.children[i]);
     }
 }
 
@@ -286,3 +294,279 @@ TEST(Parser, whileStatement)
         })
     );
 }
+
+TEST(Parser, functionStatement)
+{
+    AST ast(Lexer::lexString("function add(a, b) begin return a + b; end function none() begin return; end"));
+
+    ASSERT_TREE_EQ(ast.getRoot(),
+        TREE(Block, {
+            TREE(Function, {
+                TERMINAL(Variable),
+                TERMINAL(Variable),
+                TREE(Block, {
+                    TREE(Return, {
+                        TREE(Add, {
+                            TERMINAL(Variable),
+                            TERMINAL(Variable)
+                        })
+                    })
+                })
+            }),
+            TREE(Function, {
+                TREE(Block, {
+                    TERMINAL(Return)
+                })
+            })
+        })
+    );
+    ASSERT_EQ(ast.name(ast.getRoot()->child(0)), "add");
+    ASSERT_EQ(ast.name(ast.getRoot()->child(0)->child(1)), "b");
+
+    ASSERT_THROW(AST(Lexer::lexString("function f(a b) begin end")), ParserError);
+    ASSERT_THROW(AST(Lexer::lexString("function f(1) begin end")), ParserError);
+    ASSERT_THROW(AST(Lexer::lexString("function f() return 1;")), ParserError);
+    ASSERT_THROW(AST(Lexer::lexString("return 1")), ParserError);
+}
+
+TEST(Parser, stringTree)
+{
+    AST ast(Lexer::lexString("a = 1 + b * 2; print(a, \"s\");"));
+
+    ASSERT_EQ(ast.stringTree(ast.getRoot()),
+        "\n"
+        "  =\n"
+        "    a\n"
+        "    +\n"
+        "      1\n"
+        "      *\n"
+        "        b\n"
+        "        2\n"
+        "  print\n"
+        "    a\n"
+        "    s\n"
+    );
+}
+
+TEST(Parser, nodeData)
+{
+    AST ast(Lexer::lexString("x = 2.5;\nprint(x);"));
+    const AST::Node *assign = ast.getRoot()->child(0);
+    const AST::Node *print = ast.getRoot()->child(1);
+
+    ASSERT_EQ(assign->lineNumber, 1);
+    ASSERT_EQ(assign->colPosition, 3);
+    ASSERT_EQ(assign->child(1)->number, 2.5);
+    ASSERT_EQ(print->lineNumber, 2);
+    ASSERT_EQ(ast.name(print), "print");
+
+    // both uses of x share one name
+    ASSERT_EQ(assign->child(0)->name, print->child(0)->name);
+    ASSERT_EQ(ast.name(print->child(0)), "x");
+}
+
+TEST(Parser, stream)
+{
+    const std::string src = "i = 0; while i == 0 begin print(\"a\\tb\", i); i = 1; end";
+    LexemeStream lexemes(src);
+    AST streamed(lexemes);
+    AST listed(Lexer::lexString(src));
+
+    ASSERT_EQ(streamed.stringTree(streamed.getRoot()), listed.stringTree(listed.getRoot()));
+    ASSERT_EQ(streamed.name(streamed.getRoot()->child(1)->child(1)->child(0)->child(0)), "a\tb");
+}
+
+TEST(Parser, unexpectedEnd)
+{
+    ASSERT_THROW(AST(Lexer::lexString("a = 1")), ParserError);
+    ASSERT_THROW(AST(Lexer::lexString("print(1")), ParserError);
+    ASSERT_THROW(AST(Lexer::lexString("if a begin")), ParserError);
+
+    LexemeStream lexemes("a = ");
+    ASSERT_THROW(AST{lexemes}, ParserError);
+}
+
+std::string optimizedTree(const std::string &src, const OptimizerOptions &options = OptimizerOptions())
+{
+    AST ast(Lexer::lexString(src));
+    Optimizer::optimize(ast, options);
+    return ast.stringTree(ast.getRoot());
+}
+
+TEST(Optimizer, foldConstants)
+{
+    ASSERT_EQ(optimizedTree("a = 60 * 60 * 24 - 0.5;"), "\n  =\n    a\n    86399.5\n");
+    ASSERT_EQ(optimizedTree("a = 1 / 4 + (2 == 2);"), "\n  =\n    a\n    1.25\n");
+    ASSERT_EQ(optimizedTree("a = \"x\" + \"y\" + \"z\";"), "\n  =\n    a\n    xyz\n");
+    ASSERT_EQ(optimizedTree("a = (\"x\" == \"x\") + b;"), "\n  =\n    a\n    +\n      1\n      b\n");
+
+    // only operators with literal operands, and never ones that would fail
+    ASSERT_EQ(optimizedTree("a = b * 2 * 3;"), "\n  =\n    a\n    *\n      *\n        b\n        2\n      3\n");
+    ASSERT_EQ(optimizedTree("a = 1 + \"x\";"), "\n  =\n    a\n    +\n      1\n      x\n");
+    ASSERT_EQ(optimizedTree("a = \"x\" * \"y\";"), "\n  =\n    a\n    *\n      x\n      y\n");
+
+    AST ast(Lexer::lexString("a = 0.1 + 0.2;"));
+    Optimizer::optimize(ast);
+    ASSERT_EQ(ast.getRoot()->child(0)->child(1)->type, AST::Node::Type::Number);
+    ASSERT_EQ(ast.getRoot()->child(0)->child(1)->number, 0.1 + 0.2);
+}
+
+TEST(Optimizer, pruneBranches)
+{
+    // the body of an always-taken if becomes a plain block
+    AST ast(Lexer::lexString("if 1 == 1 begin a = 1; b = 2; end c = 3;"));
+    Optimizer::optimize(ast);
+    ASSERT_TREE_EQ(ast.getRoot(),
+        TREE(Block, {
+            TREE(Block, {
+                TREE(Assign, {
+                    TERMINAL(Variable),
+                    TERMINAL(Number)
+                }),
+                TREE(Assign, {
+                    TERMINAL(Variable),
+                    TERMINAL(Number)
+                }),
+            }),
+            TREE(Assign, {
+                TERMINAL(Variable),
+                TERMINAL(Number)
+            }),
+        })
+    );
+
+    ASSERT_EQ(optimizedTree("if 1 == 0 begin a = 1; end"), "\n  if\n");
+    ASSERT_EQ(optimizedTree("if 2 begin a = 1; end"), "\n  if\n");
+    ASSERT_EQ(optimizedTree("if \"\" begin a = 1; end"), "\n  if\n");
+    ASSERT_EQ(optimizedTree("while 0 begin a = 1; end"), "\n  while\n");
+    ASSERT_EQ(optimizedTree("while \"x\" == \"y\" begin a = 1; end"), "\n  while\n");
+
+    // conditions that are not known stay
+    ASSERT_EQ(optimizedTree("if a begin b = 1; end"), "\n  if\n    a\n    begin\n      =\n        b\n        1\n");
+    ASSERT_EQ(optimizedTree("while 1 == 2 begin a = 1; end", {true, true, false}), "\n  while\n    0\n    begin\n      =\n        a\n        1\n");
+}
+
+TEST(Optimizer, switches)
+{
+    const std::string src = "if (2 * 3) == 6 begin a = 1; end";
+    const std::string unoptimized = optimizedTree(src, {false, false, false});
+    AST ast(Lexer::lexString(src));
+    ASSERT_EQ(unoptimized, ast.stringTree(ast.getRoot()));
+
+    ASSERT_EQ(optimizedTree(src, {true, false, false}), "\n  if\n    1\n    begin\n      =\n        a\n        1\n");
+    ASSERT_EQ(optimizedTree(src, {false, true, true}), unoptimized);
+    ASSERT_EQ(optimizedTree(src), "\n  begin\n    =\n      a\n      1\n");
+}
+
+TEST(ASTCache, roundTrip)
+{
+    const std::string src = "x = 2.5;\nwhile x == 2.5 begin print(\"a\\tb\", x); x = 1; end";
+    const std::string path = testing::TempDir() + "roundTrip.sfl";
+    std::remove((path + ".sflc").c_str());
+    AST parsed(Lexer::lexString(src));
+
+    ASTCache cache;
+    ASSERT_EQ(cache.entryPath(path, src), path + ".sflc");
+    ASSERT_FALSE(cache.load(path, src));
+    ASSERT_TRUE(cache.store(path, src, parsed));
+
+    std::optional<AST> loaded = cache.load(path, src);
+    ASSERT_TRUE(loaded);
+    ASSERT_EQ(loaded->stringTree(loaded->getRoot()), parsed.stringTree(parsed.getRoot()));
+    ASSERT_EQ(loaded->symbols().size(), parsed.symbols().size());
+    ASSERT_EQ(loaded->symbols().find("print"), parsed.symbols().find("print"));
+    ASSERT_EQ(loaded->symbols().find("missing"), SymbolTable::None);
+
+    const AST::Node *assign = loaded->getRoot()->child(0);
+    ASSERT_EQ(assign->lineNumber, 1);
+    ASSERT_EQ(assign->colPosition, 3);
+    ASSERT_EQ(assign->child(1)->number, 2.5);
+
+    // a loaded AST can still be optimized, which copies it out of the mapping
+    Optimizer::optimize(*loaded);
+    AST optimized(Lexer::lexString(src));
+    Optimizer::optimize(optimized);
+    ASSERT_EQ(loaded->stringTree(loaded->getRoot()), optimized.stringTree(optimized.getRoot()));
+
+    // and an entry can be written from a loaded AST
+    ASSERT_TRUE(ASTCache::write(path + ".copy", 7, *cache.load(path, src)));
+    ASSERT_TRUE(ASTCache::read(path + ".copy", 7));
+}
+
+TEST(ASTCache, directory)
+{
+    const std::string directory = testing::TempDir() + "sfl-cache";
+    ASTCache cache(directory);
+    const std::string src = "a = 1;";
+    AST parsed(Lexer::lexString(src));
+
+    // entries are found by content, not by where the source was
+    ASSERT_EQ(cache.entryPath("one.sfl", src), cache.entryPath("two.sfl", src));
+    ASSERT_NE(cache.entryPath("one.sfl", src), cache.entryPath("one.sfl", "a = 2;"));
+    ASSERT_TRUE(cache.store("one.sfl", src, parsed));
+    ASSERT_TRUE(cache.load("two.sfl", src));
+    ASSERT_FALSE(cache.load("two.sfl", "a = 2;"));
+}
+
+TEST(ASTCache, rejectsBadEntries)
+{
+    const std::string src = "a = \"x\" + b;";
+    const std::string path = testing::TempDir() + "bad.sflc";
+    AST parsed(Lexer::lexString(src));
+    ASSERT_TRUE(ASTCache::write(path, ASTCache::hash(src), parsed));
+    ASSERT_TRUE(ASTCache::read(path, ASTCache::hash(src)));
+
+    // for other source
+    ASSERT_FALSE(ASTCache::read(path, ASTCache::hash(src + " ")));
+    ASSERT_FALSE(ASTCache::read(path + ".missing", ASTCache::hash(src)));
+
+    std::string entry;
+    {
+        std::ifstream in(path, std::ios::binary);
+        entry.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+    auto readModified = [&](std::string modified)
+    {
+        std::ofstream(path, std::ios::binary | std::ios::trunc).write(modified.data(), modified.size());
+        return ASTCache::read(path, ASTCache::hash(src)).has_value();
+    };
+
+    ASSERT_TRUE(readModified(entry));
+    ASSERT_FALSE(readModified(entry.substr(0, entry.size() - 1)));
+    ASSERT_FALSE(readModified(entry + "x"));
+    ASSERT_FALSE(readModified(entry.substr(0, 20)));
+
+    // another format version
+    std::string version = entry;
+    version[4]++;
+    ASSERT_FALSE(readModified(version));
+
+    // a child offset that points past the end
+    std::string child = entry;
+    int32_t offset = 1000;
+    std::memcpy(&child[48 + offsetof(AST::Node, childOffset)], &offset, sizeof(offset));
+    ASSERT_FALSE(readModified(child));
+
+    // nodes with fewer children than their type needs
+    const AST::Node *root = parsed.getRoot();
+    const AST::Node *assign = root->child(0);
+    const AST::Node *add = assign->child(1);
+    auto withChildCount = [&](const AST::Node *node, uint32_t count)
+    {
+        std::string modified = entry;
+        size_t at = 48 + (node - root) * sizeof(AST::Node) + offsetof(AST::Node, childCount);
+        std::memcpy(&modified[at], &count, sizeof(count));
+        return modified;
+    };
+    ASSERT_TRUE(readModified(withChildCount(assign, 2)));
+    ASSERT_FALSE(readModified(withChildCount(assign, 1)));
+    ASSERT_FALSE(readModified(withChildCount(assign, 0)));
+    ASSERT_FALSE(readModified(withChildCount(add, 1)));
+
+    // an assignment to something other than a variable
+    std::string target = entry;
+    AST::Node::Type number = AST::Node::Type::Number;
+    size_t at = 48 + (assign->child(0) - root) * sizeof(AST::Node) + offsetof(AST::Node, type);
+    std::memcpy(&target[at], &number, sizeof(number));
+    ASSERT_FALSE(readModified(target));
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <Parser/Parser.h>
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+// Keeps parsed programs on disk so that running the same source again skips
+// lexing and parsing. An entry is a copy of the AST's node array and symbol
+// names, and loading one maps the file and uses the nodes where they lie.
+//
+// Entries are checked against a hash of the source and the format they were
+// written in. One that does not match, or is damaged, is treated as missing.
+class ASTCache
+{
+public:
+    // changes whenever the file layout or AST::Node does
+    static constexpr uint32_t FormatVersion = 2;
+
+    // entries are kept in directory, or next to each source as <source>.sflc if it is empty
+    explicit ASTCache(std::string directory = "");
+
+    // the file the entry for source, read from sourcePath, lives in
+    std::string entryPath(const std::string &sourcePath, std::string_view source) const;
+
+    // returns nothing if there is no usable entry for source
+    std::optional<AST> load(const std::string &sourcePath, std::string_view source) const;
+
+    // returns false if the entry could not be written. A cache that cannot be
+    // written to only makes later runs slower, so this never throws.
+    bool store(const std::string &sourcePath, std::string_view source, const AST &ast) const;
+
+    static uint64_t hash(std::string_view source);
+
+    // the entry file itself, for callers that manage their own paths
+    static bool write(const std::string &path, uint64_t sourceHash, const AST &ast);
+    static std::optional<AST> read(const std::string &path, uint64_t sourceHash);
+
+private:
+    std::string directory;
+};
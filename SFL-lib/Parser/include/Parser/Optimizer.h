@@ -0,0 +1,31 @@
+#pragma once
+
+#include <Parser/Parser.h>
+
+// Which rewrites the Optimizer makes. They are all on by default.
+struct OptimizerOptions
+{
+    // evaluates operators whose operands are all literals, e.g. 60 * 60 or "a" + "b".
+    // Operations that would raise an error are left for run time.
+    bool foldConstants = true;
+
+    // replaces an if with a literal condition by its body, or by nothing.
+    // Inside a function, an if that assigns to a variable is never removed,
+    // as the assignment is what makes that variable local to the function.
+    bool pruneIfs = true;
+
+    // removes while loops whose condition is a literal that is false, except
+    // those that assign to a variable inside a function, as for ifs
+    bool pruneWhiles = true;
+};
+
+// Rewrites an AST in place into one that runs the same but does less work.
+// Programs that compile behave exactly as they would unoptimized at run time,
+// including which errors they raise and when. Pruned code is never compiled,
+// though, so errors the compiler would have found in it, such as a call to an
+// unknown function or a function defined inside an if, are not reported.
+class Optimizer
+{
+public:
+    static void optimize(AST &ast, const OptimizerOptions &options = OptimizerOptions());
+};
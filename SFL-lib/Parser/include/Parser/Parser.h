@@ -4,20 +4,15 @@
 #include <string>
 #include <vector>
 #include <memory>
+#include <cstdint>
 
+// The AST is stored as one flat array of nodes. The children of a node are
+// laid out next to each other so they can be reached with a relative offset.
 class AST
 {
 public:
-    struct Node;
-    typedef std::vector<std::unique_ptr<AST::Node> > NodeList;
-    
     struct Node
     {
-        std::string stringTree() const;
-
-        Lexeme lexeme;
-        NodeList children;
-
         enum class Type : int
         {
             Error = -1,
@@ -39,23 +34,73 @@ public:
             Variable,
             Number,
             String,
-            
+
             FunctionCall,
+
+            // children are the parameters as Variables, then the body Block
+            Function,
+            // the returned expression is the only child, if there is one
+            Return,
         } type;
+
+        uint32_t childCount;
+        int32_t childOffset; // distance from this node to its first child
+
+        // symbol of the identifier, string contents or operator in the AST's symbols
+        uint32_t name;
+
+        // where the lexeme this node came from starts
+        int32_t lineNumber;
+        int32_t colPosition;
+
+        // the decoded value of Number nodes
+        double number;
+
+        const Node *child(size_t i) const { return this + childOffset + i; }
     };
-    
+
     AST(const LexemeList &lexemes);
 
+    // pulls lexemes from the source as it parses instead of needing them all up front
+    AST(LexemeSource &lexemes);
+
     // AST is the owner of this pointer
     const Node *getRoot() const;
 
+    // identifiers keep the symbol ids they were given by the lexer
+    const SymbolTable &symbols() const;
+    std::string_view name(const Node *node) const;
+
+    std::string stringTree(const Node *node) const;
+
 private:
-    std::unique_ptr<Node> root;
+    friend class Parser;
+    friend class OptimizerImpl;
+    friend class ASTCache;
+
+    // uses nodes where they are, with mapping keeping them alive
+    AST(const Node *nodes, size_t count, SymbolTable symbols, std::shared_ptr<const void> mapping);
+
+    // copies mapped nodes into nodes the first time they need to change
+    std::vector<Node> &mutableNodes();
+
+    std::vector<Node> nodes;
+    SymbolTable symbolTable;
+
+    // set instead of nodes when the AST is used straight from a cache file
+    const Node *mappedNodes = nullptr;
+    size_t mappedCount = 0;
+    std::shared_ptr<const void> mapping;
 };
 
 class ParserError : public std::runtime_error
 {
 public:
     ParserError(std::string error, Lexeme lexeme = {});
+
+    // name views a copy owned by the error, so it outlives the source code
     Lexeme lexeme;
+
+private:
+    std::shared_ptr<const std::string> name;
 };
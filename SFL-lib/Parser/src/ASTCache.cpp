@@ -0,0 +1,281 @@
+#include <Parser/ASTCache.h>
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// An entry is laid out as
+//
+//     Header
+//     AST::Node nodes[nodeCount]
+//     uint32_t symbolOffsets[symbolCount + 1]   where each name starts in text
+//     char text[textSize]                       every name, back to back
+//
+// Nodes are written exactly as they are in memory, so an entry can only be read
+// by a build with the same Node layout and byte order. The header records both.
+namespace
+{
+    typedef AST::Node Node;
+
+    constexpr char Magic[4] = {'S', 'F', 'L', 'C'};
+    constexpr uint32_t ByteOrderMark = 0x01020304;
+
+    struct Header
+    {
+        char magic[4];
+        uint32_t version;
+        uint32_t nodeSize;
+        uint32_t byteOrder;
+        uint64_t sourceHash;
+        uint64_t nodeCount;
+        uint64_t symbolCount;
+        uint64_t textSize;
+    };
+
+    static_assert(std::is_trivially_copyable<Node>::value, "nodes are written as raw bytes");
+    static_assert(sizeof(Header) % alignof(Node) == 0, "nodes must be aligned in the mapping");
+
+    std::string hexHash(uint64_t hash)
+    {
+        char digits[17];
+        std::snprintf(digits, sizeof(digits), "%016llx", static_cast<unsigned long long>(hash));
+        return digits;
+    }
+
+    // whether a node has the children the parser gives its type, which the
+    // compiler relies on without checking. The children are known to exist.
+    bool validShape(const Node &node)
+    {
+        auto childIs = [&](uint32_t i, Node::Type type)
+        {
+            return node.child(i)->type == type;
+        };
+
+        switch(node.type)
+        {
+        case Node::Type::Block:
+        case Node::Type::FunctionCall:
+            return true;
+
+        case Node::Type::If:
+        case Node::Type::While:
+            return node.childCount == 2 && childIs(1, Node::Type::Block);
+
+        case Node::Type::Assign:
+            return node.childCount == 2 && childIs(0, Node::Type::Variable);
+
+        case Node::Type::Add:
+        case Node::Type::Subtract:
+        case Node::Type::Multiply:
+        case Node::Type::Divide:
+        case Node::Type::Equals:
+            return node.childCount == 2;
+
+        case Node::Type::Function:
+            if(node.childCount == 0 || !childIs(node.childCount - 1, Node::Type::Block))
+            {
+                return false;
+            }
+            for(uint32_t i = 0; i + 1 < node.childCount; i++)
+            {
+                if(!childIs(i, Node::Type::Variable)) return false;
+            }
+            return true;
+
+        case Node::Type::Return:
+            return node.childCount <= 1;
+
+        default:
+            return node.childCount == 0;
+        }
+    }
+
+    // every child and name a node refers to must be inside the entry, and
+    // every node must be shaped as the parser would have made it
+    bool validNodes(const Node *nodes, uint64_t nodeCount, uint64_t symbolCount)
+    {
+        for(uint64_t i = 0; i < nodeCount; i++)
+        {
+            const Node &node = nodes[i];
+            if(node.type < Node::Type::Error || node.type > Node::Type::Return ||
+               node.name >= symbolCount)
+            {
+                return false;
+            }
+            if(node.childCount != 0 &&
+               (node.childOffset <= 0 || i + node.childOffset + node.childCount > nodeCount))
+            {
+                return false;
+            }
+            if(!validShape(node))
+            {
+                return false;
+            }
+        }
+        return nodes[0].type == Node::Type::Block;
+    }
+}
+
+ASTCache::ASTCache(std::string directory)
+    : directory(std::move(directory))
+{}
+
+std::string ASTCache::entryPath(const std::string &sourcePath, std::string_view source) const
+{
+    if(directory.empty())
+    {
+        return sourcePath + ".sflc";
+    }
+    return directory + "/" + hexHash(hash(source)) + ".sflc";
+}
+
+std::optional<AST> ASTCache::load(const std::string &sourcePath, std::string_view source) const
+{
+    return read(entryPath(sourcePath, source), hash(source));
+}
+
+bool ASTCache::store(const std::string &sourcePath, std::string_view source, const AST &ast) const
+{
+    if(!directory.empty())
+    {
+        // only the last level is created; a missing parent means a mistyped path
+        ::mkdir(directory.c_str(), 0777);
+    }
+    return write(entryPath(sourcePath, source), hash(source), ast);
+}
+
+uint64_t ASTCache::hash(std::string_view source)
+{
+    // FNV-1a
+    uint64_t value = 0xcbf29ce484222325ull;
+    for(unsigned char c : source)
+    {
+        value = (value ^ c) * 0x100000001b3ull;
+    }
+    return value;
+}
+
+bool ASTCache::write(const std::string &path, uint64_t sourceHash, const AST &ast)
+{
+    const SymbolTable &symbols = ast.symbols();
+    const Node *nodes = ast.getRoot();
+    uint64_t nodeCount = ast.mappedNodes ? ast.mappedCount : ast.nodes.size();
+
+    std::vector<uint32_t> offsets;
+    offsets.reserve(symbols.size() + 1);
+    uint64_t textSize = 0;
+    for(uint32_t symbol = 0; symbol < symbols.size(); symbol++)
+    {
+        offsets.push_back(static_cast<uint32_t>(textSize));
+        textSize += symbols.name(symbol).size();
+        if(textSize > UINT32_MAX) return false;
+    }
+    offsets.push_back(static_cast<uint32_t>(textSize));
+
+    Header header;
+    std::memcpy(header.magic, Magic, sizeof(Magic));
+    header.version = FormatVersion;
+    header.nodeSize = sizeof(Node);
+    header.byteOrder = ByteOrderMark;
+    header.sourceHash = sourceHash;
+    header.nodeCount = nodeCount;
+    header.symbolCount = symbols.size();
+    header.textSize = textSize;
+
+    // written beside the entry and renamed over it, so a reader never sees half a file
+    std::string temporary = path + ".tmp" + std::to_string(::getpid());
+    {
+        std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char *>(nodes), static_cast<std::streamsize>(nodeCount * sizeof(Node)));
+        out.write(reinterpret_cast<const char *>(offsets.data()), static_cast<std::streamsize>(offsets.size() * sizeof(uint32_t)));
+        for(uint32_t symbol = 0; symbol < symbols.size(); symbol++)
+        {
+            std::string_view name = symbols.name(symbol);
+            out.write(name.data(), static_cast<std::streamsize>(name.size()));
+        }
+        out.close();
+        if(!out)
+        {
+            std::remove(temporary.c_str());
+            return false;
+        }
+    }
+    if(std::rename(temporary.c_str(), path.c_str()) != 0)
+    {
+        std::remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+std::optional<AST> ASTCache::read(const std::string &path, uint64_t sourceHash)
+{
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+    {
+        return std::nullopt;
+    }
+    struct stat info;
+    if(::fstat(fd, &info) != 0 || static_cast<uint64_t>(info.st_size) < sizeof(Header))
+    {
+        ::close(fd);
+        return std::nullopt;
+    }
+    size_t size = static_cast<size_t>(info.st_size);
+    void *data = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if(data == MAP_FAILED)
+    {
+        return std::nullopt;
+    }
+    std::shared_ptr<const void> mapping(data, [size](const void *data)
+    {
+        ::munmap(const_cast<void *>(data), size);
+    });
+
+    const char *bytes = static_cast<const char *>(data);
+    Header header;
+    std::memcpy(&header, bytes, sizeof(header));
+    if(std::memcmp(header.magic, Magic, sizeof(Magic)) != 0 || header.version != FormatVersion ||
+       header.nodeSize != sizeof(Node) || header.byteOrder != ByteOrderMark ||
+       header.sourceHash != sourceHash)
+    {
+        return std::nullopt;
+    }
+
+    // each count is checked against what is left before it is multiplied, so
+    // nothing overflows. There is always at least the root node.
+    uint64_t left = size - sizeof(Header);
+    if(header.nodeCount == 0 || header.nodeCount > left / sizeof(Node)) return std::nullopt;
+    left -= header.nodeCount * sizeof(Node);
+    if(header.symbolCount >= left / sizeof(uint32_t)) return std::nullopt;
+    left -= (header.symbolCount + 1) * sizeof(uint32_t);
+    if(header.textSize != left) return std::nullopt;
+
+    const Node *nodes = reinterpret_cast<const Node *>(bytes + sizeof(Header));
+    const uint32_t *offsets = reinterpret_cast<const uint32_t *>(nodes + header.nodeCount);
+    const char *text = reinterpret_cast<const char *>(offsets + header.symbolCount + 1);
+
+    if(offsets[0] != 0 || offsets[header.symbolCount] != header.textSize) return std::nullopt;
+    std::vector<std::string_view> names;
+    names.reserve(header.symbolCount);
+    for(uint64_t symbol = 0; symbol < header.symbolCount; symbol++)
+    {
+        if(offsets[symbol + 1] < offsets[symbol]) return std::nullopt;
+        names.emplace_back(text + offsets[symbol], offsets[symbol + 1] - offsets[symbol]);
+    }
+    if(!validNodes(nodes, header.nodeCount, header.symbolCount))
+    {
+        return std::nullopt;
+    }
+
+    SymbolTable symbols(std::move(names), mapping);
+    return AST(nodes, header.nodeCount, std::move(symbols), std::move(mapping));
+}
@@ -0,0 +1,196 @@
+#include <Parser/Optimizer.h>
+
+#include <string>
+
+// Nodes are only ever rewritten in place. A node that is replaced by one of its
+// children copies that child and one that goes away becomes an empty Block,
+// which leaves the nodes it used to point at unreachable but keeps the layout.
+class OptimizerImpl
+{
+public:
+    typedef AST::Node Node;
+
+    OptimizerImpl(AST &ast, const OptimizerOptions &options)
+        : ast(ast), options(options)
+    {
+        std::vector<Node> &nodes = ast.mutableNodes();
+        if(!nodes.empty())
+        {
+            visit(nodes.data());
+        }
+    }
+
+private:
+    void visit(Node *node)
+    {
+        bool function = node->type == Node::Type::Function;
+        if(function) functionDepth++;
+        for(uint32_t i = 0; i < node->childCount; i++)
+        {
+            visit(child(node, i));
+        }
+        if(function) functionDepth--;
+
+        switch(node->type)
+        {
+        case Node::Type::Add:
+        case Node::Type::Subtract:
+        case Node::Type::Multiply:
+        case Node::Type::Divide:
+        case Node::Type::Equals:
+            if(options.foldConstants) fold(node);
+            break;
+
+        case Node::Type::If:
+            if(options.pruneIfs) pruneIf(node);
+            break;
+
+        case Node::Type::While:
+            if(options.pruneWhiles) pruneWhile(node);
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    // mirrors the Value operations, skipping anything that would throw
+    void fold(Node *node)
+    {
+        Node *a = child(node, 0);
+        Node *b = child(node, 1);
+
+        if(a->type == Node::Type::Number && b->type == Node::Type::Number)
+        {
+            double result = 0;
+            switch(node->type)
+            {
+            case Node::Type::Add:       result = a->number + b->number; break;
+            case Node::Type::Subtract:  result = a->number - b->number; break;
+            case Node::Type::Multiply:  result = a->number * b->number; break;
+            case Node::Type::Divide:    result = a->number / b->number; break;
+            default:                    result = a->number == b->number ? 1 : 0; break;
+            }
+            makeNumber(node, result);
+        }
+        else if(a->type == Node::Type::String && b->type == Node::Type::String)
+        {
+            if(node->type == Node::Type::Add)
+            {
+                std::string result(ast.name(a));
+                result.append(ast.name(b));
+                makeLeaf(node, Node::Type::String, ast.symbolTable.intern(result));
+            }
+            else if(node->type == Node::Type::Equals)
+            {
+                makeNumber(node, ast.name(a) == ast.name(b) ? 1 : 0);
+            }
+        }
+    }
+
+    void pruneIf(Node *node)
+    {
+        int condition = literalTruth(child(node, 0));
+        if(condition == 1)
+        {
+            // the body block takes the if's place
+            Node *body = child(node, 1);
+            int32_t bodyChildren = static_cast<int32_t>(body + body->childOffset - node);
+            *node = *body;
+            node->childOffset = bodyChildren;
+        }
+        else if(condition == 0 && !declaresLocals(node))
+        {
+            makeEmptyBlock(node);
+        }
+    }
+
+    void pruneWhile(Node *node)
+    {
+        if(literalTruth(child(node, 0)) == 0 && !declaresLocals(node))
+        {
+            makeEmptyBlock(node);
+        }
+    }
+
+    // The compiler makes every variable assigned in a function body a local of
+    // that function, even where the assignment never runs, so such code has to
+    // stay for the variable to keep its scope.
+    bool declaresLocals(Node *node)
+    {
+        return functionDepth > 0 && assigns(node);
+    }
+
+    bool assigns(Node *node)
+    {
+        if(node->type == Node::Type::Assign)
+        {
+            return true;
+        }
+        for(uint32_t i = 0; i < node->childCount; i++)
+        {
+            if(assigns(child(node, i))) return true;
+        }
+        return false;
+    }
+
+    // 1 or 0 for literals as Value::asBool sees them, -1 for anything else
+    int literalTruth(const Node *node) const
+    {
+        if(node->type == Node::Type::Number)
+        {
+            return node->number == 1;
+        }
+        else if(node->type == Node::Type::String)
+        {
+            return !ast.name(node).empty();
+        }
+        return -1;
+    }
+
+    void makeNumber(Node *node, double value)
+    {
+        makeLeaf(node, Node::Type::Number, ast.symbolTable.intern(numberName(value)));
+        node->number = value;
+    }
+
+    void makeEmptyBlock(Node *node)
+    {
+        makeLeaf(node, Node::Type::Block, node->name);
+    }
+
+    void makeLeaf(Node *node, Node::Type type, uint32_t name)
+    {
+        node->type = type;
+        node->childCount = 0;
+        node->childOffset = 0;
+        node->name = name;
+    }
+
+    // so stringTree shows folded numbers the way they would be written
+    static std::string numberName(double value)
+    {
+        std::string str = std::to_string(value);
+        size_t decimal = str.find('.');
+        if(decimal != std::string::npos)
+        {
+            str.erase(str.find_last_not_of('0') + 1);
+            if(str.back() == '.') str.pop_back();
+        }
+        return str;
+    }
+
+    Node *child(Node *node, size_t i)
+    {
+        return node + node->childOffset + i;
+    }
+
+    AST &ast;
+    const OptimizerOptions &options;
+    int functionDepth = 0;
+};
+
+void Optimizer::optimize(AST &ast, const OptimizerOptions &options)
+{
+    OptimizerImpl(ast, options);
+}
@@ -1,52 +1,52 @@
 #include <Parser/Parser.h>
 #include <optional>
 
-std::unique_ptr<AST::Node> makeNode(Lexeme lexeme, AST::Node::Type type, AST::NodeList children = {})
-{
-    auto node = std::make_unique<AST::Node>();
-    node->lexeme = lexeme;
-    node->type = type;
-    node->children = std::move(children);
-
-    return node;
-}
-
 #ifdef PARSE_DEBUG
-#define ParseLog(x) std::cout << x << " : " << current->name << "\n";
+#define ParseLog(x) std::cout << x << " : " << window[0].name << "\n";
 #else
 #define ParseLog(x)
 #endif
 
+// Lexemes are pulled from the source as they are needed, so at most the two
+// in the lookahead window exist at once.
+//
+// Nodes are first built in the order the parser finishes them, with the
+// children of each node listed in childIndices. Once the whole tree is known
+// it is laid out breadth first so that siblings end up next to each other.
 class Parser
 {
 public:
-    typedef LexemeList::const_iterator iter;
+    typedef uint32_t NodeIndex;
 
-    Parser(iter _start, iter _end)
+    Parser(LexemeSource &lexemes, AST &ast) : lexemes(lexemes), ast(ast)
     {
-        current = _start;
-        end = _end;
+        window[0] = lexemes.next();
+        window[1] = lexemes.next();
 
-        root = makeNode(Lexeme{"", 1, 1, Lexeme::Type::KwBegin}, AST::Node::Type::Block, program());
+        size_t childrenStart = pending.size();
+        program();
+        NodeIndex root = makeNode(Lexeme{"", 1, 1, Lexeme::Type::KwBegin}, AST::Node::Type::Block, childrenStart);
         if(peek() == Lexeme::Type::KwEnd)
         {
             // special case where the program() function ended seeing the 'end' keyword
-            throw ParserError("Unexpected 'end' keyword found", *current);
+            throw ParserError("Unexpected 'end' keyword found", window[0]);
         }
+
+        layout(root);
+        ast.symbolTable = std::move(lexemes.symbols());
     }
 
-    AST::NodeList program()
+    // leaves the statements on the pending stack for the caller to collect
+    void program()
     {
         ParseLog("program");
-        AST::NodeList statements;
         while(peek() != Lexeme::Type::KwEnd && peek() != Lexeme::Type::EndOfFile)
         {
-            statements.push_back(statement());
+            pending.push_back(statement());
         }
-        return statements;
     }
 
-    std::unique_ptr<AST::Node> statement()
+    NodeIndex statement()
     {
         ParseLog("statement");
         if(peek() == Lexeme::Type::KwIf)
@@ -59,7 +59,11 @@ public:
         }
         else if(peek() == Lexeme::Type::KwFunction)
         {
-            throw ParserError("Not Implemented");
+            return functionStatement();
+        }
+        else if(peek() == Lexeme::Type::KwReturn)
+        {
+            return returnStatement();
         }
         else if(peek(1) == Lexeme::Type::Assign)
         {
@@ -73,111 +77,139 @@ public:
         }
     }
 
-    std::unique_ptr<AST::Node> ifStatement()
+    NodeIndex ifStatement()
     {
         ParseLog("ifStatement");
+        size_t childrenStart = pending.size();
         auto ifLexeme = expect(Lexeme::Type::KwIf);
-        auto expressionNode = expression();
-        auto blockNode = block();
-        AST::NodeList children;
-        children.push_back(std::move(expressionNode));
-        children.push_back(std::move(blockNode));
-        return makeNode(*ifLexeme, AST::Node::Type::If, std::move(children));
+        pending.push_back(expression());
+        pending.push_back(block());
+        return makeNode(ifLexeme, AST::Node::Type::If, childrenStart);
     }
 
-    std::unique_ptr<AST::Node> whileStatement()
+    NodeIndex whileStatement()
     {
         ParseLog("whileStatement");
+        size_t childrenStart = pending.size();
         auto whileLexeme = expect(Lexeme::Type::KwWhile);
-        auto expressionNode = expression();
-        auto blockNode = block();
-        AST::NodeList children;
-        children.push_back(std::move(expressionNode));
-        children.push_back(std::move(blockNode));
-        return makeNode(*whileLexeme, AST::Node::Type::While, std::move(children));
+        pending.push_back(expression());
+        pending.push_back(block());
+        return makeNode(whileLexeme, AST::Node::Type::While, childrenStart);
+    }
+
+    NodeIndex functionStatement()
+    {
+        ParseLog("functionStatement");
+        size_t childrenStart = pending.size();
+        expect(Lexeme::Type::KwFunction);
+        auto name = expect(Lexeme::Type::Identifier);
+        expect(Lexeme::Type::LParentheses);
+        bool first = true;
+        while(peek() != Lexeme::Type::RParentheses)
+        {
+            if(first)
+            {
+                first = false;
+            }
+            else
+            {
+                expect(Lexeme::Type::Comma);
+            }
+            pending.push_back(makeNode(expect(Lexeme::Type::Identifier), AST::Node::Type::Variable));
+        }
+        expect(Lexeme::Type::RParentheses);
+        pending.push_back(block());
+        return makeNode(name, AST::Node::Type::Function, childrenStart);
+    }
+
+    NodeIndex returnStatement()
+    {
+        ParseLog("returnStatement");
+        size_t childrenStart = pending.size();
+        auto returnLexeme = expect(Lexeme::Type::KwReturn);
+        if(peek() != Lexeme::Type::Semicolon)
+        {
+            pending.push_back(expression());
+        }
+        expect(Lexeme::Type::Semicolon);
+        return makeNode(returnLexeme, AST::Node::Type::Return, childrenStart);
     }
 
-    std::unique_ptr<AST::Node> block()
+    NodeIndex block()
     {
         ParseLog("block");
+        size_t childrenStart = pending.size();
         auto startNode = expect(Lexeme::Type::KwBegin);
-        auto statements = program();
+        program();
         expect(Lexeme::Type::KwEnd);
-        return makeNode(*startNode, AST::Node::Type::Block, std::move(statements));
+        return makeNode(startNode, AST::Node::Type::Block, childrenStart);
     }
 
 
-    std::unique_ptr<AST::Node> assignment()
+    NodeIndex assignment()
     {
         ParseLog("assignment");
+        size_t childrenStart = pending.size();
         auto identifier = expect(Lexeme::Type::Identifier);
         auto assign = expect(Lexeme::Type::Assign);
-        auto expressionNode = expression();
+        pending.push_back(makeNode(identifier, AST::Node::Type::Variable));
+        pending.push_back(expression());
         expect(Lexeme::Type::Semicolon);
-        AST::NodeList children;
-        children.push_back(makeNode(*identifier, AST::Node::Type::Variable));
-        children.push_back(std::move(expressionNode));
-        return makeNode(*assign, AST::Node::Type::Assign, std::move(children));
+        return makeNode(assign, AST::Node::Type::Assign, childrenStart);
     }
 
 
-    std::unique_ptr<AST::Node> expression()
+    NodeIndex expression()
     {
         ParseLog("expression");
         auto rootNode = term();
         while(peek() == Lexeme::Type::Plus || peek() == Lexeme::Type::Minus)
         {
-            auto lhsTermNode = std::move(rootNode);
+            size_t childrenStart = pending.size();
+            pending.push_back(rootNode);
             auto operatorLexeme = advance();
-            auto rhsTermNode = term();
-            AST::NodeList children;
-            children.push_back(std::move(lhsTermNode));
-            children.push_back(std::move(rhsTermNode));
+            pending.push_back(term());
             auto parserType = (operatorLexeme.type == Lexeme::Type::Plus) ? AST::Node::Type::Add : AST::Node::Type::Subtract;
-            rootNode = makeNode(operatorLexeme, parserType, std::move(children));
+            rootNode = makeNode(operatorLexeme, parserType, childrenStart);
         }
 
         return rootNode;
     }
 
-    std::unique_ptr<AST::Node> term()
+    NodeIndex term()
     {
         ParseLog("term");
         auto rootNode = factor();
         while(peek() == Lexeme::Type::Multiply || peek() == Lexeme::Type::Divide)
         {
-            auto lhsFactorNode = std::move(rootNode);
+            size_t childrenStart = pending.size();
+            pending.push_back(rootNode);
             auto operatorLexeme = advance();
-            auto rhsFactorNode = factor();
-            AST::NodeList children;
-            children.push_back(std::move(lhsFactorNode));
-            children.push_back(std::move(rhsFactorNode));
+            pending.push_back(factor());
             auto parserType = (operatorLexeme.type == Lexeme::Type::Multiply) ? AST::Node::Type::Multiply : AST::Node::Type::Divide;
-            rootNode = makeNode(operatorLexeme, parserType, std::move(children));
+            rootNode = makeNode(operatorLexeme, parserType, childrenStart);
         }
 
         return rootNode;
     }
 
-    std::unique_ptr<AST::Node> factor()
+    NodeIndex factor()
     {
         ParseLog("factor");
         auto rootNode = booleanTerm();
         while(peek() == Lexeme::Type::Equality)
         {
-            auto lhsBooleanTermNode = std::move(rootNode);
+            size_t childrenStart = pending.size();
+            pending.push_back(rootNode);
             auto operatorLexeme = advance();
-            auto rhsBooleanTermNode = booleanTerm();
-            AST::NodeList children;
-            children.push_back(std::move(lhsBooleanTermNode));
-            children.push_back(std::move(rhsBooleanTermNode));
-            rootNode = makeNode(operatorLexeme, AST::Node::Type::Equals, std::move(children));
+            pending.push_back(booleanTerm());
+            rootNode = makeNode(operatorLexeme, AST::Node::Type::Equals, childrenStart);
         }
 
         return rootNode;
     }
 
-    std::unique_ptr<AST::Node> booleanTerm()
+    NodeIndex booleanTerm()
     {
         ParseLog("booleanTerm");
         if(peek() == Lexeme::Type::LParentheses)
@@ -192,24 +224,24 @@ public:
             }
             else
             {
-                return makeNode(*expect(Lexeme::Type::Identifier), AST::Node::Type::Variable);
+                return makeNode(expect(Lexeme::Type::Identifier), AST::Node::Type::Variable);
             }
         }
         else if(peek() == Lexeme::Type::Number)
         {
-            return makeNode(*expect(Lexeme::Type::Number), AST::Node::Type::Number);
+            return makeNode(expect(Lexeme::Type::Number), AST::Node::Type::Number);
         }
         else if(peek() == Lexeme::Type::String)
         {
-            return makeNode(*expect(Lexeme::Type::String), AST::Node::Type::String);
+            return makeNode(expect(Lexeme::Type::String), AST::Node::Type::String);
         }
         else
         {
-            throw ParserError("Expected expression", *current);
+            throw ParserError("Expected expression", window[0]);
         }
     }
 
-    std::unique_ptr<AST::Node> group()
+    NodeIndex group()
     {
         ParseLog("group");
         expect(Lexeme::Type::LParentheses);
@@ -219,11 +251,11 @@ public:
         return expressionNode;
     }
 
-    std::unique_ptr<AST::Node> functionCall()
+    NodeIndex functionCall()
     {
         ParseLog("functionCall");
+        size_t childrenStart = pending.size();
         auto functionNameLexeme = expect(Lexeme::Type::Identifier);
-        std::vector<std::unique_ptr<AST::Node>> children;
         expect(Lexeme::Type::LParentheses);
         bool first = true;
         while(peek() != Lexeme::Type::RParentheses)
@@ -236,66 +268,109 @@ public:
             {
                 expect(Lexeme::Type::Comma);
             }
-            children.push_back(expression());
+            pending.push_back(expression());
         }
         expect(Lexeme::Type::RParentheses);
 
-        return makeNode(*functionNameLexeme, AST::Node::Type::FunctionCall, std::move(children));
+        return makeNode(functionNameLexeme, AST::Node::Type::FunctionCall, childrenStart);
     }
 
 
     std::optional<Lexeme> accept(Lexeme::Type type)
     {
         ParseLog("accept/expect: " << (int)type);
-        if(current->type == type)
+        if(window[0].type == type)
         {
             return std::optional<Lexeme>(advance());
         }
         return std::nullopt;
     }
 
-    std::optional<Lexeme> expect(Lexeme::Type type)
+    Lexeme expect(Lexeme::Type type)
     {
         auto lexemeOpt = accept(type);
         if(!lexemeOpt)
         {
-            throw ParserError("Unexpected token. Was expecting: " + std::to_string((int)type), *current);
+            throw ParserError("Unexpected token. Was expecting: " + std::to_string((int)type), window[0]);
         }
 
-        return lexemeOpt;
+        return *lexemeOpt;
     }
 
     Lexeme advance()
     {
-        Lexeme tmp = *current;
-        current++;
+        Lexeme tmp = window[0];
+        window[0] = window[1];
+        window[1] = lexemes.next();
         return tmp;
     }
 
+    // n can be at most 1
     Lexeme::Type peek(int n = 0) const
     {
-        iter peek = current;
-        while(n > 0)
+        return window[n].type;
+    }
+
+    NodeIndex makeNode(const Lexeme &lexeme, AST::Node::Type type)
+    {
+        return makeNode(lexeme, type, pending.size());
+    }
+
+    // the children of the new node are the entries of pending from childrenStart onwards
+    NodeIndex makeNode(const Lexeme &lexeme, AST::Node::Type type, size_t childrenStart)
+    {
+        AST::Node node;
+        node.type = type;
+        node.childCount = static_cast<uint32_t>(pending.size() - childrenStart);
+        node.childOffset = static_cast<int32_t>(childIndices.size()); // fixed up by layout()
+        node.name = lexeme.symbol != SymbolTable::None ? lexeme.symbol : lexemes.symbols().intern(lexeme.name);
+        node.lineNumber = lexeme.lineNumber;
+        node.colPosition = lexeme.colPosition;
+        node.number = lexeme.number;
+
+        childIndices.insert(childIndices.end(), pending.begin() + childrenStart, pending.end());
+        pending.resize(childrenStart);
+
+        nodes.push_back(node);
+        return static_cast<NodeIndex>(nodes.size() - 1);
+    }
+
+    // breadth first copy into the AST so the children of every node are adjacent
+    void layout(NodeIndex root)
+    {
+        std::vector<NodeIndex> order;
+        order.reserve(nodes.size());
+        ast.nodes.reserve(nodes.size());
+
+        order.push_back(root);
+        ast.nodes.push_back(nodes[root]);
+        for(size_t i = 0; i < ast.nodes.size(); i++)
         {
-            if(peek == end) return Lexeme::Type::EndOfFile;
-            peek++;
-            n--;
+            AST::Node &node = ast.nodes[i];
+            const NodeIndex *children = childIndices.data() + nodes[order[i]].childOffset;
+            node.childOffset = static_cast<int32_t>(ast.nodes.size() - i);
+            for(uint32_t child = 0; child < node.childCount; child++)
+            {
+                order.push_back(children[child]);
+                ast.nodes.push_back(nodes[children[child]]);
+            }
         }
-        if(peek == end) return Lexeme::Type::EndOfFile;
-        return peek->type;
     }
 
-    iter current;
-    iter end;
+    LexemeSource &lexemes;
+    Lexeme window[2];
 
-    std::unique_ptr<AST::Node> root;
+    AST &ast;
+    std::vector<AST::Node> nodes;
+    std::vector<NodeIndex> childIndices;
+    std::vector<NodeIndex> pending; // children collected for nodes that are still being parsed
 };
 
-std::string AST::Node::stringTree() const
+std::string AST::stringTree(const Node *root) const
 {
     std::vector<std::pair<const AST::Node *, int> > stack;
     std::string output;
-    stack.push_back({this, 0});
+    stack.push_back({root, 0});
     while(stack.size() > 0)
     {
         auto pair = stack.back();
@@ -305,12 +380,13 @@ std::string AST::Node::stringTree() const
         
         for(int i = 0;i < indent; i++) output.append("  ");
 
-        for(auto iter = node->children.rbegin(); iter != node->children.rend(); iter++)
+        for(uint32_t i = node->childCount; i > 0; i--)
         {
-            stack.push_back({iter->get(), indent + 1});
+            stack.push_back({node->child(i - 1), indent + 1});
         }
 
-        output.append(node->lexeme.name + "\n");
+        output.append(name(node));
+        output.append("\n");
     }
 
     return output;
@@ -318,14 +394,49 @@ std::string AST::Node::stringTree() const
 
 AST::AST(const LexemeList &lexemes)
 {
-    root = std::move(Parser(lexemes.begin(), lexemes.end()).root);
+    LexemeListSource source(lexemes);
+    Parser(source, *this);
+}
+
+AST::AST(LexemeSource &lexemes)
+{
+    Parser(lexemes, *this);
 }
 
+AST::AST(const Node *nodes, size_t count, SymbolTable symbols, std::shared_ptr<const void> mapping)
+    : symbolTable(std::move(symbols)), mappedNodes(nodes), mappedCount(count), mapping(std::move(mapping))
+{}
+
 const AST::Node *AST::getRoot() const
 {
-    return root.get();
+    return mappedNodes ? mappedNodes : nodes.data();
+}
+
+std::vector<AST::Node> &AST::mutableNodes()
+{
+    if(mappedNodes)
+    {
+        nodes.assign(mappedNodes, mappedNodes + mappedCount);
+        mappedNodes = nullptr;
+        mappedCount = 0;
+        // the symbol table holds its own reference for the names that view the mapping
+        mapping.reset();
+    }
+    return nodes;
+}
+
+const SymbolTable &AST::symbols() const
+{
+    return symbolTable;
+}
+
+std::string_view AST::name(const Node *node) const
+{
+    return symbolTable.name(node->name);
 }
 
 ParserError::ParserError(std::string error, Lexeme lexeme)
-    : std::runtime_error(error), lexeme(lexeme)
-{}
+    : std::runtime_error(error), lexeme(lexeme), name(std::make_shared<const std::string>(lexeme.name))
+{
+    this->lexeme.name = *name;
+}
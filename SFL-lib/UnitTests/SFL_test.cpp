@@ -0,0 +1,140 @@
+#include <SFL/BatchRunner.h>
+
+#include <algorithm>
+#include <string>
+
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+using namespace ::testing;
+
+static std::string countTo(int n)
+{
+    return "i = 0; while (i == " + std::to_string(n) + ") == 0 begin i = i + 1; end print(i);";
+}
+
+TEST(BatchRunner, results)
+{
+    std::vector<std::string> sources;
+    for(int i = 0; i < 100; i++)
+    {
+        sources.push_back(i % 9 == 0 ? "print(1 + \"a\");" : countTo(i * 10));
+    }
+    sources.push_back("a = ;");
+    sources.push_back("print(\"unterminated);");
+
+    BatchRunner runner(4);
+    ASSERT_EQ(runner.workerCount(), 4u);
+    for(bool stealing : {true, false})
+    {
+        runner.setStealing(stealing);
+        std::vector<BatchResult> results = runner.run(sources);
+        ASSERT_EQ(results.size(), sources.size());
+        for(int i = 0; i < 100; i++)
+        {
+            if(i % 9 == 0)
+            {
+                ASSERT_THAT(results[i].error, HasSubstr("Cannot addition"));
+                ASSERT_EQ(results[i].output, "");
+            }
+            else
+            {
+                ASSERT_EQ(results[i].error, "");
+                ASSERT_EQ(results[i].output, std::to_string(i * 10));
+            }
+            ASSERT_LT(results[i].worker, 4u);
+            ASSERT_GE(results[i].seconds, 0);
+        }
+        ASSERT_EQ(results[100].error, "Expected expression");
+        ASSERT_EQ(results[101].error, "String did not terminate");
+
+        const BatchStats &stats = runner.getStats();
+        ASSERT_EQ(stats.jobs.size(), 4u);
+        ASSERT_EQ(stats.busySeconds.size(), 4u);
+        uint32_t total = 0;
+        for(unsigned worker = 0; worker < 4; worker++)
+        {
+            total += stats.jobs[worker];
+            // without stealing every worker runs exactly the quarter it was given
+            if(!stealing)
+            {
+                ASSERT_THAT(stats.jobs[worker], AnyOf(25u, 26u));
+            }
+        }
+        ASSERT_EQ(total, sources.size());
+        ASSERT_GE(stats.utilization(), 0);
+        ASSERT_LE(stats.utilization(), 1.01);
+        if(!stealing)
+        {
+            ASSERT_EQ(stats.steals, 0u);
+        }
+    }
+}
+
+TEST(BatchRunner, stealing)
+{
+    // a lone worker has nobody to steal from
+    std::vector<std::string> sources(40, countTo(3));
+    BatchRunner runner(1);
+    ASSERT_EQ(runner.run(sources).size(), 40u);
+    ASSERT_EQ(runner.getStats().steals, 0u);
+
+    // the first quarter is long, so a static split leaves the other workers idle
+    sources.clear();
+    for(int i = 0; i < 64; i++)
+    {
+        sources.push_back(countTo(i < 16 ? 20000 : 10));
+    }
+    BatchRunner four(4);
+    four.setStealing(false);
+    std::vector<BatchResult> results = four.run(sources);
+    for(int i = 0; i < 16; i++)
+    {
+        ASSERT_EQ(results[i].worker, 0u);
+    }
+
+    // with stealing the others take long jobs off the first worker once their own are done
+    four.setStealing(true);
+    results = four.run(sources);
+    std::vector<unsigned> longJobs(4);
+    for(int i = 0; i < 64; i++)
+    {
+        ASSERT_EQ(results[i].output, i < 16 ? "20000" : "10");
+        if(i < 16)
+        {
+            longJobs[results[i].worker]++;
+        }
+    }
+    ASSERT_EQ(four.getStats().jobs.size(), 4u);
+    ASSERT_GT(four.getStats().steals, 0u);
+    ASSERT_LT(longJobs[0], 16u);
+    ASSERT_GE(std::count_if(longJobs.begin(), longJobs.end(), [](unsigned count) { return count > 0; }), 2);
+
+    ASSERT_TRUE(four.run({}).empty());
+    ASSERT_EQ(four.getStats().steals, 0u);
+}
+
+TEST(BatchRunner, limits)
+{
+    std::vector<std::string> sources = {countTo(10), "while 1 begin end", countTo(100000), "print(\"x\");"};
+    BatchRunner runner(2);
+
+    runner.setFuelLimit(100000);
+    std::vector<BatchResult> results = runner.run(sources);
+    ASSERT_EQ(results[0].output, "10");
+    ASSERT_THAT(results[1].error, HasSubstr("fuel"));
+    ASSERT_THAT(results[2].error, HasSubstr("fuel"));
+    ASSERT_EQ(results[3].output, "x");
+
+    runner.setFuelLimit(UINT64_MAX);
+    runner.setTimeLimit(0.05);
+    results = runner.run(sources);
+    ASSERT_EQ(results[0].output, "10");
+    ASSERT_THAT(results[1].error, HasSubstr("time"));
+    ASSERT_LT(results[1].seconds, 2);
+    ASSERT_EQ(results[3].output, "x");
+
+    // scripts cannot load native code either
+    results = runner.run({"dll_import(\"libm.so.6\"); print(1);"});
+    ASSERT_THAT(results[0].error, HasSubstr("foreign imports are turned off"));
+    ASSERT_EQ(results[0].output, "");
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+class WorkerPool;
+
+struct BatchResult
+{
+    std::string output; // everything the script printed
+    std::string error;  // empty if the script ran to the end
+    double seconds = 0; // lexing, parsing and running
+    unsigned worker = 0;
+};
+
+struct BatchStats
+{
+    double seconds = 0;               // from the start of the batch until its last job finished
+    std::vector<double> busySeconds;  // per worker, spent running jobs
+    std::vector<uint32_t> jobs;       // per worker, jobs run
+    uint64_t steals = 0;              // times a worker took jobs from another
+
+    // how much of the workers' time went into jobs, from 0 to 1
+    double utilization() const;
+};
+
+// Runs batches of independent scripts on a WorkerPool. Each script
+// is lexed, parsed and run by whichever worker gets to it, with its own
+// Interpreter.
+//
+// A batch starts out split evenly over the workers' queues. A worker takes jobs
+// from the back of its own queue, and once that is empty it steals half the
+// jobs from the front of another's. A batch with a few long scripts therefore
+// still keeps every worker busy until the end.
+class BatchRunner
+{
+public:
+    // the thread calling run is a worker too, so count - 1 threads are
+    // started. A count of 0 means one per hardware thread.
+    explicit BatchRunner(unsigned count = 0);
+    ~BatchRunner();
+
+    BatchRunner(const BatchRunner &) = delete;
+    BatchRunner &operator=(const BatchRunner &) = delete;
+
+    // runs every source and returns when all have finished, with results in the same order
+    std::vector<BatchResult> run(const std::vector<std::string> &sources);
+
+    // On by default. Without stealing each worker only runs the jobs it was
+    // given at the start, which is only useful to compare against.
+    void setStealing(bool enabled);
+
+    // Limits for each script, which fails if it reaches one, so a script that
+    // never ends cannot hold on to a worker. The time includes lexing and
+    // parsing. Neither is set by default, and a time of 0 means none.
+    void setFuelLimit(uint64_t fuel);
+    void setTimeLimit(double seconds);
+
+    // about the last batch run
+    const BatchStats &getStats() const;
+
+    unsigned workerCount() const;
+
+private:
+    struct Batch;
+
+    void runBatch(Batch &batch, unsigned worker);
+
+    std::unique_ptr<WorkerPool> pool;
+    bool stealing = true;
+    uint64_t fuel = UINT64_MAX;
+    std::chrono::steady_clock::duration timeLimit = std::chrono::steady_clock::duration::zero();
+    BatchStats stats;
+};
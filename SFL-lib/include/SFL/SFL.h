@@ -1,7 +1,17 @@
 #pragma once
 
+#include <string>
+
 class SFL
 {
 public:
     static void test();
+
+    // runs the program in the file at path. Its parsed form is cached next to
+    // it, or in $SFL_CACHE_DIR if that is set, unless $SFL_NO_CACHE is set.
+    static void runFile(const std::string &path);
+
+    // reads statements from stdin and runs each as soon as it is complete,
+    // keeping globals for the whole session
+    static void repl();
 };
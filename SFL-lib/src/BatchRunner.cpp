@@ -0,0 +1,208 @@
+#include <SFL/BatchRunner.h>
+
+#include <Parser/Parser.h>
+#include <Parser/Optimizer.h>
+#include <Interpreter/Interpreter.h>
+#include <Interpreter/WorkerPool.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
+
+typedef std::chrono::steady_clock Clock;
+
+static double secondsSince(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+struct BatchRunner::Batch
+{
+    // Jobs are indices into sources. The owner of a queue works from the back
+    // and thieves take from the front, so they only meet on the last few jobs.
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<size_t> jobs;
+        double busySeconds = 0; // only touched by the owner
+        uint32_t jobsRun = 0;
+    };
+
+    Batch(const std::vector<std::string> &sources, unsigned workers, bool stealing, uint64_t fuel,
+          Clock::duration timeLimit)
+        : sources(sources), results(sources.size()), queues(new Queue[workers]), workers(workers), stealing(stealing),
+          fuel(fuel), timeLimit(timeLimit)
+    {
+        for(unsigned worker = 0; worker < workers; worker++)
+        {
+            size_t begin = sources.size() * worker / workers;
+            size_t end = sources.size() * (worker + 1) / workers;
+            for(size_t job = begin; job < end; job++)
+            {
+                queues[worker].jobs.push_back(job);
+            }
+        }
+    }
+
+    // returns false once there is nothing left for worker to take
+    bool next(unsigned worker, size_t &job)
+    {
+        Queue &own = queues[worker];
+        while(true)
+        {
+            {
+                std::lock_guard<std::mutex> lock(own.mutex);
+                if(!own.jobs.empty())
+                {
+                    job = own.jobs.back();
+                    own.jobs.pop_back();
+                    return true;
+                }
+            }
+            if(!stealing || !steal(worker))
+            {
+                return false;
+            }
+        }
+    }
+
+    // Moves half the jobs of the first other worker that has any into the
+    // queue of worker. No jobs are ever added to a batch, so once every queue
+    // has been found empty there is no more work.
+    bool steal(unsigned worker)
+    {
+        std::vector<size_t> taken;
+        for(unsigned i = 1; i < workers && taken.empty(); i++)
+        {
+            Queue &victim = queues[(worker + i) % workers];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            size_t count = (victim.jobs.size() + 1) / 2;
+            taken.assign(victim.jobs.begin(), victim.jobs.begin() + count);
+            victim.jobs.erase(victim.jobs.begin(), victim.jobs.begin() + count);
+        }
+        if(taken.empty())
+        {
+            return false;
+        }
+
+        steals++;
+        Queue &own = queues[worker];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        own.jobs.insert(own.jobs.end(), taken.begin(), taken.end());
+        return true;
+    }
+
+    const std::vector<std::string> &sources;
+    std::vector<BatchResult> results;
+    std::unique_ptr<Queue[]> queues;
+    unsigned workers;
+    bool stealing;
+    uint64_t fuel;              // for each job
+    Clock::duration timeLimit;  // for each job, none if zero
+    std::atomic<uint64_t> steals{0};
+    Clock::time_point start = Clock::now();
+};
+
+double BatchStats::utilization() const
+{
+    double busy = 0;
+    for(double worker : busySeconds)
+    {
+        busy += worker;
+    }
+    return seconds > 0 && !busySeconds.empty() ? busy / (seconds * busySeconds.size()) : 0;
+}
+
+BatchRunner::BatchRunner(unsigned count)
+    : pool(std::make_unique<WorkerPool>(count))
+{}
+
+BatchRunner::~BatchRunner() = default;
+
+std::vector<BatchResult> BatchRunner::run(const std::vector<std::string> &sources)
+{
+    Batch current(sources, workerCount(), stealing, fuel, timeLimit);
+    if(!sources.empty())
+    {
+        pool->run([&](unsigned worker) { runBatch(current, worker); });
+    }
+
+    // every worker is done, so nothing touches the queues' counters any more
+    stats = BatchStats();
+    stats.seconds = secondsSince(current.start);
+    stats.steals = current.steals;
+    for(unsigned worker = 0; worker < current.workers; worker++)
+    {
+        stats.busySeconds.push_back(current.queues[worker].busySeconds);
+        stats.jobs.push_back(current.queues[worker].jobsRun);
+    }
+    return std::move(current.results);
+}
+
+void BatchRunner::setStealing(bool enabled)
+{
+    stealing = enabled;
+}
+
+void BatchRunner::setFuelLimit(uint64_t limit)
+{
+    fuel = limit;
+}
+
+void BatchRunner::setTimeLimit(double seconds)
+{
+    timeLimit = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+}
+
+const BatchStats &BatchRunner::getStats() const
+{
+    return stats;
+}
+
+unsigned BatchRunner::workerCount() const
+{
+    return pool->workerCount();
+}
+
+void BatchRunner::runBatch(Batch &current, unsigned worker)
+{
+    Batch::Queue &own = current.queues[worker];
+    size_t job;
+    while(current.next(worker, job))
+    {
+        Clock::time_point start = Clock::now();
+        BatchResult &result = current.results[job];
+        try
+        {
+            LexemeStream lexemes(current.sources[job]);
+            AST ast(lexemes);
+            Optimizer::optimize(ast);
+            Interpreter interpreter;
+            interpreter.setOutput(OutputSink::memory(result.output));
+            RunLimits limits = RunLimits::withFuel(current.fuel);
+            if(current.timeLimit > Clock::duration::zero())
+            {
+                limits.deadline = start + current.timeLimit;
+            }
+            RunStatus status = interpreter.run(ast, limits);
+            if(status == RunStatus::OutOfFuel)
+            {
+                result.error = "Stopped after running out of fuel";
+            }
+            else if(status == RunStatus::PastDeadline)
+            {
+                result.error = "Stopped after running out of time";
+            }
+        }
+        catch(const std::exception &e)
+        {
+            result.error = e.what();
+        }
+        result.seconds = secondsSince(start);
+        result.worker = worker;
+        own.busySeconds += result.seconds;
+        own.jobsRun++;
+    }
+}
@@ -1,10 +1,53 @@
 #include <SFL/SFL.h>
 
 #include <Parser/Parser.h>
+#include <Parser/ASTCache.h>
+#include <Parser/Optimizer.h>
 #include <Interpreter/Interpreter.h>
+#include <Interpreter/InterpreterError.h>
+#include <Interpreter/Repl.h>
 
 #include <string>
+#include <fstream>
 #include <iostream>
+#include <iterator>
+#include <optional>
+#include <cstdlib>
+
+#include <unistd.h>
+
+namespace
+{
+    void execute(const AST &ast, std::string_view program)
+    {
+        Interpreter interpreter;
+        interpreter.setProfiling(std::getenv("SFL_PROFILE") != nullptr);
+        interpreter.setJit(std::getenv("SFL_JIT") != nullptr);
+        // the script is the user's own, so it may load libraries like any program they run
+        interpreter.setForeignImports(true);
+        interpreter.run(ast);
+        if(auto profiler = interpreter.getProfiler())
+        {
+            profiler->report(std::cerr, program);
+        }
+        // std::cout << ast.stringTree(ast.getRoot()) << std::endl;
+    }
+
+    void reportError(const ParserError& e)
+    {
+        std::cerr << e.what() << '\n';
+        std::cerr << "name (" << e.lexeme.name << ") line:col (" << e.lexeme.lineNumber << ":" << e.lexeme.colPosition << ") type (" << (int)e.lexeme.type << ")" << '\n';
+    }
+
+    void reportError(const InterpreterError& e)
+    {
+        std::cerr << e.what() << '\n';
+        if(e.lineNumber >= 0)
+        {
+            std::cerr << "line:col (" << e.lineNumber << ":" << e.colPosition << ")" << '\n';
+        }
+    }
+}
 
 void SFL::test()
 {
@@ -21,13 +64,106 @@ void SFL::test()
             }
         }
 
-        AST ast(Lexer::lexString(program));
-        Interpreter().run(ast);
-        // std::cout << ast.getRoot()->stringTree() << std::endl;
+        LexemeStream lexemes(program);
+        AST ast(lexemes);
+        Optimizer::optimize(ast);
+        execute(ast, program);
     }
     catch(const ParserError& e)
     {
-        std::cerr << e.what() << '\n';
-        std::cerr << "name (" << e.lexeme.name << ") line:col (" << e.lexeme.lineNumber << ":" << e.lexeme.colPosition << ") type (" << (int)e.lexeme.type << ")" << '\n';
+        reportError(e);
+    }
+    catch(const InterpreterError& e)
+    {
+        reportError(e);
+    }
+}
+
+void SFL::runFile(const std::string &path)
+{
+    std::ifstream file(path, std::ios::binary);
+    if(!file)
+    {
+        std::cerr << "Could not open " << path << '\n';
+        return;
+    }
+    std::string program((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    try
+    {
+        const char *directory = std::getenv("SFL_CACHE_DIR");
+        ASTCache cache(directory ? directory : "");
+        bool useCache = std::getenv("SFL_NO_CACHE") == nullptr;
+
+        std::optional<AST> ast;
+        if(useCache)
+        {
+            ast = cache.load(path, program);
+        }
+        if(!ast)
+        {
+            LexemeStream lexemes(program);
+            ast.emplace(lexemes);
+            Optimizer::optimize(*ast);
+            if(useCache)
+            {
+                cache.store(path, program, *ast);
+            }
+        }
+        execute(*ast, program);
+    }
+    catch(const ParserError& e)
+    {
+        reportError(e);
+    }
+    catch(const InterpreterError& e)
+    {
+        reportError(e);
+    }
+}
+
+void SFL::repl()
+{
+    Repl repl;
+    repl.getInterpreter().setJit(std::getenv("SFL_JIT") != nullptr);
+    repl.getInterpreter().setForeignImports(true);
+
+    // prompts would only get in the way of piped input
+    bool interactive = ::isatty(STDIN_FILENO);
+
+    // print does not end lines, so one is added before the next prompt when needed
+    bool midLine = false;
+    repl.getInterpreter().setOutput(OutputSink([&midLine](std::string_view text)
+    {
+        std::cout.write(text.data(), static_cast<std::streamsize>(text.size()));
+        std::cout.flush();
+        midLine = text.back() != '\n';
+    }));
+    Repl::Status status = Repl::Status::Ran;
+    std::string line;
+    while(true)
+    {
+        if(interactive)
+        {
+            std::cout << (status == Repl::Status::Incomplete ? "... " : "> ") << std::flush;
+        }
+        if(!std::getline(std::cin, line))
+        {
+            break;
+        }
+        status = repl.feed(line);
+        if(status == Repl::Status::Failed)
+        {
+            std::cerr << repl.getError() << '\n';
+        }
+        if(interactive && midLine)
+        {
+            std::cout << '\n';
+            midLine = false;
+        }
+    }
+    if(status == Repl::Status::Incomplete)
+    {
+        std::cerr << "Input ended part way through a statement\n";
     }
 }